@@ -0,0 +1,62 @@
+#include "ActionEnvelope.h"
+
+ActionEnvelope::ActionEnvelope(std::string_view serviceType, std::string_view action, std::span<const std::string_view> arguments)
+    : action(action)
+    , arguments(arguments.begin(), arguments.end())
+{
+    headers.append("CONTENT-TYPE: text/xml; charset=\"utf-8\"\r\nSOAPACTION: \"").append(serviceType).append("#").append(action).append("\"\r\n");
+
+    std::string piece = "<?xml version=\"1.0\"?>\r\n<s:Envelope xmlns:s=\"http://schemas.xmlsoap.org/soap/envelope/\" "
+        "s:encodingStyle=\"http://schemas.xmlsoap.org/soap/encoding/\"><s:Body>";
+    piece.append("<u:").append(action).append(" xmlns:u=\"").append(serviceType).append("\">");
+    for (std::string_view argument : arguments)
+    {
+        piece.append("<").append(argument).append(">");
+        pieces.push_back(std::move(piece));
+        piece.assign("</").append(argument).append(">");
+    }
+    piece.append("</u:").append(action).append("></s:Body></s:Envelope>\r\n");
+    pieces.push_back(std::move(piece));
+
+    for (const std::string& constant : pieces)
+        constantLength += constant.size();
+}
+
+void ActionEnvelope::Write(std::string& out, std::span<const std::string_view> values) const
+{
+    size_t length = constantLength;
+    for (std::string_view value : values)
+        length += value.size();
+    out.clear();
+    out.reserve(length + length / 8);
+
+    for (size_t i = 0; i < arguments.size(); i++)
+    {
+        out.append(pieces[i]);
+        if (i < values.size())
+            AppendXmlEscaped(out, values[i]);
+    }
+    out.append(pieces.back());
+}
+
+void AppendXmlEscaped(std::string& out, std::string_view text)
+{
+    /* Runs without special characters, nearly all of the text, are copied whole */
+    size_t start = 0;
+    for (size_t i = 0; i < text.size(); i++)
+    {
+        const char* entity;
+        switch (text[i])
+        {
+        case '&': entity = "&amp;"; break;
+        case '<': entity = "&lt;"; break;
+        case '>': entity = "&gt;"; break;
+        case '"': entity = "&quot;"; break;
+        case '\'': entity = "&apos;"; break;
+        default: continue;
+        }
+        out.append(text, start, i - start).append(entity);
+        start = i + 1;
+    }
+    out.append(text, start, text.size() - start);
+}
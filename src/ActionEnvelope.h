@@ -0,0 +1,40 @@
+#pragma once
+#include <initializer_list>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/*
+ * SOAP request of one action with fixed argument names, as pupnp would send it.
+ *
+ * Everything but the argument values is written once, when the envelope is made. Write
+ * copies those pieces and the escaped values into the caller's buffer, no XML document
+ * is built per request.
+ */
+class ActionEnvelope
+{
+public:
+    ActionEnvelope(std::string_view serviceType, std::string_view action, std::span<const std::string_view> arguments);
+    ActionEnvelope(std::string_view serviceType, std::string_view action, std::initializer_list<std::string_view> arguments)
+        : ActionEnvelope(serviceType, action, std::span<const std::string_view>(arguments.begin(), arguments.size())) {}
+
+    std::string_view Action() const { return action; }
+    const std::vector<std::string>& Arguments() const { return arguments; }
+    // CONTENT-TYPE and SOAPACTION header lines, CRLF included.
+    std::string_view Headers() const { return headers; }
+
+    // Replaces out with the envelope, values in the order of the argument names.
+    void Write(std::string& out, std::span<const std::string_view> values) const;
+    void Write(std::string& out, std::initializer_list<std::string_view> values) const { Write(out, std::span<const std::string_view>(values.begin(), values.size())); }
+
+private:
+    std::string action;
+    std::vector<std::string> arguments;
+    std::string headers;
+    std::vector<std::string> pieces; // pieces[i] goes before value i, the last one after every value
+    size_t constantLength = 0;
+};
+
+// Appends text with the XML special characters escaped.
+void AppendXmlEscaped(std::string& out, std::string_view text);
@@ -0,0 +1,229 @@
+#include <cstdint>
+#include <initializer_list>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define BASE64_X86 1
+#include <immintrin.h>
+#if _MSC_VER
+#include <intrin.h>
+#endif
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define BASE64_NEON 1
+#include <arm_neon.h>
+#endif
+
+#if BASE64_X86 && (defined(__GNUC__) || defined(__clang__))
+#define BASE64_TARGET(isa) __attribute__((target(isa)))
+#else
+#define BASE64_TARGET(isa)
+#endif
+
+#include "Base64Simd.h"
+
+namespace
+{
+    const char* const Alphabets[2] = {
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/",
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_" };
+    /* base64.cpp pads url encoding with dots */
+    const char Padding[2] = { '=', '.' };
+
+    void EncodeScalar(const unsigned char* in, size_t length, char* out, bool url)
+    {
+        const char* chars = Alphabets[url];
+        size_t i = 0;
+        for (; length - i >= 3; i += 3)
+        {
+            const uint32_t value = uint32_t{ in[i] } << 16 | uint32_t{ in[i + 1] } << 8 | in[i + 2];
+            out[0] = chars[value >> 18];
+            out[1] = chars[(value >> 12) & 0x3f];
+            out[2] = chars[(value >> 6) & 0x3f];
+            out[3] = chars[value & 0x3f];
+            out += 4;
+        }
+
+        if (length - i == 1)
+        {
+            out[0] = chars[in[i] >> 2];
+            out[1] = chars[(in[i] & 0x03) << 4];
+            out[2] = Padding[url];
+            out[3] = Padding[url];
+        }
+        else if (length - i == 2)
+        {
+            out[0] = chars[in[i] >> 2];
+            out[1] = chars[(in[i] & 0x03) << 4 | in[i + 1] >> 4];
+            out[2] = chars[(in[i + 1] & 0x0f) << 2];
+            out[3] = Padding[url];
+        }
+    }
+
+#if BASE64_X86
+    /*
+     * Wojciech Mula's and Daniel Lemire's method: spread 12 bytes over 16 lanes of 6 bits,
+     * then map the 6 bit indices to ASCII with a 16 entry offset table.
+     */
+    BASE64_TARGET("ssse3")
+    __m128i SplitSixBits(__m128i in)
+    {
+        in = _mm_shuffle_epi8(in, _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+        const __m128i high = _mm_mulhi_epu16(_mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00)), _mm_set1_epi32(0x04000040));
+        const __m128i low = _mm_mullo_epi16(_mm_and_si128(in, _mm_set1_epi32(0x003f03f0)), _mm_set1_epi32(0x01000010));
+        return _mm_or_si128(high, low);
+    }
+
+    BASE64_TARGET("ssse3")
+    __m128i ToAscii(__m128i indices, __m128i offsets)
+    {
+        /* 0..25 -> 13, 26..51 -> 0, 52..61 -> 1..10, 62 -> 11, 63 -> 12 */
+        __m128i range = _mm_subs_epu8(indices, _mm_set1_epi8(51));
+        range = _mm_or_si128(range, _mm_and_si128(_mm_cmpgt_epi8(_mm_set1_epi8(26), indices), _mm_set1_epi8(13)));
+        return _mm_add_epi8(_mm_shuffle_epi8(offsets, range), indices);
+    }
+
+    BASE64_TARGET("ssse3")
+    void EncodeSSSE3(const unsigned char* in, size_t length, char* out, bool url)
+    {
+        const __m128i offsets = _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+            '0' - 52, '0' - 52, '0' - 52, (url ? '-' : '+') - 62, (url ? '_' : '/') - 63, 'A', 0, 0);
+        size_t i = 0;
+        /* Loads are 16 bytes wide for 12 used */
+        for (; length - i >= 16; i += 12, out += 16)
+        {
+            const __m128i indices = SplitSixBits(_mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i)));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out), ToAscii(indices, offsets));
+        }
+        EncodeScalar(in + i, length - i, out, url);
+    }
+
+    BASE64_TARGET("avx2")
+    void EncodeAVX2(const unsigned char* in, size_t length, char* out, bool url)
+    {
+        const __m256i offsets = _mm256_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+            '0' - 52, '0' - 52, '0' - 52, (url ? '-' : '+') - 62, (url ? '_' : '/') - 63, 'A', 0, 0,
+            'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+            '0' - 52, '0' - 52, '0' - 52, (url ? '-' : '+') - 62, (url ? '_' : '/') - 63, 'A', 0, 0);
+        const __m256i shuffle = _mm256_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10,
+            1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10);
+        size_t i = 0;
+        /* Each 128 bit lane takes 12 bytes, the upper load ends 4 bytes past them */
+        for (; length - i >= 28; i += 24, out += 32)
+        {
+            const __m128i low = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+            const __m128i high = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i + 12));
+            __m256i data = _mm256_inserti128_si256(_mm256_castsi128_si256(low), high, 1);
+            data = _mm256_shuffle_epi8(data, shuffle);
+            const __m256i indices = _mm256_or_si256(
+                _mm256_mulhi_epu16(_mm256_and_si256(data, _mm256_set1_epi32(0x0fc0fc00)), _mm256_set1_epi32(0x04000040)),
+                _mm256_mullo_epi16(_mm256_and_si256(data, _mm256_set1_epi32(0x003f03f0)), _mm256_set1_epi32(0x01000010)));
+
+            __m256i range = _mm256_subs_epu8(indices, _mm256_set1_epi8(51));
+            range = _mm256_or_si256(range, _mm256_and_si256(_mm256_cmpgt_epi8(_mm256_set1_epi8(26), indices), _mm256_set1_epi8(13)));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(out), _mm256_add_epi8(_mm256_shuffle_epi8(offsets, range), indices));
+        }
+        EncodeScalar(in + i, length - i, out, url);
+    }
+
+    bool CpuHas(Base64Isa isa)
+    {
+#if defined(__GNUC__) || defined(__clang__)
+        __builtin_cpu_init();
+        return isa == Base64Isa::AVX2 ? __builtin_cpu_supports("avx2") : __builtin_cpu_supports("ssse3");
+#else
+        int info[4];
+        __cpuid(info, 1);
+        if (isa == Base64Isa::SSSE3)
+            return info[2] & (1 << 9);
+        /* AVX2 also needs the OS to save the ymm registers */
+        if (!(info[2] & (1 << 27)) || (_xgetbv(0) & 0x6) != 0x6)
+            return false;
+        __cpuidex(info, 7, 0);
+        return info[1] & (1 << 5);
+#endif
+    }
+#endif // BASE64_X86
+
+#if BASE64_NEON
+    void EncodeNEON(const unsigned char* in, size_t length, char* out, bool url)
+    {
+        const uint8_t* chars = reinterpret_cast<const uint8_t*>(Alphabets[url]);
+        const uint8x16x4_t table = { { vld1q_u8(chars), vld1q_u8(chars + 16), vld1q_u8(chars + 32), vld1q_u8(chars + 48) } };
+        const uint8x16_t mask = vdupq_n_u8(0x3f);
+        size_t i = 0;
+        /* vld3 splits 48 bytes into their first, second and third of each triplet */
+        for (; length - i >= 48; i += 48, out += 64)
+        {
+            const uint8x16x3_t source = vld3q_u8(in + i);
+            uint8x16x4_t encoded;
+            encoded.val[0] = vqtbl4q_u8(table, vshrq_n_u8(source.val[0], 2));
+            encoded.val[1] = vqtbl4q_u8(table, vandq_u8(vorrq_u8(vshlq_n_u8(source.val[0], 4), vshrq_n_u8(source.val[1], 4)), mask));
+            encoded.val[2] = vqtbl4q_u8(table, vandq_u8(vorrq_u8(vshlq_n_u8(source.val[1], 2), vshrq_n_u8(source.val[2], 6)), mask));
+            encoded.val[3] = vqtbl4q_u8(table, vandq_u8(source.val[2], mask));
+            vst4q_u8(reinterpret_cast<uint8_t*>(out), encoded);
+        }
+        EncodeScalar(in + i, length - i, out, url);
+    }
+#endif
+
+    using Encoder = void (*)(const unsigned char*, size_t, char*, bool);
+
+    Encoder EncoderOf(Base64Isa isa)
+    {
+        switch (isa)
+        {
+#if BASE64_X86
+        case Base64Isa::SSSE3: return CpuHas(isa) ? EncodeSSSE3 : nullptr;
+        case Base64Isa::AVX2: return CpuHas(isa) ? EncodeAVX2 : nullptr;
+#endif
+#if BASE64_NEON
+        case Base64Isa::NEON: return EncodeNEON;
+#endif
+        case Base64Isa::Scalar: return EncodeScalar;
+        default: return nullptr;
+        }
+    }
+
+    struct Best
+    {
+        Base64Isa isa = Base64Isa::Scalar;
+        Encoder encoder = EncodeScalar;
+
+        Best()
+        {
+            for (Base64Isa candidate : { Base64Isa::AVX2, Base64Isa::SSSE3, Base64Isa::NEON })
+            {
+                if (Encoder found = EncoderOf(candidate))
+                {
+                    isa = candidate;
+                    encoder = found;
+                    return;
+                }
+            }
+        }
+    };
+
+    const Best& GetBest()
+    {
+        static const Best best;
+        return best;
+    }
+}
+
+void Base64Encode(const unsigned char* in, size_t length, char* out, bool url)
+{
+    GetBest().encoder(in, length, out, url);
+}
+
+bool Base64EncodeWith(Base64Isa isa, const unsigned char* in, size_t length, char* out, bool url)
+{
+    Encoder encoder = EncoderOf(isa);
+    if (!encoder)
+        return false;
+    encoder(in, length, out, url);
+    return true;
+}
+
+Base64Isa Base64BestIsa()
+{
+    return GetBest().isa;
+}
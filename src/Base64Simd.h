@@ -0,0 +1,26 @@
+#pragma once
+#include <cstddef>
+
+/*
+ * Base64 encoding into a caller provided buffer, vectorized where the CPU allows it.
+ * The output is the same as base64_encode() from base64.h, padding included.
+ */
+enum class Base64Isa
+{
+    Scalar,
+    SSSE3,
+    AVX2,
+    NEON
+};
+
+constexpr size_t Base64EncodedLength(size_t length)
+{
+    return (length + 2) / 3 * 4;
+}
+
+// Writes Base64EncodedLength(length) characters to out, with the best encoder of this CPU.
+void Base64Encode(const unsigned char* in, size_t length, char* out, bool url = false);
+// Same with a given encoder, false when this CPU or build doesn't have it.
+bool Base64EncodeWith(Base64Isa isa, const unsigned char* in, size_t length, char* out, bool url = false);
+// Encoder picked by Base64Encode.
+Base64Isa Base64BestIsa();
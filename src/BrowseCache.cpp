@@ -0,0 +1,125 @@
+#include "BrowseCache.h"
+
+BrowseCache::BrowseCache(size_t budget)
+    : budget(budget)
+{
+}
+
+std::string BrowseCache::Key(std::string_view udn, std::string_view objectID, std::string_view sortCriteria,
+    unsigned int startingIndex, unsigned int requestedCount, std::string_view version, uint32_t fields)
+{
+    std::string key;
+    key.reserve(udn.size() + objectID.size() + sortCriteria.size() + version.size() + 32);
+    key.append(udn).push_back('\x1f');
+    key.append(objectID).push_back('\x1f');
+    key.append(sortCriteria).push_back('\x1f');
+    key.append(std::to_string(startingIndex)).push_back('\x1f');
+    key.append(std::to_string(requestedCount)).push_back('\x1f');
+    key.append(version).push_back('\x1f');
+    key.append(std::to_string(fields));
+    return key;
+}
+
+void BrowseCache::SetBudget(size_t newBudget)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    budget = newBudget;
+    Trim();
+}
+
+void BrowseCache::Track(const std::string& udn)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    generations.try_emplace(udn, nextGeneration++);
+}
+
+void BrowseCache::Untrack(const std::string& udn)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    generations.erase(udn);
+    EraseIf([&udn](const Entry& entry) { return entry.udn == udn; });
+}
+
+uint64_t BrowseCache::Generation(const std::string& udn)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = generations.find(udn);
+    return it != generations.end() ? it->second : 0;
+}
+
+std::shared_ptr<const CachedPage> BrowseCache::Find(const std::string& key)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = index.find(key);
+    if (it == index.end())
+        return nullptr;
+    entries.splice(entries.begin(), entries, it->second);
+    return it->second->page;
+}
+
+void BrowseCache::Store(const std::string& key, const std::string& udn, const std::string& objectID, uint64_t generation, std::shared_ptr<const CachedPage> page)
+{
+    const size_t cost = sizeof(Entry) + key.size() * 2 + udn.size() + objectID.size() + sizeof(CachedPage) + page->results.size();
+
+    std::lock_guard<std::mutex> lock(mutex);
+    auto current = generations.find(udn);
+    if (!generation || current == generations.end() || current->second != generation || cost > budget)
+        return;
+
+    auto it = index.find(key);
+    if (it != index.end())
+    {
+        used -= it->second->cost;
+        entries.erase(it->second);
+        index.erase(it);
+    }
+
+    entries.push_front({ key, udn, objectID, std::move(page), cost });
+    index.emplace(entries.front().key, entries.begin());
+    used += cost;
+    Trim();
+}
+
+void BrowseCache::InvalidateServer(const std::string& udn)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = generations.find(udn);
+    if (it != generations.end())
+        it->second = nextGeneration++;
+    EraseIf([&udn](const Entry& entry) { return entry.udn == udn; });
+}
+
+void BrowseCache::InvalidateContainer(const std::string& udn, const std::string& objectID)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = generations.find(udn);
+    if (it != generations.end())
+        it->second = nextGeneration++;
+    EraseIf([&udn, &objectID](const Entry& entry) { return entry.udn == udn && entry.objectID == objectID; });
+}
+
+template <typename Predicate>
+void BrowseCache::EraseIf(Predicate predicate)
+{
+    for (auto it = entries.begin(); it != entries.end();)
+    {
+        if (!predicate(*it))
+        {
+            ++it;
+            continue;
+        }
+        used -= it->cost;
+        index.erase(it->key);
+        it = entries.erase(it);
+    }
+}
+
+void BrowseCache::Trim()
+{
+    while (used > budget && !entries.empty())
+    {
+        used -= entries.back().cost;
+        index.erase(entries.back().key);
+        entries.pop_back();
+    }
+}
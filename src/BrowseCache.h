@@ -0,0 +1,67 @@
+#pragma once
+#include <cstdint>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+struct CachedPage
+{
+    std::string results; // JSON array written as the "results" member of a browse response
+    unsigned int numberReturned = 0;
+    unsigned int totalMatches = 0;
+};
+
+/*
+ * Least recently used browse pages, within a memory budget.
+ *
+ * Pages are only kept for servers whose ContentDirectory events are received (Track),
+ * since SystemUpdateID and ContainerUpdateIDs are what tells a page went stale. Every
+ * invalidation bumps the server generation, a page answered for an older generation
+ * is not stored.
+ */
+class BrowseCache
+{
+public:
+    explicit BrowseCache(size_t budget);
+
+    static std::string Key(std::string_view udn, std::string_view objectID, std::string_view sortCriteria,
+        unsigned int startingIndex, unsigned int requestedCount, std::string_view version, uint32_t fields);
+
+    void SetBudget(size_t budget);
+    void Track(const std::string& udn);
+    void Untrack(const std::string& udn);
+    // 0 when the server is not tracked.
+    uint64_t Generation(const std::string& udn);
+
+    std::shared_ptr<const CachedPage> Find(const std::string& key);
+    void Store(const std::string& key, const std::string& udn, const std::string& objectID, uint64_t generation, std::shared_ptr<const CachedPage> page);
+
+    void InvalidateServer(const std::string& udn);
+    void InvalidateContainer(const std::string& udn, const std::string& objectID);
+
+private:
+    struct Entry
+    {
+        std::string key;
+        std::string udn;
+        std::string objectID;
+        std::shared_ptr<const CachedPage> page;
+        size_t cost;
+    };
+
+    template <typename Predicate>
+    void EraseIf(Predicate predicate);
+    void Trim();
+
+    std::mutex mutex;
+    size_t budget;
+    size_t used = 0;
+    uint64_t nextGeneration = 1;
+    std::map<std::string, uint64_t> generations;
+    std::list<Entry> entries; // Most recently used first
+    std::unordered_map<std::string_view, std::list<Entry>::iterator> index;
+};
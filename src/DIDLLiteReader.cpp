@@ -0,0 +1,463 @@
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <utility>
+
+#include "DIDLLiteReader.h"
+#include "logger.h"
+
+namespace
+{
+    bool IsSpace(char c)
+    {
+        return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+    }
+
+    char* SkipSpaces(char* cur, char* end)
+    {
+        while (cur < end && IsSpace(*cur))
+            cur++;
+        return cur;
+    }
+
+    char* Find(char* cur, char* end, std::string_view pattern)
+    {
+        size_t pos = std::string_view(cur, end - cur).find(pattern);
+        return pos == std::string_view::npos ? nullptr : cur + pos;
+    }
+
+    char* AppendUtf8(char* out, unsigned long codePoint)
+    {
+        if (codePoint < 0x80)
+            *out++ = static_cast<char>(codePoint);
+        else if (codePoint < 0x800)
+        {
+            *out++ = static_cast<char>(0xc0 | (codePoint >> 6));
+            *out++ = static_cast<char>(0x80 | (codePoint & 0x3f));
+        }
+        else if (codePoint < 0x10000)
+        {
+            *out++ = static_cast<char>(0xe0 | (codePoint >> 12));
+            *out++ = static_cast<char>(0x80 | ((codePoint >> 6) & 0x3f));
+            *out++ = static_cast<char>(0x80 | (codePoint & 0x3f));
+        }
+        else
+        {
+            *out++ = static_cast<char>(0xf0 | (codePoint >> 18));
+            *out++ = static_cast<char>(0x80 | ((codePoint >> 12) & 0x3f));
+            *out++ = static_cast<char>(0x80 | ((codePoint >> 6) & 0x3f));
+            *out++ = static_cast<char>(0x80 | (codePoint & 0x3f));
+        }
+        return out;
+    }
+
+    // Properties read from the first element of that name found in an object, as ixmlElement_getFirstChildElementValue does
+    const std::pair<std::string_view, std::string_view ItemView::*> properties[] = {
+        { "dc:title", &ItemView::filename },
+        { "dc:date", &ItemView::date },
+        { "upnp:artist", &ItemView::artist },
+        { "upnp:genre", &ItemView::genre },
+        { "upnp:album", &ItemView::album },
+        { "upnp:originalTrackNumber", &ItemView::orig_track_nb },
+        { "upnp:albumArtist", &ItemView::album_artist },
+        { "upnp:albumArtURI", &ItemView::albumArtURI },
+    };
+
+    // Subtitles given outside the video resource, by order of preference, Samsung servers use sec:CaptionInfo
+    const std::string_view captionElements[] = { "sec:CaptionInfo", "sec:CaptionInfoEx", "pv:subtitlefile" };
+}
+
+DIDLLiteReader::DIDLLiteReader(char* didl, size_t length, FieldMask fields)
+    : cur(didl)
+    , end(didl + length)
+    , fields(fields | FieldBit(&ItemView::filename))
+{
+}
+
+bool DIDLLiteReader::Next(ItemView& item, bool& isContainer)
+{
+    while (!failed)
+    {
+        switch (NextToken())
+        {
+        case Token::End:
+            failed = !openElements.empty();
+            return false;
+
+        case Token::Error:
+            failed = true;
+            return false;
+
+        case Token::StartTag:
+            if (name == "container" || name == "item")
+            {
+                isContainer = name == "container";
+                if (ReadObject(item, isContainer))
+                    return true;
+            }
+            else openElements.push_back(name);
+            break;
+
+        case Token::EndTag:
+            if (openElements.empty() || openElements.back() != name)
+            {
+                failed = true;
+                return false;
+            }
+            openElements.pop_back();
+            break;
+
+        case Token::EmptyTag:
+        case Token::Text:
+            break;
+        }
+    }
+    return false;
+}
+
+bool DIDLLiteReader::ReadObject(ItemView& item, bool isContainer)
+{
+    item = ItemView();
+    const std::string_view objectID = Attribute("id");
+    std::string_view upnpClass;
+    unsigned int found = 0;
+    unsigned int captionsFound = 0;
+
+    resources.clear();
+    std::fill(std::begin(captions), std::end(captions), std::string_view());
+    const size_t depth = openElements.size();
+    openElements.push_back(name);
+
+    /* The value of an element is its first child, if that child is some text */
+    std::string_view* pendingValue = nullptr;
+    size_t pendingResource = SIZE_MAX;
+    while (openElements.size() > depth)
+    {
+        std::string_view* value = std::exchange(pendingValue, nullptr);
+        size_t resource = std::exchange(pendingResource, SIZE_MAX);
+
+        Token token = NextToken();
+        switch (token)
+        {
+        case Token::End:
+        case Token::Error:
+            failed = true;
+            return false;
+
+        case Token::Text:
+            if (value)
+                *value = text;
+            if (resource != SIZE_MAX)
+                resources[resource].url = text;
+            break;
+
+        case Token::StartTag:
+        case Token::EmptyTag:
+            if (name == "res")
+            {
+                resources.push_back({ Attribute("protocolInfo"), {}, Attribute("duration"), Attribute("size"), Attribute("resolution"), Attribute("pv:subtitleFileUri") });
+                if (token == Token::StartTag)
+                    pendingResource = resources.size() - 1;
+            }
+            else if (name == "upnp:class")
+            {
+                if (!(found & 1u))
+                {
+                    found |= 1u;
+                    if (token == Token::StartTag)
+                        pendingValue = &upnpClass;
+                }
+            }
+            else if (auto caption = std::find(std::begin(captionElements), std::end(captionElements), name); caption != std::end(captionElements))
+            {
+                const size_t i = caption - std::begin(captionElements);
+                if (!(captionsFound & (1u << i)))
+                {
+                    captionsFound |= 1u << i;
+                    if (token == Token::StartTag && (fields & FieldBit(&ItemView::subtitle)))
+                        pendingValue = &captions[i];
+                }
+            }
+            else
+            {
+                for (unsigned int i = 0; i < std::size(properties); i++)
+                {
+                    if (properties[i].first != name)
+                        continue;
+                    if (!(found & (2u << i)))
+                    {
+                        found |= 2u << i;
+                        if (token == Token::StartTag && (fields & FieldBit(properties[i].second)))
+                            pendingValue = &(item.*properties[i].second);
+                    }
+                    break;
+                }
+            }
+            if (token == Token::StartTag)
+                openElements.push_back(name);
+            break;
+
+        case Token::EndTag:
+            if (openElements.back() != name)
+            {
+                failed = true;
+                return false;
+            }
+            openElements.pop_back();
+            break;
+        }
+    }
+
+    if (!objectID.data() || !item.filename.data() || !upnpClass.data())
+        return false;
+
+    if (upnpClass.starts_with("object.item.videoItem"))
+        item.media_type = Item::VIDEO;
+    else if (upnpClass.starts_with("object.item.audioItem"))
+        item.media_type = Item::AUDIO;
+    else if (upnpClass.starts_with("object.item.imageItem"))
+        item.media_type = Item::IMAGE;
+    else if (upnpClass.starts_with("object.container"))
+        item.media_type = Item::CONTAINER;
+    else
+        return false;
+
+    item.objectID = objectID;
+    if (isContainer)
+    {
+        if (item.media_type != Item::CONTAINER)
+            Log(LogLevel::Error, "Unexpected type in container enumeration");
+        return true;
+    }
+    return ResolveResources(item);
+}
+
+bool DIDLLiteReader::ResolveResources(ItemView& item)
+{
+    if (resources.empty())
+        return false;
+
+    for (const Resource& res : resources)
+    {
+        if (res.protocolInfo.starts_with("http-get:*:video/") && item.media_type == Item::VIDEO)
+        {
+            if (!res.url.data())
+                return false;
+            item.url = res.url;
+            item.duration = res.duration;
+            item.size = res.size;
+            item.resolution = res.resolution;
+            item.subtitle = res.subtitle;
+        }
+        else if (res.protocolInfo.starts_with("http-get:*:image/"))
+            switch (item.media_type)
+            {
+            case Item::IMAGE:
+                if (!res.url.data())
+                    return false;
+                item.url = res.url;
+                item.duration = res.duration;
+                break;
+            case Item::VIDEO:
+            case Item::AUDIO:
+                item.albumArtURI = res.url;
+                break;
+            case Item::CONTAINER:
+                Log(LogLevel::Warning, "Unexpected object.container in item enumeration");
+                continue;
+            }
+        else if (res.protocolInfo.starts_with("http-get:*:audio/"))
+        {
+            if (item.media_type == Item::AUDIO)
+            {
+                if (!res.url.data())
+                    return false;
+                item.url = res.url;
+                item.duration = res.duration;
+            }
+            else item.audio_url = res.url;
+        }
+    }
+
+    if (item.media_type == Item::VIDEO && item.subtitle.empty())
+    {
+        for (std::string_view caption : captions)
+        {
+            if (caption.data())
+            {
+                item.subtitle = caption;
+                break;
+            }
+        }
+    }
+    return true;
+}
+
+DIDLLiteReader::Token DIDLLiteReader::NextToken()
+{
+    while (cur < end)
+    {
+        if (*cur != '<')
+        {
+            char* textEnd = static_cast<char*>(memchr(cur, '<', end - cur));
+            if (!textEnd)
+                textEnd = end;
+            text = Decode(cur, textEnd);
+            cur = textEnd;
+            return Token::Text;
+        }
+
+        std::string_view markup(cur, end - cur);
+        if (markup.starts_with("<![CDATA["))
+        {
+            char* cdataEnd = Find(cur + 9, end, "]]>");
+            if (!cdataEnd)
+                return Token::Error;
+            text = std::string_view(cur + 9, cdataEnd - cur - 9);
+            cur = cdataEnd + 3;
+            return Token::Text;
+        }
+
+        /* Declarations, processing instructions and comments carry nothing we need */
+        char* skipTo = nullptr;
+        if (markup.starts_with("<?"))
+            skipTo = Find(cur + 2, end, "?>");
+        else if (markup.starts_with("<!--"))
+            skipTo = Find(cur + 4, end, "-->");
+        else if (markup.starts_with("<!"))
+            skipTo = static_cast<char*>(memchr(cur, '>', end - cur));
+        else
+            return ReadTag();
+
+        if (!skipTo)
+            return Token::Error;
+        cur = static_cast<char*>(memchr(skipTo, '>', end - skipTo)) + 1;
+    }
+    return Token::End;
+}
+
+DIDLLiteReader::Token DIDLLiteReader::ReadTag()
+{
+    bool closing = ++cur < end && *cur == '/';
+    if (closing)
+        cur++;
+
+    char* nameBegin = cur;
+    while (cur < end && !IsSpace(*cur) && *cur != '/' && *cur != '>' && *cur != '=')
+        cur++;
+    if (cur == nameBegin)
+        return Token::Error;
+    name = std::string_view(nameBegin, cur - nameBegin);
+
+    if (closing)
+    {
+        cur = SkipSpaces(cur, end);
+        if (cur == end || *cur != '>')
+            return Token::Error;
+        cur++;
+        return Token::EndTag;
+    }
+
+    attributes.clear();
+    for (;;)
+    {
+        cur = SkipSpaces(cur, end);
+        if (cur == end)
+            return Token::Error;
+        if (*cur == '>')
+        {
+            cur++;
+            return Token::StartTag;
+        }
+        if (*cur == '/')
+        {
+            if (++cur == end || *cur != '>')
+                return Token::Error;
+            cur++;
+            return Token::EmptyTag;
+        }
+
+        char* attributeBegin = cur;
+        while (cur < end && !IsSpace(*cur) && *cur != '=' && *cur != '/' && *cur != '>')
+            cur++;
+        std::string_view attribute(attributeBegin, cur - attributeBegin);
+
+        cur = SkipSpaces(cur, end);
+        if (attribute.empty() || cur == end || *cur != '=')
+            return Token::Error;
+        cur = SkipSpaces(cur + 1, end);
+        if (cur == end || (*cur != '"' && *cur != '\''))
+            return Token::Error;
+
+        char quote = *cur++;
+        char* valueEnd = static_cast<char*>(memchr(cur, quote, end - cur));
+        if (!valueEnd)
+            return Token::Error;
+        attributes.emplace_back(attribute, Decode(cur, valueEnd));
+        cur = valueEnd + 1;
+    }
+}
+
+std::string_view DIDLLiteReader::Attribute(std::string_view attribute) const
+{
+    for (const auto& [key, value] : attributes)
+        if (key == attribute)
+            return value;
+    return {};
+}
+
+std::string_view DIDLLiteReader::Decode(char* begin, char* end)
+{
+    char* out = static_cast<char*>(memchr(begin, '&', end - begin));
+    if (!out)
+        return std::string_view(begin, end - begin);
+
+    /* Decoded text is never longer than its source, so it is written over it */
+    char* in = out;
+    while (in < end)
+    {
+        if (*in != '&')
+        {
+            *out++ = *in++;
+            continue;
+        }
+
+        char* semicolon = static_cast<char*>(memchr(in, ';', std::min<ptrdiff_t>(end - in, 12)));
+        if (semicolon)
+        {
+            std::string_view entity(in + 1, semicolon - in - 1);
+            char c = entity == "amp" ? '&'
+                : entity == "lt" ? '<'
+                : entity == "gt" ? '>'
+                : entity == "quot" ? '"'
+                : entity == "apos" ? '\''
+                : '\0';
+            if (c)
+            {
+                *out++ = c;
+                in = semicolon + 1;
+                continue;
+            }
+
+            if (entity.size() > 1 && entity[0] == '#')
+            {
+                bool hex = entity[1] == 'x' || entity[1] == 'X';
+                const char* digits = entity.data() + (hex ? 2 : 1);
+                char* digitsEnd = nullptr;
+                unsigned long codePoint = strtoul(digits, &digitsEnd, hex ? 16 : 10);
+                if (digitsEnd == semicolon && digits != semicolon && std::isxdigit(static_cast<unsigned char>(*digits)) && codePoint && codePoint <= 0x10ffff)
+                {
+                    out = AppendUtf8(out, codePoint);
+                    in = semicolon + 1;
+                    continue;
+                }
+            }
+        }
+
+        /* Relaxed like ixmlRelaxParser(1): unknown entities and lone '&' are kept as they are */
+        *out++ = *in++;
+    }
+    return std::string_view(begin, out - begin);
+}
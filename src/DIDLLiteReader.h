@@ -0,0 +1,63 @@
+#pragma once
+#include <string_view>
+#include <vector>
+#include <utility>
+
+#include "UpnpCommand.h"
+
+/*
+ * Pull parser for the DIDL-Lite document carried in the Result of a Browse response.
+ *
+ * The document is walked once, entities are decoded in place and every field of
+ * the returned ItemView points into the caller's buffer, so no DOM is built and
+ * nothing is allocated per item. It applies the same rules as TryParseItem.
+ * Anything it doesn't understand makes Failed() return true, callers are then
+ * expected to fall back to the ixml parser. Properties not in fields are left
+ * empty, the title is always read.
+ */
+class DIDLLiteReader
+{
+public:
+    DIDLLiteReader(char* didl, size_t length, FieldMask fields = AllFields);
+
+    // Returns false once the document is exhausted or malformed.
+    bool Next(ItemView& item, bool& isContainer);
+    bool Failed() const { return failed; }
+
+private:
+    enum class Token
+    {
+        End,
+        StartTag,
+        EmptyTag,
+        EndTag,
+        Text,
+        Error
+    };
+
+    struct Resource
+    {
+        std::string_view protocolInfo, url, duration, size, resolution, subtitle;
+    };
+
+    Token NextToken();
+    Token ReadTag();
+    bool ReadObject(ItemView& item, bool isContainer);
+    bool ResolveResources(ItemView& item);
+    std::string_view Attribute(std::string_view name) const;
+    std::string_view Decode(char* begin, char* end);
+
+    char* cur;
+    char* const end;
+    const FieldMask fields;
+    bool failed = false;
+
+    // Current token
+    std::string_view name;
+    std::string_view text;
+    std::vector<std::pair<std::string_view, std::string_view>> attributes;
+
+    std::vector<std::string_view> openElements;
+    std::vector<Resource> resources;
+    std::string_view captions[3]; // Values of the caption elements, used when the video resource names no subtitle
+};
@@ -1,10 +1,13 @@
 #include "DLNAModule.h"
+#include "ServerSearch.h"
 #include "UpnpCommand.h"
 
 #if __ANDROID__
 #define DLNA_EXPORT
 #elif _WIN64
 #define DLNA_EXPORT __declspec(dllexport)
+#else
+#define DLNA_EXPORT __attribute__((visibility("default")))
 #endif
 
 extern "C" DLNA_EXPORT void SKYBOXStartupDLNA()
@@ -28,10 +31,40 @@ extern "C" DLNA_EXPORT void SKYBOXDLNAUpdate()
 }
 
 extern "C" DLNA_EXPORT bool BrowseDLNAFolder2(const char* json, BrowseDLNAFolderCallback OnBrowseResultCallback)
+{
+    return BrowseFolderByUnity(json, OnBrowseResultCallback) != 0;
+}
+
+// Same as BrowseDLNAFolder2, returns the ID of the request for CancelDLNARequest, 0 when it failed
+extern "C" DLNA_EXPORT uint32_t BrowseDLNAFolder3(const char* json, BrowseDLNAFolderCallback OnBrowseResultCallback)
 {
     return BrowseFolderByUnity(json, OnBrowseResultCallback);
 }
 
+// Searches the titles of every MediaServer, matches are streamed to the callback as servers answer
+extern "C" DLNA_EXPORT bool SearchDLNAServers(const char* json, BrowseDLNAFolderCallback OnSearchResultCallback)
+{
+    return SearchServersByUnity(json, OnSearchResultCallback) != 0;
+}
+
+// Same as SearchDLNAServers, returns the ID of the request for CancelDLNARequest, 0 when it failed
+extern "C" DLNA_EXPORT uint32_t SearchDLNAServers2(const char* json, BrowseDLNAFolderCallback OnSearchResultCallback)
+{
+    return SearchServersByUnity(json, OnSearchResultCallback);
+}
+
+// Stops a browse or search, its callback gets no response once the one being delivered returned. False when it already finished
+extern "C" DLNA_EXPORT bool CancelDLNARequest(uint32_t requestID)
+{
+    return DLNAModule::GetInstance().requests.Cancel(requestID);
+}
+
+extern "C" DLNA_EXPORT void GetDLNARequestStats(DLNARequestStats* stats)
+{
+    if (stats)
+        *stats = DLNAModule::GetInstance().RequestStats();
+}
+
 extern "C" DLNA_EXPORT void SetAddDLNADeviceCallback(AddDLNADeviceCallback OnAddDLNADevice)
 {
     DLNAModule::GetInstance().ptrToUnityAddDLNADeviceCallBack = OnAddDLNADevice;
@@ -40,4 +73,33 @@ extern "C" DLNA_EXPORT void SetAddDLNADeviceCallback(AddDLNADeviceCallback OnAdd
 extern "C" DLNA_EXPORT void SetRemoveDLNADeviceCallback(RemoveDLNADeviceCallback OnRemoveDLNADevice)
 {
     DLNAModule::GetInstance().ptrToUnityRemoveDLNADeviceCallback = OnRemoveDLNADevice;
+}
+
+// Replaces the add/remove callbacks: every pending event is delivered by a single call per Update().
+extern "C" DLNA_EXPORT void SetDLNADeviceEventsCallback(DLNADeviceEventsCallback OnDLNADeviceEvents)
+{
+    DLNAModule::GetInstance().ptrToUnityDeviceEventsCallback = OnDLNADeviceEvents;
+}
+
+extern "C" DLNA_EXPORT void SetDLNAUpdateBudget(unsigned int maxEventsPerUpdate)
+{
+    DLNAModule::GetInstance().updateBudget.store(maxEventsPerUpdate, std::memory_order_relaxed);
+}
+
+// Crawls every MediaServer in the background into indexes kept in directory, nullptr or "" stops it
+extern "C" DLNA_EXPORT void EnableDLNALibraryIndex(const char* directory)
+{
+    DLNAModule::GetInstance().libraryIndexer.Enable(directory ? directory : "");
+}
+
+// Answers from the library indexes before returning, without any network request
+extern "C" DLNA_EXPORT bool QueryDLNALibrary(const char* json, BrowseDLNAFolderCallback OnQueryResultCallback)
+{
+    return DLNAModule::GetInstance().libraryIndexer.Query(json, OnQueryResultCallback);
+}
+
+// Memory kept for browse pages of servers whose ContentDirectory events are received, 0 disables the cache
+extern "C" DLNA_EXPORT void SetDLNABrowseCacheBudget(unsigned int bytes)
+{
+    DLNAModule::GetInstance().browseCache.SetBudget(bytes);
 }
\ No newline at end of file
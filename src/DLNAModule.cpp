@@ -19,6 +19,9 @@ using namespace std::chrono_literals;
 
 const char* MEDIA_SERVER_DEVICE_TYPE = "urn:schemas-upnp-org:device:MediaServer:1";
 const char* CONTENT_DIRECTORY_SERVICE_TYPE = "urn:schemas-upnp-org:service:ContentDirectory:1"; 
+const int DESCRIPTION_TIMEOUT = 5; /* seconds, a description download gets twice that */
+const size_t MAX_DESCRIPTION_LENGTH = 1024 * 1024;
+const int CONTENT_DIRECTORY_SUBSCRIPTION_TIMEOUT = 1800; /* seconds, pupnp renews it */
 DLNAModule DLNAModule::_dlnaInst;
 
 DLNAModule& DLNAModule::GetInstance()
@@ -29,12 +32,23 @@ DLNAModule& DLNAModule::GetInstance()
 void DLNAModule::Initialize()
 {
     Log(LogLevel::Info, "Starting DLNAModule-%s-%.8s, built at %s", DLNA_VERSION_REF, DLNA_VERSION_COMMIT, BUILD_TIMESTAMP);
+#if not ENABLE_SLOG
+    if (!logger::logFile.empty())
+        descriptionCache.Load(logger::logFile.parent_path() / "DLNADescriptionCache.json");
+#endif
+    /* Show the servers seen during the previous run until SSDP tells otherwise */
+    const std::vector<UpnpDevice> restoredDevices = descriptionCache.FreshDevices();
+    RestoreServers(restoredDevices);
+
 #if __ANDROID__
     int res = UpnpInit2(nullptr, 0);
 #elif _WIN64
     char8_t* bestAdapterName = GetBestAdapterInterfaceName();
     int res = UpnpInit2(reinterpret_cast<char*>(bestAdapterName), 0);
     free(bestAdapterName);
+#else
+    /* Desktop builds are only used for tests, let them pick the interface */
+    int res = UpnpInit2(getenv("DLNA_IFNAME"), 0);
 #endif
     if (res != UPNP_E_SUCCESS)
     {
@@ -42,6 +56,9 @@ void DLNAModule::Initialize()
         return;
     }
     Log(LogLevel::Info, "Upnp SDK init success");
+    descriptionWorkers.Start();
+    searchWorkers.Start();
+    actionWorkers.Start();
     ixmlRelaxParser(1);
 
     /* Register a control point */
@@ -53,6 +70,8 @@ void DLNAModule::Initialize()
     }
     Log(LogLevel::Info, "Upnp control point register success, handle is %d", handle);
     UpnpSetMaxContentLength(INT_MAX);
+    /* Needs the handle, servers that won't answer the search are evented all the same */
+    SubscribeServers(restoredDevices);
 
     if (UpnpSearchAsync(handle, 80, MEDIA_SERVER_DEVICE_TYPE, &GetInstance()) != UPNP_E_SUCCESS)
     {
@@ -65,17 +84,31 @@ void DLNAModule::Initialize()
 void DLNAModule::Finitialize()
 {
     UpnpUnRegisterClient(handle);
+    descriptionWorkers.Stop();
+    /* After the workers, whatever they stored last is written too */
+    descriptionCache.Save();
+    searchWorkers.Stop();
+    actionWorkers.Stop();
+    libraryIndexer.Stop();
+    connections.Clear();
     if (UpnpFinish() == UPNP_E_SUCCESS)
         Log(LogLevel::Info, "Upnp SDK finished success");
+#if not ENABLE_SLOG
+    StopLogWriter();
+#endif
+}
+
+DLNARequestStats DLNAModule::RequestStats()
+{
+    DLNARequestStats stats = requests.Stats();
+    stats.queuedActions = static_cast<uint32_t>(actionWorkers.Queued() + searchWorkers.Queued());
+    return stats;
 }
 
 void DLNAModule::Search()
 {
     Log(LogLevel::Info, "Searching servers...");
-    {
-        std::scoped_lock<std::mutex> lock(UpnpDeviceMapMutex);
-        UpnpDeviceMap.clear();
-    }
+    devices.Clear();
     UpnpSearchAsync(handle, 80, "ssdp:all", &GetInstance());
 }
 
@@ -87,13 +120,30 @@ int DLNAModule::UpnpRegisterClientCallback(Upnp_EventType eventType, const void*
     case UPNP_DISCOVERY_SEARCH_RESULT:
     {
         UpnpDiscovery* discoverResult = (UpnpDiscovery*)event;
-        IXML_Document* description = nullptr;
-        int res = UpnpDownloadXmlDoc(UpnpString_get_String(UpnpDiscovery_get_Location(discoverResult)), &description);
-        if (res != UPNP_E_SUCCESS)
-            return res;
+        const char* location = UpnpString_get_String(UpnpDiscovery_get_Location(discoverResult));
+        const char* udn = UpnpString_get_String(UpnpDiscovery_get_DeviceID(discoverResult));
+        int maxAge = UpnpDiscovery_get_Expires(discoverResult);
 
-        GetInstance().ParseNewServer(description, UpnpString_get_String(UpnpDiscovery_get_Location(discoverResult)));
-        ixmlDocument_free(description);
+        /* A known device re-advertising at the same location doesn't need its description again */
+        std::vector<UpnpDevice> cachedDevices;
+        if (location && udn && GetInstance().descriptionCache.Refresh(location, udn, maxAge, cachedDevices))
+        {
+            GetInstance().RestoreServers(cachedDevices);
+            /* Also brings back an event subscription that was lost since */
+            GetInstance().SubscribeServers(cachedDevices);
+            GetInstance().SaveDescriptionCache();
+            break;
+        }
+
+        if (!location)
+            break;
+
+        /* Fetching may block for seconds, keep it off the SDK threads */
+        if (!GetInstance().descriptionWorkers.Submit(location, WorkerHostKey(location, udn ? udn : location), [location = std::string(location), maxAge]
+            {
+                GetInstance().FetchDescription(location, maxAge);
+            }))
+            Log(LogLevel::Debug, "Description of %s is already pending or the queue is full", location);
     }
     break;
 
@@ -104,11 +154,17 @@ int DLNAModule::UpnpRegisterClientCallback(Upnp_EventType eventType, const void*
     }
     break;
 
-    case UPNP_DISCOVERY_SEARCH_TIMEOUT:
     case UPNP_EVENT_RECEIVED:
-    case UPNP_EVENT_SUBSCRIBE_COMPLETE:
+        GetInstance().OnContentDirectoryEvent((const UpnpEvent*)event);
+        break;
+
     case UPNP_EVENT_AUTORENEWAL_FAILED:
     case UPNP_EVENT_SUBSCRIPTION_EXPIRED:
+        GetInstance().OnSubscriptionLost(UpnpString_get_String(UpnpEventSubscribe_get_SID((const UpnpEventSubscribe*)event)));
+        break;
+
+    case UPNP_DISCOVERY_SEARCH_TIMEOUT:
+    case UPNP_EVENT_SUBSCRIBE_COMPLETE:
         break;
 
     default:
@@ -120,46 +176,78 @@ int DLNAModule::UpnpRegisterClientCallback(Upnp_EventType eventType, const void*
 
 void DLNAModule::Update()
 {
-    if (ptrToUnityAddDLNADeviceCallBack)
+    if (ptrToUnityDeviceEventsCallback)
     {
-        std::lock_guard<std::mutex> lock(deviceQueueMutex);
-        while (!queueAddDeviceInfo.empty())
-        {
-            std::shared_ptr<UpnpDevice> infoToTreate = queueAddDeviceInfo.front();
-            ptrToUnityAddDLNADeviceCallBack(infoToTreate->UDN.data(), infoToTreate->UDN.length(), infoToTreate->friendlyName.data(), infoToTreate->friendlyName.length(), infoToTreate->iconUrl.data(), infoToTreate->iconUrl.length(), infoToTreate->manufacturer.data(), infoToTreate->manufacturer.length());
-            queueAddDeviceInfo.pop();
-        }
+        UpdateBatch();
+        return;
     }
 
-    if (ptrToUnityRemoveDLNADeviceCallback)
+    /* Adds and removes share one stream, removes nobody listens to are dropped so adds keep flowing */
+    if (!ptrToUnityAddDLNADeviceCallBack)
+        return;
+
+    const unsigned int budget = updateBudget.load(std::memory_order_relaxed);
+    DeviceEvent event;
+    for (unsigned int delivered = 0; (budget == 0 || delivered < budget) && deviceEvents.Pop(event); delivered++)
     {
-        std::lock_guard<std::mutex> lock(deviceQueueMutex);
-        while (!queueRemoveDeviceInfo.empty())
+        const UpnpDevice& infoToTreate = *event.device;
+        switch (event.kind)
         {
-            std::shared_ptr<UpnpDevice> infoToTreate = queueRemoveDeviceInfo.front();
-            ptrToUnityRemoveDLNADeviceCallback(infoToTreate->UDN.data(), infoToTreate->UDN.length());
-            queueRemoveDeviceInfo.pop();
+        case DeviceEvent::Kind::Add:
+            ptrToUnityAddDLNADeviceCallBack(infoToTreate.UDN.data(), infoToTreate.UDN.length(), infoToTreate.friendlyName.data(), infoToTreate.friendlyName.length(), infoToTreate.iconUrl.data(), infoToTreate.iconUrl.length(), infoToTreate.manufacturer.data(), infoToTreate.manufacturer.length());
+            break;
+        case DeviceEvent::Kind::Remove:
+            if (ptrToUnityRemoveDLNADeviceCallback)
+                ptrToUnityRemoveDLNADeviceCallback(infoToTreate.UDN.data(), infoToTreate.UDN.length());
+            break;
         }
     }
 }
 
+void DLNAModule::UpdateBatch()
+{
+    eventBatch.clear();
+    eventBatchArena.clear();
+    auto append = [this](const std::string& value, int32_t& offset, int32_t& length)
+    {
+        offset = static_cast<int32_t>(eventBatchArena.size());
+        length = static_cast<int32_t>(value.size());
+        eventBatchArena.append(value.data(), value.size());
+        eventBatchArena.push_back('\0');
+    };
+
+    const unsigned int budget = updateBudget.load(std::memory_order_relaxed);
+    DeviceEvent event;
+    while ((budget == 0 || eventBatch.size() < budget) && deviceEvents.Pop(event))
+    {
+        DLNADeviceEvent& entry = eventBatch.emplace_back();
+        entry.kind = event.kind == DeviceEvent::Kind::Add ? 0 : 1;
+        append(event.device->UDN, entry.uuidOffset, entry.uuidLength);
+        append(event.kind == DeviceEvent::Kind::Add ? event.device->friendlyName : std::string(), entry.titleOffset, entry.titleLength);
+        append(event.kind == DeviceEvent::Kind::Add ? event.device->iconUrl : std::string(), entry.iconOffset, entry.iconLength);
+        append(event.kind == DeviceEvent::Kind::Add ? event.device->manufacturer : std::string(), entry.manufacturerOffset, entry.manufacturerLength);
+    }
+
+    if (!eventBatch.empty())
+        ptrToUnityDeviceEventsCallback(eventBatch.data(), static_cast<int>(eventBatch.size()), eventBatchArena.data(), static_cast<int>(eventBatchArena.size()));
+}
+
 void DLNAModule::RemoveServer(const char* udn)
 {
     if (!udn)
         return;
 
-    {
-        std::lock_guard<std::mutex> lock(UpnpDeviceMapMutex);
-        auto it = UpnpDeviceMap.find(udn);
-        if (it != UpnpDeviceMap.end())
-            UpnpDeviceMap.erase(it);
-    }
-
-    std::lock_guard<std::mutex> lock(deviceQueueMutex);
-    DLNAModule::GetInstance().queueRemoveDeviceInfo.emplace(std::make_shared<UpnpDevice>(udn));
+    descriptionCache.Remove(udn);
+    SaveDescriptionCache();
+    Unsubscribe(udn);
+    libraryIndexer.Untrack(udn);
+    DeviceRegistry::Device device = devices.Erase(udn);
+    if (!device)
+        device = std::make_shared<const UpnpDevice>(udn);
+    deviceEvents.Push({ DeviceEvent::Kind::Remove, std::move(device) });
 }
 
-void DLNAModule::ParseNewServer(IXML_Document* doc, const char* location)
+void DLNAModule::ParseNewServer(IXML_Document* doc, const char* location, int maxAge)
 {
     if (!doc || !location)
         return;
@@ -183,51 +271,43 @@ void DLNAModule::ParseNewServer(IXML_Document* doc, const char* location)
     if (!deviceList)
         return;
 
+    DescriptionCache::Entry cacheEntry;
     for (unsigned int i = 0; i < ixmlNodeList_length(deviceList); i++)
     {
-        IXML_Element* device = (IXML_Element*)ixmlNodeList_item(deviceList, i);
-        if (!device)
+        IXML_Element* deviceElement = (IXML_Element*)ixmlNodeList_item(deviceList, i);
+        if (!deviceElement)
             continue;
 
-        const char* deviceType = ixmlElement_getFirstChildElementValue(device, "deviceType");
+        const char* deviceType = ixmlElement_getFirstChildElementValue(deviceElement, "deviceType");
         if (!deviceType)
         {
             continue;
         }
 
-        const char* udn = ixmlElement_getFirstChildElementValue(device, "UDN");
-        {
-            std::lock_guard<std::mutex> lock(UpnpDeviceMapMutex);
-            if (!udn || UpnpDeviceMap.find(udn) != UpnpDeviceMap.end())
-                continue;
-        }
+        const char* udn = ixmlElement_getFirstChildElementValue(deviceElement, "UDN");
+        if (udn)
+            cacheEntry.udns.emplace_back(udn);
+        if (!udn || devices.Find(udn))
+            continue;
 
-        const char* friendlyName = ixmlElement_getFirstChildElementValue(device, "friendlyName");
+        const char* friendlyName = ixmlElement_getFirstChildElementValue(deviceElement, "friendlyName");
         if (!friendlyName)
         {
             continue;
         }
 
-        const char* manufacturer = ixmlElement_getFirstChildElementValue(device, "manufacturer");
+        const char* manufacturer = ixmlElement_getFirstChildElementValue(deviceElement, "manufacturer");
         std::string manufacturerString = manufacturer ? manufacturer : "";
-        std::string iconUrl = GetIconURL(device, baseURL);
+        std::string iconUrl = GetIconURL(deviceElement, baseURL);
 
-        {
-            std::lock_guard<std::mutex> lock(UpnpDeviceMapMutex);
-            if (UpnpDeviceMap.find(udn) == UpnpDeviceMap.end())
-            {
-                UpnpDeviceMap.emplace(std::piecewise_construct, std::forward_as_tuple(udn),
-                    std::forward_as_tuple(udn, friendlyName, location, iconUrl, manufacturerString));
-                Log(LogLevel::Info, "Device found: DeviceType=%s, UDN=%s, Name=%s", deviceType, udn, friendlyName);
-            }
-        }
+        /* The record is completed here and published once, readers never see it half built */
+        auto device = std::make_shared<UpnpDevice>(udn, friendlyName, location, iconUrl, manufacturerString);
+        bool contentDirectoryFound = false;
 
         /* Check for ContentDirectory service. */
-        IXML_NodeList* serviceList = ixmlElement_getElementsByTagName(device, "service");
-        if (!serviceList)
-            continue;
+        IXML_NodeList* serviceList = ixmlElement_getElementsByTagName(deviceElement, "service");
 
-        for (unsigned int j = 0; j < ixmlNodeList_length(serviceList); j++)
+        for (unsigned int j = 0; serviceList && j < ixmlNodeList_length(serviceList); j++)
         {
             IXML_Element* service = (IXML_Element*)ixmlNodeList_item(serviceList, j);
 
@@ -243,31 +323,253 @@ void DLNAModule::ParseNewServer(IXML_Document* doc, const char* location)
                 continue;
             }
 
+            const char* eventSubURL = ixmlElement_getFirstChildElementValue(service, "eventSubURL");
+            if (eventSubURL && *eventSubURL)
+                ResolveUrl(baseURL, eventSubURL, device->eventUrl);
+
             /* Try to browse content directory. */
             Log(LogLevel::Info, "%s support service:%s, BaseURL=%s, ControlURL=%s", friendlyName, serviceType, baseURL, controlURL);
-            std::lock_guard<std::mutex> lock(UpnpDeviceMapMutex);
-            auto itr = UpnpDeviceMap.find(udn);
-            if (itr != UpnpDeviceMap.end())
-                itr->second.deviceType = UpnpDevice::DeviceType::MediaServer;
-
-            char* url = (char*)malloc(strlen(baseURL) + strlen(controlURL) + 1);
-            if (!url)
-                continue;
+            device->deviceType = UpnpDevice::DeviceType::MediaServer;
 
-            int ret = UpnpResolveURL(baseURL, controlURL, url);
-            if (ret == UPNP_E_SUCCESS)
+            std::string controlUrl;
+            if (ResolveUrl(baseURL, controlURL, controlUrl))
             {
-                Log(LogLevel::Info, "UpnpResolveURL success, add device %s", friendlyName);
-                itr->second.location = url;
-                std::lock_guard<std::mutex> deviceQueueLock(deviceQueueMutex);
-                queueAddDeviceInfo.emplace(std::make_shared<UpnpDevice>(itr->second));
+                Log(LogLevel::Info, "ResolveUrl success, add device %s", friendlyName);
+                device->location = std::move(controlUrl);
+                contentDirectoryFound = true;
             }
-            else Log(LogLevel::Error, "UpnpResolveURL return %d, error: %d", ret, errno);
-            free(url);
+            else Log(LogLevel::Error, "ResolveUrl failed, base URL %s isn't absolute", baseURL);
+        }
+        if (serviceList)
+            ixmlNodeList_free(serviceList);
+
+        if (!devices.Insert(device))
+            continue;
+        Log(LogLevel::Info, "Device found: DeviceType=%s, UDN=%s, Name=%s", deviceType, udn, friendlyName);
+        if (contentDirectoryFound)
+        {
+            Subscribe(*device);
+            libraryIndexer.Track(device);
+            deviceEvents.Push({ DeviceEvent::Kind::Add, std::move(device) });
         }
-        ixmlNodeList_free(serviceList);
     }
     ixmlNodeList_free(deviceList);
+
+    for (const std::string& udn : cacheEntry.udns)
+        if (DeviceRegistry::Device device = devices.Find(udn))
+            cacheEntry.devices.push_back(*device);
+    cacheEntry.expires = DescriptionCache::Clock::now() + std::chrono::seconds(maxAge > 0 ? maxAge : DescriptionCache::DefaultMaxAge);
+    descriptionCache.Store(location, std::move(cacheEntry));
+    SaveDescriptionCache();
+}
+
+void DLNAModule::SaveDescriptionCache()
+{
+    /* Written on a worker so a slow disk never holds up discovery, a save already queued takes this change along */
+    descriptionWorkers.Submit("DescriptionCache", "DescriptionCache", []
+        {
+            while (GetInstance().descriptionCache.Save())
+                ;
+        });
+}
+
+void DLNAModule::FetchDescription(const std::string& location, int maxAge)
+{
+    /* Same as UpnpDownloadXmlDoc, with our own timeout and size limit, over the connection the actions use next */
+    HttpConnectionPool::Response reply;
+    int res = connections.Request("GET", location, "", "", std::chrono::seconds(DESCRIPTION_TIMEOUT * 2), MAX_DESCRIPTION_LENGTH, reply);
+    if (res != UPNP_E_SUCCESS || reply.status != 200)
+    {
+        Log(LogLevel::Warning, "Download description %s failed, http status %d: %s", location.c_str(), reply.status, UpnpGetErrorMessage(res));
+        return;
+    }
+
+    IXML_Document* description = ixmlParseBuffer(reply.body.c_str());
+    if (!description)
+    {
+        Log(LogLevel::Warning, "Parse description %s failed", location.c_str());
+        return;
+    }
+    ParseNewServer(description, location.c_str(), maxAge);
+    ixmlDocument_free(description);
+}
+
+void DLNAModule::RestoreServers(const std::vector<UpnpDevice>& cachedDevices)
+{
+    for (const UpnpDevice& cachedDevice : cachedDevices)
+    {
+        auto device = std::make_shared<const UpnpDevice>(cachedDevice);
+        if (!devices.Insert(device))
+            continue;
+        Log(LogLevel::Info, "Device restored from description cache: UDN=%s, Name=%s", device->UDN.c_str(), device->friendlyName.c_str());
+
+        if (device->deviceType == UpnpDevice::DeviceType::MediaServer)
+        {
+            libraryIndexer.Track(device);
+            deviceEvents.Push({ DeviceEvent::Kind::Add, std::move(device) });
+        }
+    }
+}
+
+void DLNAModule::SubscribeServers(const std::vector<UpnpDevice>& servers)
+{
+    for (const UpnpDevice& server : servers)
+        if (server.deviceType == UpnpDevice::DeviceType::MediaServer)
+            Subscribe(server);
+}
+
+void DLNAModule::Subscribe(const UpnpDevice& device)
+{
+    if (device.eventUrl.empty())
+        return;
+    {
+        std::lock_guard<std::mutex> lock(subscriptionMutex);
+        if (!subscribedServers.insert(device.UDN).second)
+            return;
+    }
+
+    std::string* udn = new std::string(device.UDN);
+    int res = UpnpSubscribeAsync(handle, device.eventUrl.c_str(), CONTENT_DIRECTORY_SUBSCRIPTION_TIMEOUT, UpnpSubscribeCallback, udn);
+    if (res != UPNP_E_SUCCESS)
+    {
+        Log(LogLevel::Warning, "Subscribe to %s failed: %s", device.eventUrl.c_str(), UpnpGetErrorMessage(res));
+        delete udn;
+        std::lock_guard<std::mutex> lock(subscriptionMutex);
+        subscribedServers.erase(device.UDN);
+    }
+}
+
+int DLNAModule::UpnpSubscribeCallback(Upnp_EventType eventType, const void* event, void* cookie)
+{
+    std::unique_ptr<std::string> udn(static_cast<std::string*>(cookie));
+    if (eventType != UPNP_EVENT_SUBSCRIBE_COMPLETE)
+        return UPNP_E_SUCCESS;
+
+    const UpnpEventSubscribe* subscription = (const UpnpEventSubscribe*)event;
+    const char* sid = UpnpString_get_String(UpnpEventSubscribe_get_SID(subscription));
+    int res = UpnpEventSubscribe_get_ErrCode(subscription);
+    DLNAModule& module = GetInstance();
+    std::lock_guard<std::mutex> lock(module.subscriptionMutex);
+    if (res != UPNP_E_SUCCESS || !sid || !*sid)
+    {
+        Log(LogLevel::Warning, "ContentDirectory subscription of %s failed: %s, browse results won't be cached", udn->c_str(), UpnpGetErrorMessage(res));
+        module.subscribedServers.erase(*udn);
+        return UPNP_E_SUCCESS;
+    }
+
+    /* A byebye that came while subscribing already unsubscribed the server, don't track it again */
+    if (!module.subscribedServers.count(*udn) || !module.devices.Find(*udn))
+    {
+        Log(LogLevel::Debug, "%s left while subscribing, dropping SID=%s", udn->c_str(), sid);
+        module.subscribedServers.erase(*udn);
+        UpnpUnSubscribeAsync(module.handle, sid, UpnpSubscribeCallback, nullptr);
+        return UPNP_E_SUCCESS;
+    }
+
+    Log(LogLevel::Info, "Subscribed to ContentDirectory events of %s, SID=%s", udn->c_str(), sid);
+    module.subscriptions[sid] = { *udn, std::nullopt };
+    module.browseCache.Track(*udn);
+    return UPNP_E_SUCCESS;
+}
+
+void DLNAModule::Unsubscribe(const std::string& udn)
+{
+    browseCache.Untrack(udn);
+    std::lock_guard<std::mutex> lock(subscriptionMutex);
+    subscribedServers.erase(udn);
+    for (auto it = subscriptions.begin(); it != subscriptions.end();)
+    {
+        if (it->second.udn != udn)
+        {
+            ++it;
+            continue;
+        }
+        UpnpUnSubscribeAsync(handle, it->first.c_str(), UpnpSubscribeCallback, nullptr);
+        it = subscriptions.erase(it);
+    }
+}
+
+void DLNAModule::OnSubscriptionLost(const char* sid)
+{
+    if (!sid)
+        return;
+
+    std::string udn;
+    {
+        std::lock_guard<std::mutex> lock(subscriptionMutex);
+        auto it = subscriptions.find(sid);
+        if (it == subscriptions.end())
+            return;
+        udn = it->second.udn;
+        subscriptions.erase(it);
+        subscribedServers.erase(udn);
+    }
+    /* Changes can't be seen anymore, the next advertisement subscribes again */
+    Log(LogLevel::Warning, "ContentDirectory subscription of %s lost", udn.c_str());
+    browseCache.Untrack(udn);
+}
+
+void DLNAModule::OnContentDirectoryEvent(const UpnpEvent* event)
+{
+    const char* sid = UpnpString_get_String(UpnpEvent_get_SID(event));
+    IXML_Document* variables = UpnpEvent_get_ChangedVariables(event);
+    if (!sid || !variables)
+        return;
+
+    const char* systemUpdateID = ixmlElement_getFirstChildElementValue((IXML_Element*)variables, "SystemUpdateID");
+    const char* containerUpdateIDs = ixmlElement_getFirstChildElementValue((IXML_Element*)variables, "ContainerUpdateIDs");
+    std::string udn;
+    bool systemChanged = false;
+    std::vector<std::pair<std::string, uint32_t>> changedContainers;
+    {
+        std::lock_guard<std::mutex> lock(subscriptionMutex);
+        auto it = subscriptions.find(sid);
+        if (it == subscriptions.end())
+            return;
+        udn = it->second.udn;
+        if (systemUpdateID)
+        {
+            /* Without a previous value to compare to, assume anything changed */
+            unsigned long value = strtoul(systemUpdateID, nullptr, 10);
+            systemChanged = it->second.systemUpdateID != value;
+            it->second.systemUpdateID = value;
+        }
+    }
+
+    if (containerUpdateIDs && *containerUpdateIDs)
+    {
+        /* "id,updateID,id,updateID...", commas inside an id are escaped with a backslash */
+        std::string field;
+        bool isObjectID = true;
+        for (const char* c = containerUpdateIDs;; c++)
+        {
+            if (*c == '\\' && c[1])
+                field += *++c;
+            else if (*c == ',' || !*c)
+            {
+                if (isObjectID)
+                {
+                    Log(LogLevel::Debug, "Container %s of %s changed", field.c_str(), udn.c_str());
+                    browseCache.InvalidateContainer(udn, field);
+                    changedContainers.emplace_back(field, 0);
+                }
+                else if (!changedContainers.empty())
+                    changedContainers.back().second = static_cast<uint32_t>(strtoul(field.c_str(), nullptr, 10));
+                isObjectID = !isObjectID;
+                field.clear();
+                if (!*c)
+                    break;
+            }
+            else field += *c;
+        }
+    }
+    else if (systemChanged)
+    {
+        Log(LogLevel::Debug, "Content of %s changed, SystemUpdateID=%s", udn.c_str(), systemUpdateID);
+        browseCache.InvalidateServer(udn);
+    }
+    if (systemUpdateID || !changedContainers.empty())
+        libraryIndexer.OnContentChanged(udn, systemUpdateID ? std::optional<uint64_t>(strtoull(systemUpdateID, nullptr, 10)) : std::nullopt, changedContainers);
 }
 
 #if _WIN64
@@ -1,57 +1,41 @@
 #pragma once
-#include <queue>
+#include <atomic>
+#include <cstdint>
 #include <mutex>
 #include <string>
 #include <tuple>
 #include <thread>
 #include <map>
+#include <optional>
+#include <set>
+#include <vector>
 #include <filesystem>
 
 #include "upnp.h"
+#include "UpnpDevice.h"
+#include "BrowseCache.h"
+#include "DescriptionCache.h"
+#include "DeviceRegistry.h"
+#include "DeviceEventQueue.h"
+#include "HttpConnectionPool.h"
+#include "LibraryIndexer.h"
+#include "RequestEngine.h"
+#include "WorkerPool.h"
 
 typedef void(*AddDLNADeviceCallback)(const char* uuid, int uuidLength, const char* title, int titleLength, const char* iconurl, int iconLength, const char* manufacturer, int manufacturerLength);
 typedef void(*RemoveDLNADeviceCallback)(const char* uuid, int uuidLength);
 
-struct UpnpDevice
+/* One entry of a device event batch, strings are offsets into the batch arena (each one is also nul terminated) */
+struct DLNADeviceEvent
 {
-    std::string UDN;
-    std::string friendlyName;
-    std::string location;
-    std::string iconUrl;
-    std::string manufacturer;
-    enum DeviceType
-    {
-        UnknownDevice = 0,
-        MediaServer = 1,
-        MediaRenderer = 2,
-    }deviceType;
-
-    UpnpDevice(const UpnpDevice& other)
-        : UDN(other.UDN)
-        , friendlyName(other.friendlyName)
-        , location(other.location)
-        , iconUrl(other.iconUrl)
-        , manufacturer(other.manufacturer)
-        , deviceType(other.deviceType)
-    {
-    }
-
-    UpnpDevice(const std::string& udn)
-        : UDN(udn)
-        , deviceType(UnknownDevice)
-    {
-    }
-
-    UpnpDevice(const std::string& udn, const std::string& friendlyName, const std::string& location, const std::string& iconUrl, const std::string& manufacturer)
-        : UDN(udn)
-        , friendlyName(friendlyName)
-        , location(location)
-        , iconUrl(iconUrl)
-        , manufacturer(manufacturer)
-        , deviceType(UnknownDevice)
-    {
-    }
+    int32_t kind; // 0 = add, 1 = remove
+    int32_t uuidOffset, uuidLength;
+    int32_t titleOffset, titleLength;
+    int32_t iconOffset, iconLength;
+    int32_t manufacturerOffset, manufacturerLength;
 };
+static_assert(sizeof(DLNADeviceEvent) == 9 * sizeof(int32_t), "DLNADeviceEvent is mirrored by managed code");
+typedef void(*DLNADeviceEventsCallback)(const DLNADeviceEvent* events, int eventCount, const char* arena, int arenaLength);
 
 class DLNAModule
 {
@@ -61,33 +45,62 @@ public:
 private:
     static DLNAModule _dlnaInst;
     static int UpnpRegisterClientCallback(Upnp_EventType event_type, const void* p_event, void* p_cookie);
+    static int UpnpSubscribeCallback(Upnp_EventType event_type, const void* p_event, void* p_cookie);
 
 public:
     AddDLNADeviceCallback ptrToUnityAddDLNADeviceCallBack = nullptr;
     RemoveDLNADeviceCallback ptrToUnityRemoveDLNADeviceCallback = nullptr;
+    DLNADeviceEventsCallback ptrToUnityDeviceEventsCallback = nullptr;
 
     const std::filesystem::path logFile;
     UpnpClient_Handle handle;
 
 private:
-    std::queue<std::shared_ptr<UpnpDevice>> queueAddDeviceInfo;
-    std::queue<std::shared_ptr<UpnpDevice>> queueRemoveDeviceInfo;
-    std::mutex deviceQueueMutex;
+    DeviceEventQueue deviceEvents;
+    std::vector<DLNADeviceEvent> eventBatch;
+    std::string eventBatchArena;
+
+    struct EventSubscription
+    {
+        std::string udn;
+        std::optional<unsigned long> systemUpdateID;
+    };
+    std::mutex subscriptionMutex;
+    std::map<std::string, EventSubscription> subscriptions; // By SID
+    std::set<std::string> subscribedServers;                // Subscribed or subscribing, by UDN
 
 public:
-    std::mutex UpnpDeviceMapMutex;
-    std::map<std::string, UpnpDevice> UpnpDeviceMap;
+    DeviceRegistry devices;
+    BrowseCache browseCache{ 16 * 1024 * 1024 };
+    std::atomic<unsigned int> updateBudget{ 0 }; // Events delivered per Update(), 0 for all of them
     std::atomic_flag discoverAtomicFlag;
+    DescriptionCache descriptionCache;
+    HttpConnectionPool connections{ 4, std::chrono::seconds(15) }; // Kept to the servers, outlives the workers using it
+    RequestEngine requests{ 64 };   // Browse and search requests of Unity, outlives the workers holding them
+    WorkerPool descriptionWorkers{ 4, 64, 2 };
+    WorkerPool searchWorkers{ 8, 1024, 4 }; // ContentDirectory requests of SearchDLNAServers, by server host
+    WorkerPool actionWorkers{ 8, 1024, 4 }; // Browse actions of BrowseDLNAFolder, by server host
+    LibraryIndexer libraryIndexer;
 
 public:
     void Initialize();
     void Finitialize();
     void Search();
     void Update();
+    DLNARequestStats RequestStats();
 
 private:
     void RemoveServer(const char* udn);
-    void ParseNewServer(IXML_Document* doc, const char* location);
+    void ParseNewServer(IXML_Document* doc, const char* location, int maxAge);
+    void RestoreServers(const std::vector<UpnpDevice>& cachedDevices);
+    void FetchDescription(const std::string& location, int maxAge);
+    void SaveDescriptionCache();
+    void UpdateBatch();
+    void Subscribe(const UpnpDevice& device);
+    void SubscribeServers(const std::vector<UpnpDevice>& servers);
+    void Unsubscribe(const std::string& udn);
+    void OnContentDirectoryEvent(const UpnpEvent* event);
+    void OnSubscriptionLost(const char* sid);
 #if _WIN64
     char8_t* GetBestAdapterInterfaceName();
 #endif
@@ -0,0 +1,207 @@
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+
+#include "rapidjson/document.h"
+#include "rapidjson/stringbuffer.h"
+#include "rapidjson/writer.h"
+
+#include "DescriptionCache.h"
+#include "logger.h"
+
+namespace
+{
+    constexpr int CacheFileVersion = 1;
+
+    const char* GetString(const rapidjson::Value& object, const char* name)
+    {
+        auto member = object.FindMember(name);
+        return member != object.MemberEnd() && member->value.IsString() ? member->value.GetString() : "";
+    }
+}
+
+void DescriptionCache::Load(const std::filesystem::path& cachePath)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    path = cachePath;
+    if (path.empty())
+        return;
+
+    std::ifstream file{ path, std::ios::in | std::ios::binary };
+    if (!file.is_open())
+        return;
+    std::stringstream content;
+    content << file.rdbuf();
+
+    rapidjson::Document document;
+    document.Parse(content.str().c_str());
+    if (document.HasParseError() || !document.IsObject() || !document.HasMember("version") || !document["version"].IsInt()
+        || document["version"].GetInt() != CacheFileVersion || !document.HasMember("entries") || !document["entries"].IsArray())
+    {
+        Log(LogLevel::Warning, "Ignoring unreadable description cache %s", path.string().c_str());
+        return;
+    }
+
+    const Clock::time_point now = Clock::now();
+    for (const rapidjson::Value& item : document["entries"].GetArray())
+    {
+        if (!item.IsObject() || !item.HasMember("expires") || !item["expires"].IsInt64()
+            || !item.HasMember("udns") || !item["udns"].IsArray() || !item.HasMember("devices") || !item["devices"].IsArray())
+            continue;
+
+        Entry entry;
+        entry.expires = Clock::time_point(std::chrono::seconds(item["expires"].GetInt64()));
+        if (entry.expires <= now)
+            continue;
+
+        for (const rapidjson::Value& udn : item["udns"].GetArray())
+            if (udn.IsString())
+                entry.udns.emplace_back(udn.GetString());
+
+        for (const rapidjson::Value& device : item["devices"].GetArray())
+        {
+            if (!device.IsObject() || !*GetString(device, "udn"))
+                continue;
+            UpnpDevice& cached = entry.devices.emplace_back(GetString(device, "udn"), GetString(device, "friendlyName"),
+                GetString(device, "location"), GetString(device, "iconUrl"), GetString(device, "manufacturer"));
+            cached.eventUrl = GetString(device, "eventUrl");
+            if (device.HasMember("deviceType") && device["deviceType"].IsInt())
+                cached.deviceType = static_cast<UpnpDevice::DeviceType>(device["deviceType"].GetInt());
+        }
+        entries.insert_or_assign(GetString(item, "location"), std::move(entry));
+    }
+    Log(LogLevel::Info, "Loaded %d device descriptions from %s", static_cast<int>(entries.size()), path.string().c_str());
+}
+
+bool DescriptionCache::Save()
+{
+    std::lock_guard<std::mutex> fileLock(fileMutex);
+    rapidjson::StringBuffer buffer;
+    std::filesystem::path cachePath;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (path.empty() || !dirty)
+            return false;
+        cachePath = path;
+        dirty = false;
+
+        rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
+        writer.StartObject();
+        writer.Key("version");
+        writer.Int(CacheFileVersion);
+        writer.Key("entries");
+        writer.StartArray();
+        for (const auto& [location, entry] : entries)
+        {
+            writer.StartObject();
+            writer.Key("location");
+            writer.String(location.c_str(), static_cast<rapidjson::SizeType>(location.length()));
+            writer.Key("expires");
+            writer.Int64(std::chrono::duration_cast<std::chrono::seconds>(entry.expires.time_since_epoch()).count());
+            writer.Key("udns");
+            writer.StartArray();
+            for (const std::string& udn : entry.udns)
+                writer.String(udn.c_str(), static_cast<rapidjson::SizeType>(udn.length()));
+            writer.EndArray();
+            writer.Key("devices");
+            writer.StartArray();
+            for (const UpnpDevice& device : entry.devices)
+            {
+                writer.StartObject();
+                writer.Key("udn");
+                writer.String(device.UDN.c_str(), static_cast<rapidjson::SizeType>(device.UDN.length()));
+                writer.Key("friendlyName");
+                writer.String(device.friendlyName.c_str(), static_cast<rapidjson::SizeType>(device.friendlyName.length()));
+                writer.Key("location");
+                writer.String(device.location.c_str(), static_cast<rapidjson::SizeType>(device.location.length()));
+                writer.Key("iconUrl");
+                writer.String(device.iconUrl.c_str(), static_cast<rapidjson::SizeType>(device.iconUrl.length()));
+                writer.Key("manufacturer");
+                writer.String(device.manufacturer.c_str(), static_cast<rapidjson::SizeType>(device.manufacturer.length()));
+                writer.Key("eventUrl");
+                writer.String(device.eventUrl.c_str(), static_cast<rapidjson::SizeType>(device.eventUrl.length()));
+                writer.Key("deviceType");
+                writer.Int(device.deviceType);
+                writer.EndObject();
+            }
+            writer.EndArray();
+            writer.EndObject();
+        }
+        writer.EndArray();
+        writer.EndObject();
+    }
+
+    /* Write aside and rename, so a crash never leaves half a cache behind */
+    std::filesystem::path temporary = cachePath;
+    temporary += ".tmp";
+    {
+        std::ofstream file{ temporary, std::ios::out | std::ios::binary | std::ios::trunc };
+        if (!file.is_open() || !file.write(buffer.GetString(), buffer.GetSize()))
+        {
+            Log(LogLevel::Warning, "Unable to write description cache %s", temporary.string().c_str());
+            return true;
+        }
+    }
+    std::error_code error;
+    std::filesystem::rename(temporary, cachePath, error);
+    if (error)
+        Log(LogLevel::Warning, "Unable to replace description cache %s: %s", cachePath.string().c_str(), error.message().c_str());
+    return true;
+}
+
+bool DescriptionCache::Refresh(const std::string& location, const std::string& udn, int maxAge, std::vector<UpnpDevice>& devices)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = entries.find(location);
+    if (it == entries.end())
+        return false;
+
+    const Clock::time_point now = Clock::now();
+    Entry& entry = it->second;
+    if (entry.expires <= now || std::find(entry.udns.begin(), entry.udns.end(), udn) == entry.udns.end())
+    {
+        entries.erase(it);
+        dirty = true;
+        return false;
+    }
+
+    /* Saved too, or the file keeps the expiry of the first fetch and the next run finds nothing fresh */
+    const Clock::time_point expires = now + std::chrono::seconds(maxAge > 0 ? maxAge : DefaultMaxAge);
+    if (expires > entry.expires)
+    {
+        entry.expires = expires;
+        dirty = true;
+    }
+    devices = entry.devices;
+    return true;
+}
+
+void DescriptionCache::Store(const std::string& location, Entry entry)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    entries.insert_or_assign(location, std::move(entry));
+    dirty = true;
+}
+
+void DescriptionCache::Remove(const std::string& udn)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (std::erase_if(entries, [&udn](const auto& item)
+        {
+            const std::vector<std::string>& udns = item.second.udns;
+            return std::find(udns.begin(), udns.end(), udn) != udns.end();
+        }))
+        dirty = true;
+}
+
+std::vector<UpnpDevice> DescriptionCache::FreshDevices()
+{
+    std::vector<UpnpDevice> devices;
+    std::lock_guard<std::mutex> lock(mutex);
+    const Clock::time_point now = Clock::now();
+    for (const auto& [location, entry] : entries)
+        if (entry.expires > now)
+            std::copy(entry.devices.begin(), entry.devices.end(), std::back_inserter(devices));
+    return devices;
+}
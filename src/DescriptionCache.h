@@ -0,0 +1,51 @@
+#pragma once
+#include <chrono>
+#include <filesystem>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "UpnpDevice.h"
+
+/*
+ * Device descriptions already downloaded, keyed by their location.
+ *
+ * An entry stays fresh for the max-age of the advertisement that brought it, and every
+ * advertisement of a known UDN at the same location extends it, so alive messages from
+ * a busy network don't download the same description again. Entries are saved to disk
+ * so servers seen during the previous run can be shown before any SSDP reply arrives.
+ * Changes only mark the cache dirty, the owner decides when Save writes it.
+ */
+class DescriptionCache
+{
+public:
+    using Clock = std::chrono::system_clock;
+
+    struct Entry
+    {
+        Clock::time_point expires;
+        std::vector<std::string> udns;      // Every device of the description, usable or not
+        std::vector<UpnpDevice> devices;    // Devices as they were added to the registry
+    };
+
+    // An empty path keeps the cache in memory only.
+    void Load(const std::filesystem::path& path);
+    // Writes the entries when they changed since the last save, returns false when there was nothing to write.
+    bool Save();
+
+    // Returns true and the devices of location when it was described recently and lists udn.
+    bool Refresh(const std::string& location, const std::string& udn, int maxAge, std::vector<UpnpDevice>& devices);
+    void Store(const std::string& location, Entry entry);
+    void Remove(const std::string& udn);
+    std::vector<UpnpDevice> FreshDevices();
+
+    static constexpr int DefaultMaxAge = 1800;
+
+private:
+    std::mutex mutex;
+    std::map<std::string, Entry> entries;
+    std::filesystem::path path;
+    bool dirty = false;
+    std::mutex fileMutex; // One save writes the file at a time
+};
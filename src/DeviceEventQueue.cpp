@@ -0,0 +1,74 @@
+#include "DeviceEventQueue.h"
+
+DeviceEventQueue::DeviceEventQueue()
+{
+    for (size_t i = 0; i < Capacity; i++)
+        slots[i].sequence.store(i, std::memory_order_relaxed);
+}
+
+void DeviceEventQueue::Push(DeviceEvent event)
+{
+    if (!overflowing.load(std::memory_order_acquire) && TryPush(event))
+        return;
+
+    std::lock_guard<std::mutex> lock(overflowMutex);
+    overflowing.store(true, std::memory_order_release);
+    overflow.push_back(std::move(event));
+}
+
+bool DeviceEventQueue::Pop(DeviceEvent& event)
+{
+    if (TryPop(event))
+        return true;
+    if (!overflowing.load(std::memory_order_acquire))
+        return false;
+
+    std::lock_guard<std::mutex> lock(overflowMutex);
+    /* Events that reached the ring before the overflow started go first */
+    if (TryPop(event))
+        return true;
+    if (overflow.empty())
+    {
+        overflowing.store(false, std::memory_order_release);
+        return false;
+    }
+    event = std::move(overflow.front());
+    overflow.pop_front();
+    return true;
+}
+
+bool DeviceEventQueue::TryPush(DeviceEvent& event)
+{
+    size_t position = enqueuePosition.load(std::memory_order_relaxed);
+    Slot* slot;
+    for (;;)
+    {
+        slot = &slots[position & (Capacity - 1)];
+        size_t sequence = slot->sequence.load(std::memory_order_acquire);
+        intptr_t difference = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position);
+        if (difference == 0)
+        {
+            if (enqueuePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+                break;
+        }
+        else if (difference < 0)
+            return false; /* Full */
+        else position = enqueuePosition.load(std::memory_order_relaxed);
+    }
+
+    slot->event = std::move(event);
+    slot->sequence.store(position + 1, std::memory_order_release);
+    return true;
+}
+
+bool DeviceEventQueue::TryPop(DeviceEvent& event)
+{
+    Slot& slot = slots[dequeuePosition & (Capacity - 1)];
+    if (slot.sequence.load(std::memory_order_acquire) != dequeuePosition + 1)
+        return false;
+
+    event = std::move(slot.event);
+    slot.sequence.store(dequeuePosition + Capacity, std::memory_order_release);
+    dequeuePosition++;
+    return true;
+}
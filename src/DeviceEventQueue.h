@@ -0,0 +1,61 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+
+#include "DeviceRegistry.h"
+
+struct DeviceEvent
+{
+    enum class Kind : uint8_t
+    {
+        Add,
+        Remove
+    };
+
+    Kind kind = Kind::Add;
+    DeviceRegistry::Device device; // The published record, shared rather than copied
+};
+
+/*
+ * Device events from the discovery threads to Update(), in a single ordered stream.
+ *
+ * A bounded multi-producer ring (Vyukov's sequence-per-slot design): producers claim
+ * a slot with one CAS, the consumer takes events without any lock. Events are only
+ * diverted to a mutex-guarded overflow list while the ring is full, and everything
+ * goes there until the consumer has caught up, so a producer's events never overtake
+ * each other.
+ */
+class DeviceEventQueue
+{
+public:
+    static constexpr size_t Capacity = 256;
+    static_assert((Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+
+    DeviceEventQueue();
+
+    // Any thread.
+    void Push(DeviceEvent event);
+    // Update() thread only.
+    bool Pop(DeviceEvent& event);
+
+private:
+    bool TryPush(DeviceEvent& event);
+    bool TryPop(DeviceEvent& event);
+
+    struct Slot
+    {
+        std::atomic<size_t> sequence;
+        DeviceEvent event;
+    };
+
+    std::array<Slot, Capacity> slots;
+    alignas(64) std::atomic<size_t> enqueuePosition{ 0 };
+    alignas(64) size_t dequeuePosition = 0;
+
+    std::atomic<bool> overflowing{ false };
+    std::mutex overflowMutex;
+    std::deque<DeviceEvent> overflow;
+};
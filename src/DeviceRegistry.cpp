@@ -0,0 +1,65 @@
+#include "DeviceRegistry.h"
+
+DeviceRegistry::DeviceRegistry()
+    : snapshot(std::make_shared<const Map>())
+{
+}
+
+DeviceRegistry::Snapshot DeviceRegistry::Load() const
+{
+#if __cpp_lib_atomic_shared_ptr
+    return snapshot.load(std::memory_order_acquire);
+#else
+    return std::atomic_load_explicit(&snapshot, std::memory_order_acquire);
+#endif
+}
+
+void DeviceRegistry::Publish(Snapshot next)
+{
+#if __cpp_lib_atomic_shared_ptr
+    snapshot.store(std::move(next), std::memory_order_release);
+#else
+    std::atomic_store_explicit(&snapshot, std::move(next), std::memory_order_release);
+#endif
+}
+
+DeviceRegistry::Device DeviceRegistry::Find(std::string_view udn) const
+{
+    Snapshot devices = Load();
+    auto it = devices->find(udn);
+    return it != devices->end() ? it->second : nullptr;
+}
+
+bool DeviceRegistry::Insert(Device device)
+{
+    std::lock_guard<std::mutex> lock(writerMutex);
+    Snapshot current = Load();
+    if (!device || current->find(device->UDN) != current->end())
+        return false;
+
+    auto next = std::make_shared<Map>(*current);
+    next->emplace(device->UDN, std::move(device));
+    Publish(std::move(next));
+    return true;
+}
+
+DeviceRegistry::Device DeviceRegistry::Erase(std::string_view udn)
+{
+    std::lock_guard<std::mutex> lock(writerMutex);
+    Snapshot current = Load();
+    auto it = current->find(udn);
+    if (it == current->end())
+        return nullptr;
+
+    Device erased = it->second;
+    auto next = std::make_shared<Map>(*current);
+    next->erase(erased->UDN);
+    Publish(std::move(next));
+    return erased;
+}
+
+void DeviceRegistry::Clear()
+{
+    std::lock_guard<std::mutex> lock(writerMutex);
+    Publish(std::make_shared<const Map>());
+}
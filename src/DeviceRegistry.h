@@ -0,0 +1,53 @@
+#pragma once
+#include <atomic>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+
+#include "UpnpDevice.h"
+
+/*
+ * Known devices by UDN, read far more often than written.
+ *
+ * Readers load the current snapshot with one atomic operation and never wait for
+ * writers. Writers are serialized, copy the snapshot, change the copy and publish
+ * it. Records are immutable once published, a change replaces the record, so a
+ * device handed to a reader stays valid and consistent as long as it is held.
+ *
+ * That load is still not lock-free, a shared_ptr can't be read atomically without
+ * one. libstdc++ guards std::atomic<shared_ptr> with a spin bit inside the
+ * object, and where it is missing (libc++) std::atomic_load and std::atomic_store
+ * take a lock from a small global pool, possibly shared with unrelated atomics.
+ * Either way the lock is only held while the reference count is taken, never for
+ * as long as a writer runs.
+ */
+class DeviceRegistry
+{
+public:
+    using Device = std::shared_ptr<const UpnpDevice>;
+    using Map = std::map<std::string, Device, std::less<>>;
+    using Snapshot = std::shared_ptr<const Map>;
+
+    DeviceRegistry();
+
+    Snapshot Load() const;
+    Device Find(std::string_view udn) const;
+
+    // Returns false, leaving the registry untouched, when the UDN is already known.
+    bool Insert(Device device);
+    Device Erase(std::string_view udn);
+    void Clear();
+
+private:
+    void Publish(Snapshot next);
+
+    std::mutex writerMutex;
+#if __cpp_lib_atomic_shared_ptr
+    std::atomic<Snapshot> snapshot;
+#else
+    Snapshot snapshot; // Only accessed through std::atomic_load and std::atomic_store
+#endif
+};
@@ -0,0 +1,581 @@
+#include <algorithm>
+#include <climits>
+#include <cstring>
+
+#include "HttpConnectionPool.h"
+#include "URLHandler.h"
+#include "logger.h"
+#include "upnp.h"
+
+/* After upnp.h, which wants winsock2.h before windows.h */
+#if _WIN32
+#include <ws2tcpip.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+    using Clock = std::chrono::steady_clock;
+
+#if _WIN32
+    using Socket = SOCKET;
+    const Socket InvalidSocket = INVALID_SOCKET;
+    constexpr int SendFlags = 0;
+
+    int Poll(pollfd* fds, unsigned long count, int timeout) { return WSAPoll(fds, count, timeout); }
+    void CloseSocket(Socket socket) { closesocket(socket); }
+    bool SetNonBlocking(Socket socket)
+    {
+        u_long enable = 1;
+        return ioctlsocket(socket, FIONBIO, &enable) == 0;
+    }
+    bool Interrupted() { return false; }
+    bool WouldBlock() { return WSAGetLastError() == WSAEWOULDBLOCK; }
+    bool ConnectPending() { return WSAGetLastError() == WSAEWOULDBLOCK; }
+#else
+    using Socket = int;
+    const Socket InvalidSocket = -1;
+#ifdef MSG_NOSIGNAL
+    constexpr int SendFlags = MSG_NOSIGNAL;
+#else
+    constexpr int SendFlags = 0; // SO_NOSIGPIPE is set instead
+#endif
+
+    int Poll(pollfd* fds, nfds_t count, int timeout) { return poll(fds, count, timeout); }
+    void CloseSocket(Socket socket) { close(socket); }
+    bool SetNonBlocking(Socket socket)
+    {
+        int flags = fcntl(socket, F_GETFL, 0);
+        return flags >= 0 && fcntl(socket, F_SETFL, flags | O_NONBLOCK) == 0;
+    }
+    bool Interrupted() { return errno == EINTR; }
+    bool WouldBlock() { return errno == EAGAIN || errno == EWOULDBLOCK; }
+    bool ConnectPending() { return errno == EINPROGRESS; }
+#endif
+
+    constexpr size_t MaxHeaderLength = 16 * 1024;
+    constexpr size_t ReceiveSize = 64 * 1024;
+
+    int Remaining(Clock::time_point deadline)
+    {
+        auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - Clock::now()).count();
+        return static_cast<int>(std::clamp<long long>(left, 0, INT_MAX));
+    }
+
+    /* False once the deadline passed, errors and hangups count as ready so the next call reports them */
+    bool WaitFor(Socket socket, short events, Clock::time_point deadline)
+    {
+        for (;;)
+        {
+            pollfd fd{};
+            fd.fd = socket;
+            fd.events = events;
+            int ready = Poll(&fd, 1, Remaining(deadline));
+            if (ready > 0)
+                return true;
+            if (ready == 0 || !Interrupted())
+                return false;
+        }
+    }
+
+    /* A kept connection with something to read was closed by the server, or is out of step */
+    bool Readable(Socket socket)
+    {
+        pollfd fd{};
+        fd.fd = socket;
+        fd.events = POLLIN;
+        return Poll(&fd, 1, 0) != 0;
+    }
+
+    int Connect(const std::string& host, unsigned int port, Clock::time_point deadline, Socket& connected)
+    {
+        addrinfo hints{};
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        hints.ai_flags = AI_NUMERICSERV;
+        addrinfo* addresses = nullptr;
+        if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &addresses) != 0)
+            return UPNP_E_SOCKET_CONNECT;
+
+        int res = UPNP_E_SOCKET_CONNECT;
+        for (addrinfo* address = addresses; address && res != UPNP_E_SUCCESS; address = address->ai_next)
+        {
+            Socket socket = ::socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+            if (socket == InvalidSocket)
+                continue;
+
+            /* Requests go out in a single send, waiting to coalesce them would only add latency */
+            int enable = 1;
+            setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char*>(&enable), sizeof(enable));
+#ifdef SO_NOSIGPIPE
+            setsockopt(socket, SOL_SOCKET, SO_NOSIGPIPE, &enable, sizeof(enable));
+#endif
+            bool done = false;
+            if (SetNonBlocking(socket))
+            {
+                if (connect(socket, address->ai_addr, static_cast<socklen_t>(address->ai_addrlen)) == 0)
+                    done = true;
+                else if (ConnectPending() && WaitFor(socket, POLLOUT, deadline))
+                {
+                    int error = 0;
+                    socklen_t length = sizeof(error);
+                    done = getsockopt(socket, SOL_SOCKET, SO_ERROR, reinterpret_cast<char*>(&error), &length) == 0 && error == 0;
+                }
+            }
+            if (done)
+            {
+                connected = socket;
+                res = UPNP_E_SUCCESS;
+            }
+            else
+            {
+                CloseSocket(socket);
+                if (Clock::now() >= deadline)
+                {
+                    res = UPNP_E_TIMEDOUT;
+                    break;
+                }
+            }
+        }
+        freeaddrinfo(addresses);
+        return res;
+    }
+
+    int SendAll(Socket socket, std::string_view data, Clock::time_point deadline)
+    {
+        while (!data.empty())
+        {
+            int sent = send(socket, data.data(), static_cast<int>(std::min<size_t>(data.size(), INT_MAX)), SendFlags);
+            if (sent > 0)
+                data.remove_prefix(sent);
+            else if (sent < 0 && (Interrupted() || WouldBlock()))
+            {
+                if (!WaitFor(socket, POLLOUT, deadline))
+                    return UPNP_E_TIMEDOUT;
+            }
+            else
+                return UPNP_E_SOCKET_WRITE;
+        }
+        return UPNP_E_SUCCESS;
+    }
+
+    /* Appends what arrives to buffer, received is 0 once the server closed the connection */
+    int Receive(Socket socket, std::string& buffer, Clock::time_point deadline, size_t& received)
+    {
+        const size_t size = buffer.size();
+        buffer.resize(size + ReceiveSize);
+        for (;;)
+        {
+            int read = recv(socket, buffer.data() + size, static_cast<int>(ReceiveSize), 0);
+            if (read >= 0)
+            {
+                buffer.resize(size + read);
+                received = read;
+                return UPNP_E_SUCCESS;
+            }
+            if (!Interrupted() && !WouldBlock())
+                break;
+            if (!WaitFor(socket, POLLIN, deadline))
+            {
+                buffer.resize(size);
+                return UPNP_E_TIMEDOUT;
+            }
+        }
+        buffer.resize(size);
+        return UPNP_E_SOCKET_READ;
+    }
+
+    bool EqualsIgnoringCase(std::string_view a, std::string_view b)
+    {
+        return a.size() == b.size() && std::equal(a.begin(), a.end(), b.begin(), [](char x, char y)
+            {
+                return (x >= 'A' && x <= 'Z' ? x - 'A' + 'a' : x) == (y >= 'A' && y <= 'Z' ? y - 'A' + 'a' : y);
+            });
+    }
+
+    bool ContainsToken(std::string_view value, std::string_view token)
+    {
+        while (!value.empty())
+        {
+            size_t comma = std::min(value.find(','), value.size());
+            std::string_view item = value.substr(0, comma);
+            while (!item.empty() && (item.front() == ' ' || item.front() == '\t'))
+                item.remove_prefix(1);
+            while (!item.empty() && (item.back() == ' ' || item.back() == '\t'))
+                item.remove_suffix(1);
+            if (EqualsIgnoringCase(item, token))
+                return true;
+            value.remove_prefix(std::min(comma + 1, value.size()));
+        }
+        return false;
+    }
+
+    /*
+     * Reads one response off the connection. keep tells whether the connection can carry
+     * another request, answered whether any byte of a response came back.
+     */
+    int ReadResponse(Socket socket, Clock::time_point deadline, size_t maxLength, HttpConnectionPool::Response& response, bool& keep, bool& answered)
+    {
+        std::string buffer;
+        auto more = [&]() -> int
+        {
+            size_t received = 0;
+            int res = Receive(socket, buffer, deadline, received);
+            if (res == UPNP_E_SUCCESS && received == 0)
+                res = UPNP_E_SOCKET_READ;
+            answered |= received != 0;
+            return res;
+        };
+
+        /* Interim 1xx responses are skipped */
+        size_t headerEnd;
+        bool http11 = false;
+        for (;;)
+        {
+            while ((headerEnd = buffer.find("\r\n\r\n")) == std::string::npos)
+            {
+                if (buffer.size() > MaxHeaderLength)
+                    return UPNP_E_BAD_HTTPMSG;
+                if (int res = more())
+                    return res;
+            }
+            if (buffer.compare(0, 5, "HTTP/") || headerEnd < 12 || buffer[8] != ' ')
+                return UPNP_E_BAD_HTTPMSG;
+            http11 = buffer.compare(5, 3, "1.0") != 0;
+            response.status = atoi(buffer.c_str() + 9);
+            if (response.status < 100 || response.status > 999)
+                return UPNP_E_BAD_HTTPMSG;
+            if (response.status >= 200)
+                break;
+            buffer.erase(0, headerEnd + 4);
+        }
+
+        size_t contentLength = SIZE_MAX;
+        bool chunked = false, close = false, keepAlive = false;
+        std::string_view headers = std::string_view(buffer).substr(0, headerEnd);
+        headers.remove_prefix(std::min(headers.find("\r\n"), headers.size()));
+        while (!headers.empty())
+        {
+            headers.remove_prefix(2);
+            const size_t lineEnd = std::min(headers.find("\r\n"), headers.size());
+            const std::string_view line = headers.substr(0, lineEnd);
+            headers.remove_prefix(lineEnd);
+            const size_t colon = line.find(':');
+            if (colon == std::string_view::npos)
+                continue;
+            const std::string_view name = line.substr(0, colon);
+            std::string_view value = line.substr(colon + 1);
+            while (!value.empty() && (value.front() == ' ' || value.front() == '\t'))
+                value.remove_prefix(1);
+            if (EqualsIgnoringCase(name, "Content-Length"))
+            {
+                contentLength = 0;
+                size_t digits = 0;
+                for (; digits < value.size() && value[digits] >= '0' && value[digits] <= '9'; digits++)
+                {
+                    contentLength = contentLength * 10 + (value[digits] - '0');
+                    if (contentLength > maxLength)
+                        return UPNP_E_BAD_RESPONSE;
+                }
+                if (digits == 0 || value.find_first_not_of(" \t", digits) != std::string_view::npos)
+                    return UPNP_E_BAD_HTTPMSG;
+            }
+            else if (EqualsIgnoringCase(name, "Transfer-Encoding"))
+                chunked = ContainsToken(value, "chunked");
+            else if (EqualsIgnoringCase(name, "Connection"))
+            {
+                close = ContainsToken(value, "close");
+                keepAlive = ContainsToken(value, "keep-alive");
+            }
+        }
+        keep = http11 ? !close : keepAlive;
+        buffer.erase(0, headerEnd + 4);
+
+        response.body.clear();
+        if (response.status == 204 || response.status == 304)
+            keep = keep && buffer.empty();
+        else if (chunked)
+        {
+            size_t at = 0;
+            for (;;)
+            {
+                size_t lineEnd;
+                while ((lineEnd = buffer.find("\r\n", at)) == std::string::npos)
+                {
+                    if (buffer.size() - at > 1024)
+                        return UPNP_E_BAD_HTTPMSG;
+                    if (int res = more())
+                        return res;
+                }
+                size_t size = 0;
+                size_t digit = at;
+                for (; digit < lineEnd; digit++)
+                {
+                    const char c = buffer[digit];
+                    const int value = c >= '0' && c <= '9' ? c - '0' : c >= 'a' && c <= 'f' ? c - 'a' + 10 : c >= 'A' && c <= 'F' ? c - 'A' + 10 : -1;
+                    if (value < 0)
+                        break;
+                    size = size * 16 + value;
+                    if (size > maxLength)
+                        return UPNP_E_BAD_RESPONSE;
+                }
+                if (digit == at || (digit < lineEnd && buffer[digit] != ';' && buffer[digit] != ' '))
+                    return UPNP_E_BAD_HTTPMSG;
+                at = lineEnd + 2;
+
+                if (size == 0)
+                {
+                    /* Trailers, up to an empty line */
+                    for (;;)
+                    {
+                        while ((lineEnd = buffer.find("\r\n", at)) == std::string::npos)
+                        {
+                            if (buffer.size() - at > MaxHeaderLength)
+                                return UPNP_E_BAD_HTTPMSG;
+                            if (int res = more())
+                                return res;
+                        }
+                        const bool last = lineEnd == at;
+                        at = lineEnd + 2;
+                        if (last)
+                            break;
+                    }
+                    break;
+                }
+
+                if (response.body.size() + size > maxLength)
+                    return UPNP_E_BAD_RESPONSE;
+                while (buffer.size() < at + size + 2)
+                {
+                    if (int res = more())
+                        return res;
+                }
+                if (buffer.compare(at + size, 2, "\r\n"))
+                    return UPNP_E_BAD_HTTPMSG;
+                response.body.append(buffer, at, size);
+                buffer.erase(0, at + size + 2);
+                at = 0;
+            }
+            keep = keep && at == buffer.size();
+        }
+        else if (contentLength != SIZE_MAX)
+        {
+            while (buffer.size() < contentLength)
+            {
+                if (int res = more())
+                    return res;
+            }
+            keep = keep && buffer.size() == contentLength;
+            buffer.resize(contentLength);
+            response.body = std::move(buffer);
+        }
+        else
+        {
+            /* The body ends with the connection */
+            keep = false;
+            for (;;)
+            {
+                size_t received = 0;
+                if (int res = Receive(socket, buffer, deadline, received))
+                    return res;
+                if (received == 0)
+                    break;
+                if (buffer.size() > maxLength)
+                    return UPNP_E_BAD_RESPONSE;
+            }
+            response.body = std::move(buffer);
+        }
+        return UPNP_E_SUCCESS;
+    }
+}
+
+HttpConnectionPool::HttpConnectionPool(unsigned int maxPerHost, std::chrono::seconds idleTimeout)
+    : maxPerHost(maxPerHost)
+    , idleTimeout(idleTimeout)
+{
+}
+
+HttpConnectionPool::~HttpConnectionPool()
+{
+    Clear();
+}
+
+int HttpConnectionPool::Request(std::string_view method, const std::string& url, std::string_view headers, std::string_view body,
+    std::chrono::milliseconds timeout, size_t maxLength, Response& response)
+{
+    URLView view;
+    char scratch[256];
+    if (!ParseUrlView(url, view, scratch) || !EqualsIgnoringCase(view.scheme, "http") || view.host.empty())
+        return UPNP_E_INVALID_URL;
+
+    const std::string host(view.host);
+    const unsigned int port = view.port ? view.port : 80;
+    const std::string key = host + ':' + std::to_string(port);
+
+    std::string request;
+    request.reserve(method.size() + url.size() + headers.size() + body.size() + 64);
+    request.append(method).push_back(' ');
+    if (view.path.empty())
+        request.push_back('/');
+    request.append(view.path);
+    if (view.hasQuery)
+        request.append("?").append(view.query);
+    request.append(" HTTP/1.1\r\nHOST: ");
+    if (host.find(':') != std::string::npos)
+        request.append("[").append(host).append("]");
+    else
+        request.append(host);
+    if (view.port)
+        request.append(":").append(std::to_string(view.port));
+    request.append("\r\n");
+    if (!body.empty() || method == "POST")
+        request.append("CONTENT-LENGTH: ").append(std::to_string(body.size())).append("\r\n");
+    request.append(headers).append("\r\n").append(body);
+
+    const Clock::time_point deadline = Clock::now() + timeout;
+    int res = UPNP_E_SOCKET_CONNECT;
+    for (int attempt = 0; attempt < 2; attempt++)
+    {
+        Connection connection{ static_cast<Socket>(InvalidSocket), {}, 0 };
+        bool reused = false;
+        res = Acquire(key, deadline, connection, reused);
+        if (res != UPNP_E_SUCCESS)
+            return res;
+        if (!reused)
+        {
+            ::Socket socket = InvalidSocket;
+            res = Connect(host, port, deadline, socket);
+            connection.socket = static_cast<Socket>(socket);
+            if (res != UPNP_E_SUCCESS)
+            {
+                Release(key, connection, false);
+                return res;
+            }
+        }
+
+        bool keep = false, answered = false;
+        const ::Socket socket = static_cast<::Socket>(connection.socket);
+        res = SendAll(socket, request, deadline);
+        if (res == UPNP_E_SUCCESS)
+            res = ReadResponse(socket, deadline, maxLength, response, keep, answered);
+        if (Release(key, connection, res == UPNP_E_SUCCESS && keep))
+            StartReaper();
+        if (res == UPNP_E_SUCCESS || !reused || answered || Clock::now() >= deadline)
+            return res;
+        Log(LogLevel::Debug, "Connection kept to %s was closed, sending again", key.c_str());
+    }
+    return res;
+}
+
+int HttpConnectionPool::Acquire(const std::string& host, Clock::time_point deadline, Connection& connection, bool& reused)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    for (;;)
+    {
+        CloseExpired(Clock::now(), &host);
+
+        Host& entry = hosts[host];
+        while (!entry.idle.empty())
+        {
+            const Connection kept = entry.idle.back();
+            entry.idle.pop_back();
+            if (!Readable(static_cast<::Socket>(kept.socket)))
+            {
+                connection = kept;
+                reused = true;
+                return UPNP_E_SUCCESS;
+            }
+            CloseSocket(static_cast<::Socket>(kept.socket));
+            entry.open--;
+        }
+        if (entry.open < maxPerHost)
+        {
+            entry.open++;
+            connection.generation = generation;
+            reused = false;
+            return UPNP_E_SUCCESS;
+        }
+        if (released.wait_until(lock, deadline) == std::cv_status::timeout)
+            return UPNP_E_TIMEDOUT;
+    }
+}
+
+bool HttpConnectionPool::Release(const std::string& host, const Connection& connection, bool keep)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    Host& entry = hosts[host];
+    keep = keep && connection.generation == generation;
+    if (keep)
+        entry.idle.push_back({ connection.socket, Clock::now(), generation });
+    else
+    {
+        if (static_cast<::Socket>(connection.socket) != InvalidSocket)
+            CloseSocket(static_cast<::Socket>(connection.socket));
+        entry.open--;
+    }
+    released.notify_all();
+    return keep;
+}
+
+void HttpConnectionPool::CloseExpired(Clock::time_point now, const std::string* host)
+{
+    for (auto entry = hosts.begin(); entry != hosts.end();)
+    {
+        std::vector<Connection>& idle = entry->second.idle;
+        auto fresh = std::find_if(idle.begin(), idle.end(), [&](const Connection& kept) { return now - kept.idleSince < idleTimeout; });
+        for (auto expired = idle.begin(); expired != fresh; ++expired)
+            CloseSocket(static_cast<::Socket>(expired->socket));
+        entry->second.open -= static_cast<unsigned int>(fresh - idle.begin());
+        idle.erase(idle.begin(), fresh);
+        entry = entry->second.open || (host && entry->first == *host) ? std::next(entry) : hosts.erase(entry);
+    }
+}
+
+void HttpConnectionPool::StartReaper()
+{
+    std::lock_guard<std::mutex> lock(reaperMutex);
+    if (reaper.joinable())
+        return;
+    {
+        std::lock_guard<std::mutex> poolLock(mutex);
+        stopping = false;
+    }
+    reaper = std::thread(&HttpConnectionPool::Reap, this);
+}
+
+void HttpConnectionPool::Reap()
+{
+    /* Servers no longer asked anything don't get a request to sweep their sockets, this does */
+    std::unique_lock<std::mutex> lock(mutex);
+    while (!wakeup.wait_for(lock, idleTimeout / 2, [this] { return stopping; }))
+        CloseExpired(Clock::now(), nullptr);
+}
+
+void HttpConnectionPool::Clear()
+{
+    std::lock_guard<std::mutex> reaperLock(reaperMutex);
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        generation++;
+        stopping = true;
+        for (auto& [host, entry] : hosts)
+        {
+            for (const Connection& kept : entry.idle)
+                CloseSocket(static_cast<::Socket>(kept.socket));
+            entry.open -= static_cast<unsigned int>(entry.idle.size());
+            entry.idle.clear();
+        }
+        released.notify_all();
+    }
+    wakeup.notify_all();
+    if (reaper.joinable())
+        reaper.join();
+}
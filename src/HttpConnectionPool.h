@@ -0,0 +1,83 @@
+#pragma once
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+/*
+ * Persistent HTTP/1.1 connections for the SOAP actions and description downloads the
+ * module sends, pupnp's client closes its connection after every request.
+ *
+ * A connection whose response was read whole is kept per host and port and reused by
+ * the next request there, the most recently used first. No more than maxPerHost
+ * connections to a host are open at once, requests beyond that wait for one to be
+ * released. Idle connections are closed after idleTimeout, give or take half of it, by a
+ * thread started when the first one is kept and stopped by Clear. A request sent on a kept
+ * connection the server closed meanwhile is sent again, once, on a new one: the module
+ * only sends requests that can be repeated. Only http URLs are handled.
+ */
+class HttpConnectionPool
+{
+public:
+    struct Response
+    {
+        int status = 0;
+        std::string body;
+    };
+
+    HttpConnectionPool(unsigned int maxPerHost, std::chrono::seconds idleTimeout);
+    ~HttpConnectionPool();
+
+    // headers are complete lines, CRLF included. Returns UPNP_E_SUCCESS whatever the HTTP status, or a UPNP_E_* error.
+    int Request(std::string_view method, const std::string& url, std::string_view headers, std::string_view body,
+        std::chrono::milliseconds timeout, size_t maxLength, Response& response);
+    // Closes the idle connections and stops closing expired ones, the ones in use are closed when released.
+    void Clear();
+
+private:
+#if _WIN32
+    using Socket = uintptr_t; // SOCKET
+#else
+    using Socket = int;
+#endif
+    using Clock = std::chrono::steady_clock;
+
+    struct Connection
+    {
+        Socket socket;
+        Clock::time_point idleSince;
+        uint64_t generation;
+    };
+
+    struct Host
+    {
+        std::vector<Connection> idle; // Oldest first
+        unsigned int open = 0;        // Idle and in use
+    };
+
+    int Acquire(const std::string& host, Clock::time_point deadline, Connection& connection, bool& reused);
+    // Returns true when the connection was kept.
+    bool Release(const std::string& host, const Connection& connection, bool keep);
+    // Called with mutex held, the entry of host is kept even when it has no connection left.
+    void CloseExpired(Clock::time_point now, const std::string* host);
+    void StartReaper();
+    void Reap();
+
+    const unsigned int maxPerHost;
+    const std::chrono::seconds idleTimeout;
+
+    std::mutex mutex;
+    std::condition_variable released;
+    std::map<std::string, Host> hosts; // By "host:port"
+    uint64_t generation = 0;           // Bumped by Clear, connections opened before are not kept
+    bool stopping = false;             // Tells the reaper to return
+    std::condition_variable wakeup;    // Of the reaper
+
+    std::mutex reaperMutex; // Starting and joining the reaper, never taken with mutex held
+    std::thread reaper;
+};
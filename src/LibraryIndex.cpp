@@ -0,0 +1,256 @@
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <system_error>
+
+#include "LibraryIndex.h"
+#include "logger.h"
+
+/* After upnp.h, which wants winsock2.h before windows.h */
+#if _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+    /* Columns are stored in ItemFields order, changing it needs a new FileVersion */
+    constexpr char Magic[8] = { 'D', 'L', 'N', 'A', 'I', 'D', 'X', '\0' };
+    constexpr uint32_t FileVersion = 1;
+    constexpr size_t PoolBlockSize = 1024 * 1024;
+}
+
+LibraryIndex::~LibraryIndex()
+{
+    if (!mapping)
+        return;
+#if _WIN32
+    UnmapViewOfFile(mapping);
+#else
+    munmap(mapping, mappingSize);
+#endif
+}
+
+std::shared_ptr<const LibraryIndex> LibraryIndex::Open(const std::filesystem::path& path)
+{
+    std::shared_ptr<LibraryIndex> index(new LibraryIndex());
+#if _WIN32
+    HANDLE file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+        return nullptr;
+    LARGE_INTEGER fileSize;
+    HANDLE fileMapping = nullptr;
+    if (GetFileSizeEx(file, &fileSize) && fileSize.QuadPart >= static_cast<LONGLONG>(sizeof(Header)))
+        fileMapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (fileMapping)
+    {
+        /* The view keeps the file mapped once both handles are closed */
+        index->mapping = MapViewOfFile(fileMapping, FILE_MAP_READ, 0, 0, 0);
+        index->mappingSize = static_cast<size_t>(fileSize.QuadPart);
+        CloseHandle(fileMapping);
+    }
+    CloseHandle(file);
+#else
+    int file = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (file < 0)
+        return nullptr;
+    struct stat status;
+    if (fstat(file, &status) == 0 && status.st_size >= static_cast<off_t>(sizeof(Header)))
+    {
+        void* mapping = mmap(nullptr, status.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+        if (mapping != MAP_FAILED)
+        {
+            index->mapping = mapping;
+            index->mappingSize = static_cast<size_t>(status.st_size);
+        }
+    }
+    close(file);
+#endif
+    if (!index->mapping || !index->Validate(index->mappingSize))
+    {
+        Log(LogLevel::Warning, "Library index %s is unusable", path.string().c_str());
+        return nullptr;
+    }
+    return index;
+}
+
+/* Every reference is checked once here, so lookups never have to */
+bool LibraryIndex::Validate(size_t fileSize)
+{
+    const char* base = static_cast<const char*>(mapping);
+    header = reinterpret_cast<const Header*>(base);
+    if (memcmp(header->magic, Magic, sizeof(Magic)) || header->version != FileVersion || header->fieldCount != ItemFieldCount)
+        return false;
+
+    const uint64_t itemCount = header->itemCount;
+    const uint64_t containersAt = sizeof(Header);
+    const uint64_t columnsAt = containersAt + header->containerCount * uint64_t(sizeof(Container));
+    const uint64_t typesAt = columnsAt + ItemFieldCount * itemCount * sizeof(StringRef);
+    const uint64_t poolAt = typesAt + itemCount;
+    if (header->poolSize > UINT32_MAX || poolAt + header->poolSize != fileSize)
+        return false;
+
+    containers = reinterpret_cast<const Container*>(base + containersAt);
+    columns = reinterpret_cast<const StringRef*>(base + columnsAt);
+    types = reinterpret_cast<const uint8_t*>(base + typesAt);
+    pool = base + poolAt;
+
+    auto valid = [this](StringRef ref) { return uint64_t(ref.offset) + ref.length <= header->poolSize; };
+    for (size_t i = 0; i < ItemFieldCount * itemCount; i++)
+    {
+        if (!valid(columns[i]))
+            return false;
+    }
+    for (size_t i = 0; i < itemCount; i++)
+    {
+        if (types[i] > MediaType::CONTAINER)
+            return false;
+    }
+    for (size_t i = 0; i < header->containerCount; i++)
+    {
+        const Container& container = containers[i];
+        if (!valid(container.objectID) || uint64_t(container.firstItem) + container.itemCount > itemCount)
+            return false;
+        if (i && ContainerID(containers[i - 1]) >= ContainerID(container))
+            return false;
+    }
+    return true;
+}
+
+std::string_view LibraryIndex::TitleAt(size_t item) const
+{
+    return String(columns[TitleField * header->itemCount + item]);
+}
+
+ItemView LibraryIndex::ItemAt(size_t item) const
+{
+    ItemView view;
+    view.media_type = TypeAt(item);
+    for (size_t field = 0; field < ItemFieldCount; field++)
+        view.*ItemFields[field] = String(columns[field * header->itemCount + item]);
+    return view;
+}
+
+const LibraryIndex::Container* LibraryIndex::FindContainer(std::string_view objectID) const
+{
+    const Container* end = containers + header->containerCount;
+    const Container* found = std::lower_bound(containers, end, objectID, [this](const Container& container, std::string_view id)
+        {
+            return ContainerID(container) < id;
+        });
+    return found != end && ContainerID(*found) == objectID ? found : nullptr;
+}
+
+LibraryIndex::StringRef LibraryIndexWriter::Intern(std::string_view text, std::string_view* stored)
+{
+    if (text.empty())
+        return { 0, 0 };
+    auto known = interned.find(text);
+    if (known != interned.end())
+    {
+        if (stored)
+            *stored = known->first;
+        return known->second;
+    }
+
+    if (poolSize + text.size() > UINT32_MAX)
+    {
+        overflow = true;
+        return { 0, 0 };
+    }
+    if (blocks.empty() || blocks.back().capacity() - blocks.back().size() < text.size())
+    {
+        blocks.emplace_back();
+        blocks.back().reserve(std::max(PoolBlockSize, text.size()));
+    }
+    std::string& block = blocks.back();
+    const std::string_view copy(block.data() + block.size(), text.size());
+    block.append(text);
+    if (stored)
+        *stored = copy;
+
+    LibraryIndex::StringRef ref{ static_cast<uint32_t>(poolSize), static_cast<uint32_t>(text.size()) };
+    poolSize += text.size();
+    interned.emplace(copy, ref);
+    return ref;
+}
+
+bool LibraryIndexWriter::AddContainer(std::string_view objectID, uint32_t updateID, const std::vector<ItemView>& items)
+{
+    if (columns.empty())
+        columns.resize(ItemFieldCount);
+    if (overflow || types.size() + items.size() > UINT32_MAX)
+        return false;
+
+    /* The table is sorted on the interned copy, the caller's buffer may be gone by then */
+    std::string_view storedID;
+    LibraryIndex::StringRef id = Intern(objectID, &storedID);
+    containers.push_back({ storedID, { id, updateID, static_cast<uint32_t>(types.size()), static_cast<uint32_t>(items.size()) } });
+    for (const ItemView& item : items)
+    {
+        for (size_t field = 0; field < ItemFieldCount; field++)
+            columns[field].push_back(Intern(item.*ItemFields[field]));
+        types.push_back(static_cast<uint8_t>(item.media_type));
+    }
+    return !overflow;
+}
+
+bool LibraryIndexWriter::Write(const std::filesystem::path& path, uint64_t systemUpdateID)
+{
+    if (overflow)
+        return false;
+    if (columns.empty())
+        columns.resize(ItemFieldCount);
+
+    std::sort(containers.begin(), containers.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+    for (size_t i = 1; i < containers.size(); i++)
+    {
+        if (containers[i - 1].first == containers[i].first)
+            return false;
+    }
+
+    LibraryIndex::Header header{};
+    memcpy(header.magic, Magic, sizeof(Magic));
+    header.version = FileVersion;
+    header.fieldCount = ItemFieldCount;
+    header.itemCount = static_cast<uint32_t>(types.size());
+    header.containerCount = static_cast<uint32_t>(containers.size());
+    header.systemUpdateID = systemUpdateID;
+    header.poolSize = poolSize;
+
+    std::filesystem::path temporary = path;
+    temporary += ".tmp";
+    {
+        std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        for (const auto& [id, container] : containers)
+            file.write(reinterpret_cast<const char*>(&container), sizeof(container));
+        for (const std::vector<LibraryIndex::StringRef>& column : columns)
+            file.write(reinterpret_cast<const char*>(column.data()), column.size() * sizeof(LibraryIndex::StringRef));
+        file.write(reinterpret_cast<const char*>(types.data()), types.size());
+        for (const std::string& block : blocks)
+            file.write(block.data(), block.size());
+        if (!file.flush())
+        {
+            Log(LogLevel::Warning, "Writing library index %s failed", temporary.string().c_str());
+            file.close();
+            std::error_code error;
+            std::filesystem::remove(temporary, error);
+            return false;
+        }
+    }
+
+    std::error_code error;
+    std::filesystem::rename(temporary, path, error);
+    if (error)
+    {
+        Log(LogLevel::Warning, "Renaming library index to %s failed: %s", path.string().c_str(), error.message().c_str());
+        std::filesystem::remove(temporary, error);
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,108 @@
+#pragma once
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "UpnpCommand.h"
+
+/*
+ * Every object of one MediaServer, in a file mapped read only.
+ *
+ * The file holds a header, the container table sorted by object ID, one column per
+ * item field (offset and length into the string pool, indexed by item), a column of
+ * media types and the string pool. Strings are interned, a title, album or artist
+ * shared by many items is stored once. The items listed by a container are stored
+ * next to each other, so a container crawled again replaces a single range.
+ *
+ * An index is immutable once opened: refreshing a server writes a new file, readers
+ * keep the mapping they hold. Files are never replaced in place, Windows refuses to
+ * rename over a mapped file.
+ */
+class LibraryIndex
+{
+public:
+    struct StringRef
+    {
+        uint32_t offset;
+        uint32_t length;
+    };
+
+    struct Container
+    {
+        StringRef objectID;
+        uint32_t updateID;  // Last ContainerUpdateIDs value seen for it, 0 when unknown
+        uint32_t firstItem;
+        uint32_t itemCount;
+    };
+
+    ~LibraryIndex();
+
+    // Returns nullptr when the file is missing, truncated or written by another version.
+    static std::shared_ptr<const LibraryIndex> Open(const std::filesystem::path& path);
+
+    uint64_t SystemUpdateID() const { return header->systemUpdateID; }
+    size_t ItemCount() const { return header->itemCount; }
+    size_t ContainerCount() const { return header->containerCount; }
+
+    MediaType::MEDIA_TYPE TypeAt(size_t item) const { return static_cast<MediaType::MEDIA_TYPE>(types[item]); }
+    std::string_view TitleAt(size_t item) const;
+    ItemView ItemAt(size_t item) const;
+
+    const Container& ContainerAt(size_t container) const { return containers[container]; }
+    std::string_view ContainerID(const Container& container) const { return String(container.objectID); }
+    const Container* FindContainer(std::string_view objectID) const;
+
+private:
+    struct Header
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t fieldCount;
+        uint32_t itemCount;
+        uint32_t containerCount;
+        uint64_t systemUpdateID;
+        uint64_t poolSize;
+    };
+
+    LibraryIndex() = default;
+    std::string_view String(StringRef ref) const { return std::string_view(pool + ref.offset, ref.length); }
+    bool Validate(size_t fileSize);
+
+    void* mapping = nullptr;
+    size_t mappingSize = 0;
+    const Header* header = nullptr;
+    const Container* containers = nullptr;
+    const StringRef* columns = nullptr; // ItemFieldCount columns of itemCount references
+    const uint8_t* types = nullptr;
+    const char* pool = nullptr;
+
+    friend class LibraryIndexWriter;
+};
+
+/* Builds the file of a LibraryIndex, strings are copied as containers are added */
+class LibraryIndexWriter
+{
+public:
+    // Returns false once the index outgrew the 32 bit offsets of the file.
+    bool AddContainer(std::string_view objectID, uint32_t updateID, const std::vector<ItemView>& items);
+    // Written to a temporary file first, then renamed over path.
+    bool Write(const std::filesystem::path& path, uint64_t systemUpdateID);
+
+    size_t ItemCount() const { return types.size(); }
+
+private:
+    LibraryIndex::StringRef Intern(std::string_view text, std::string_view* stored = nullptr);
+
+    std::vector<std::string> blocks; // String pool, a block is never reallocated so interned views stay valid
+    uint64_t poolSize = 0;
+    std::unordered_map<std::string_view, LibraryIndex::StringRef> interned;
+    std::vector<std::pair<std::string_view, LibraryIndex::Container>> containers;
+    std::vector<std::vector<LibraryIndex::StringRef>> columns;
+    std::vector<uint8_t> types;
+    bool overflow = false;
+};
@@ -0,0 +1,532 @@
+#include <algorithm>
+#include <deque>
+#include <system_error>
+#include <unordered_set>
+
+#include "rapidjson/document.h"
+#include "rapidjson/stringbuffer.h"
+#include "rapidjson/writer.h"
+
+#include "ixml.h"
+
+#include "LibraryIndexer.h"
+#include "URLHandler.h"
+#include "logger.h"
+
+#if _WIN32
+#include <windows.h>
+#elif __linux__ || __ANDROID__
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+    const unsigned int PAGE_SIZE = 200;
+    const size_t MAX_ITEMS_PER_SERVER = 1000000;
+
+    void LowerThreadPriority()
+    {
+#if _WIN32
+        SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_BELOW_NORMAL);
+#elif __linux__ || __ANDROID__
+        /* Niceness is per thread on Linux */
+        setpriority(PRIO_PROCESS, static_cast<id_t>(syscall(SYS_gettid)), 10);
+#endif
+    }
+
+    /* UDNs are "uuid:..." but nothing stops a server from putting a path in there */
+    std::string FileStem(std::string_view udn)
+    {
+        std::string stem;
+        for (char c : udn)
+            stem += (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '-' ? c : '_';
+        return stem;
+    }
+}
+
+struct LibraryIndexer::Crawled
+{
+    uint32_t updateID = 0;
+    std::vector<BrowseResult> pages;
+    std::vector<ItemView> items; // Point into pages
+};
+
+LibraryIndexer::~LibraryIndexer()
+{
+    Stop();
+}
+
+void LibraryIndexer::Enable(const std::filesystem::path& newDirectory)
+{
+    Stop();
+    if (newDirectory.empty())
+        return;
+
+    std::error_code error;
+    std::filesystem::create_directories(newDirectory, error);
+    if (error)
+    {
+        Log(LogLevel::Error, "Library index directory %s can't be created: %s", newDirectory.string().c_str(), error.message().c_str());
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    directory = newDirectory;
+    workers.Start();
+    Log(LogLevel::Info, "Library indexing in %s", directory.string().c_str());
+    for (auto& [udn, server] : servers)
+    {
+        Load(*server);
+        Schedule(server);
+    }
+}
+
+void LibraryIndexer::Stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (directory.empty())
+            return;
+        directory.clear();
+        for (auto& [udn, server] : servers)
+            server->cancelled = true;
+    }
+    /* Running crawls notice the cancellation after their current request */
+    workers.Stop();
+
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto& [udn, server] : servers)
+    {
+        server->index.reset();
+        server->path.clear();
+        server->generation = 0;
+        server->changed.clear();
+        server->wholeTree = false;
+        server->verified = false;
+        server->crawling = false;
+        server->cancelled = false;
+    }
+}
+
+void LibraryIndexer::Track(const DeviceRegistry::Device& device)
+{
+    if (!device || device->location.empty())
+        return;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    std::shared_ptr<Server>& server = servers[device->UDN];
+    const bool added = !server;
+    if (added)
+        server = std::make_shared<Server>();
+    server->device = device;
+    server->host = WorkerHostKey(device->location, device->UDN);
+    if (directory.empty())
+        return;
+    if (added)
+        Load(*server);
+    Schedule(server);
+}
+
+void LibraryIndexer::Untrack(const std::string& udn)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = servers.find(udn);
+    if (it == servers.end())
+        return;
+    it->second->cancelled = true;
+    servers.erase(it);
+}
+
+void LibraryIndexer::OnContentChanged(const std::string& udn, std::optional<uint64_t> systemUpdateID, const std::vector<std::pair<std::string, uint32_t>>& containers)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = servers.find(udn);
+    if (directory.empty() || it == servers.end())
+        return;
+
+    Server& server = *it->second;
+    /* The first event of a subscription repeats the current values */
+    if (systemUpdateID && server.index && server.index->SystemUpdateID() == *systemUpdateID)
+        return;
+    if (containers.empty())
+        server.wholeTree = true;
+    for (const auto& [objectID, updateID] : containers)
+    {
+        const LibraryIndex::Container* known = server.index ? server.index->FindContainer(objectID) : nullptr;
+        if (!known || known->updateID != updateID)
+            server.changed[objectID] = updateID;
+    }
+    Schedule(it->second);
+}
+
+/* Called with mutex held, picks the newest file of the server and removes the older ones */
+void LibraryIndexer::Load(Server& server)
+{
+    const std::string prefix = FileStem(server.device->UDN) + '.';
+    std::vector<std::pair<uint64_t, std::filesystem::path>> files;
+    std::error_code error;
+    for (const auto& entry : std::filesystem::directory_iterator(directory, error))
+    {
+        const std::string name = entry.path().filename().string();
+        if (!name.starts_with(prefix))
+            continue;
+        if (name.ends_with(".idx"))
+            files.emplace_back(strtoull(name.c_str() + prefix.size(), nullptr, 10), entry.path());
+        else if (name.ends_with(".idx.tmp"))
+            std::filesystem::remove(entry.path(), error);
+    }
+    std::sort(files.begin(), files.end());
+
+    while (!files.empty() && !server.index)
+    {
+        server.index = LibraryIndex::Open(files.back().second);
+        if (server.index)
+        {
+            server.path = files.back().second;
+            server.generation = files.back().first;
+        }
+        else
+            std::filesystem::remove(files.back().second, error);
+        files.pop_back();
+    }
+    for (const auto& [generation, path] : files)
+        std::filesystem::remove(path, error);
+}
+
+/* Called with mutex held */
+void LibraryIndexer::Schedule(const std::shared_ptr<Server>& server)
+{
+    if (directory.empty() || server->crawling || server->cancelled)
+        return;
+    if (server->verified && !server->wholeTree && server->changed.empty())
+        return;
+    if (workers.Submit("index/" + server->device->UDN, server->host, [this, server] { Refresh(server); }))
+        server->crawling = true;
+    else
+        Log(LogLevel::Warning, "Library index of %s can't be refreshed, the queue is full", server->device->friendlyName.c_str());
+}
+
+void LibraryIndexer::Refresh(const std::shared_ptr<Server>& server)
+{
+    LowerThreadPriority();
+
+    DeviceRegistry::Device device;
+    std::shared_ptr<const LibraryIndex> previous;
+    std::map<std::string, uint32_t> changed;
+    bool wholeTree;
+    bool verified;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        device = server->device;
+        previous = server->index;
+        changed.swap(server->changed);
+        wholeTree = std::exchange(server->wholeTree, false);
+        verified = server->verified;
+    }
+
+    /* Changes made while nobody listened can only be found by looking at everything */
+    IXML_Document* response;
+    uint64_t systemUpdateID = 0;
+    int res = SendContentDirectoryAction(device->location, "GetSystemUpdateID", {}, &response);
+    if (res == UPNP_E_SUCCESS)
+    {
+        const char* id = ixmlElement_getFirstChildElementValue((IXML_Element*)response, "Id");
+        systemUpdateID = id ? strtoull(id, nullptr, 10) : 0;
+        ixmlDocument_free(response);
+    }
+    if (!verified && (res != UPNP_E_SUCCESS || !previous || previous->SystemUpdateID() != systemUpdateID))
+        wholeTree = true;
+    if (wholeTree)
+        previous.reset();
+
+    bool done = true;
+    if (wholeTree || !changed.empty())
+        done = Crawl(*server, *device, previous.get(), changed, systemUpdateID);
+    else
+        Log(LogLevel::Debug, "Library index of %s is up to date", device->friendlyName.c_str());
+
+    std::lock_guard<std::mutex> lock(mutex);
+    server->crawling = false;
+    if (server->cancelled)
+        return;
+    if (!done)
+    {
+        /* Left for the next event or advertisement, retrying now would only fail again */
+        server->wholeTree |= wholeTree;
+        server->changed.merge(changed);
+        return;
+    }
+    server->verified = true;
+    Schedule(server);
+}
+
+/* Browses the changed containers, or the whole tree without previous, then writes the next index */
+bool LibraryIndexer::Crawl(Server& server, const UpnpDevice& device, const LibraryIndex* previous, const std::map<std::string, uint32_t>& changed, uint64_t systemUpdateID)
+{
+    std::map<std::string, Crawled, std::less<>> crawled;
+    std::deque<std::string> pending;
+    if (!previous)
+        pending.push_back("0");
+    for (const auto& [objectID, updateID] : changed)
+    {
+        if (previous && previous->FindContainer(objectID))
+            pending.push_back(objectID);
+    }
+
+    size_t itemCount = 0;
+    while (!pending.empty() && itemCount < MAX_ITEMS_PER_SERVER)
+    {
+        if (server.cancelled)
+            return false;
+        std::string objectID = std::move(pending.front());
+        pending.pop_front();
+        auto [it, added] = crawled.try_emplace(objectID);
+        if (!added)
+            continue;
+
+        auto update = changed.find(objectID);
+        it->second.updateID = update != changed.end() ? update->second : 0;
+        int res = BrowseChildren(server, device, objectID, it->second);
+        if (res != UPNP_E_SUCCESS)
+        {
+            Log(LogLevel::Warning, "Indexing %s of %s failed: %d", objectID.c_str(), device.friendlyName.c_str(), res);
+            if (!previous && objectID == "0")
+                return false;
+            /* The previous content stays, or the container is left out */
+            crawled.erase(it);
+            continue;
+        }
+
+        itemCount += it->second.items.size();
+        for (const ItemView& child : it->second.items)
+        {
+            if (child.media_type == MediaType::CONTAINER && (!previous || !previous->FindContainer(child.objectID)))
+                pending.emplace_back(child.objectID);
+        }
+    }
+    if (server.cancelled)
+        return false;
+    if (!pending.empty())
+        Log(LogLevel::Warning, "%s holds more than %u objects, the index stops there", device.friendlyName.c_str(), MAX_ITEMS_PER_SERVER);
+
+    /* Whatever the root still reaches, browsed now or copied from the previous index */
+    LibraryIndexWriter writer;
+    std::vector<std::string_view> reachable{ "0" };
+    std::unordered_set<std::string_view> visited;
+    std::vector<ItemView> copied;
+    while (!reachable.empty())
+    {
+        std::string_view objectID = reachable.back();
+        reachable.pop_back();
+        if (!visited.insert(objectID).second)
+            continue;
+
+        const std::vector<ItemView>* items;
+        uint32_t updateID;
+        auto found = crawled.find(objectID);
+        if (found != crawled.end())
+        {
+            items = &found->second.items;
+            updateID = found->second.updateID;
+        }
+        else if (const LibraryIndex::Container* container = previous ? previous->FindContainer(objectID) : nullptr)
+        {
+            copied.clear();
+            for (uint32_t i = 0; i < container->itemCount; i++)
+                copied.push_back(previous->ItemAt(container->firstItem + i));
+            items = &copied;
+            updateID = container->updateID;
+        }
+        else
+            continue;
+
+        if (!writer.AddContainer(objectID, updateID, *items))
+        {
+            Log(LogLevel::Warning, "Library index of %s is too large", device.friendlyName.c_str());
+            return false;
+        }
+        for (auto child = items->rbegin(); child != items->rend(); ++child)
+        {
+            if (child->media_type == MediaType::CONTAINER)
+                reachable.push_back(child->objectID);
+        }
+    }
+
+    std::filesystem::path path;
+    uint64_t generation;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (directory.empty())
+            return false;
+        generation = server.generation + 1;
+        path = directory / (FileStem(device.UDN) + '.' + std::to_string(generation) + ".idx");
+    }
+    std::shared_ptr<const LibraryIndex> index = writer.Write(path, systemUpdateID) ? LibraryIndex::Open(path) : nullptr;
+    if (!index)
+        return false;
+
+    std::filesystem::path old;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        old = std::exchange(server.path, path);
+        server.generation = generation;
+        server.index = index;
+    }
+    /* Fails on Windows while a query still maps it, the next Load removes it then */
+    std::error_code error;
+    if (!old.empty())
+        std::filesystem::remove(old, error);
+
+    Log(LogLevel::Info, "Library of %s indexed: %u objects in %u containers, %u browsed", device.friendlyName.c_str(),
+        index->ItemCount(), index->ContainerCount(), crawled.size());
+    return true;
+}
+
+int LibraryIndexer::BrowseChildren(Server& server, const UpnpDevice& device, const std::string& objectID, Crawled& crawled)
+{
+    const std::string requestedCount = std::to_string(PAGE_SIZE);
+    for (unsigned int start = 0; crawled.items.size() < MAX_ITEMS_PER_SERVER && !server.cancelled;)
+    {
+        const std::string startingIndex = std::to_string(start);
+        IXML_Document* response;
+        int res = SendContentDirectoryAction(device.location, "Browse", { { "ObjectID", objectID.c_str() }, { "BrowseFlag", "BrowseDirectChildren" },
+            { "Filter", "*" }, { "StartingIndex", startingIndex.c_str() }, { "RequestedCount", requestedCount.c_str() }, { "SortCriteria", "" } }, &response);
+        if (res != UPNP_E_SUCCESS)
+            return res;
+
+        const char* numberReturned = ixmlElement_getFirstChildElementValue((IXML_Element*)response, "NumberReturned");
+        const char* totalMatches = ixmlElement_getFirstChildElementValue((IXML_Element*)response, "TotalMatches");
+        const unsigned int returned = numberReturned ? strtoul(numberReturned, nullptr, 10) : 0;
+        const unsigned int total = totalMatches ? strtoul(totalMatches, nullptr, 10) : 0;
+        std::variant<BrowseResult, int> parsed = Resolve2(response);
+        ixmlDocument_free(response);
+        if (const int* error = std::get_if<int>(&parsed))
+            return *error;
+
+        /* Items point into the text of the result, moving it keeps them valid */
+        const BrowseResult& page = crawled.pages.emplace_back(std::move(std::get<BrowseResult>(parsed)));
+        for (size_t i = 0; i < page.size(); i++)
+            crawled.items.push_back(page[i]);
+
+        if (IsLastPage(start, returned, total, PAGE_SIZE))
+            break;
+        start += returned;
+    }
+    return UPNP_E_SUCCESS;
+}
+
+bool LibraryIndexer::Query(const char* json, BrowseDLNAFolderCallback callback)
+{
+    if (!json || !callback)
+        return false;
+
+    rapidjson::Document request, arguments;
+    request.Parse(json);
+    if (request.HasParseError() || !request.IsObject() || !request.HasMember("version") || !request["version"].IsString()
+        || !request.HasMember("arguments") || !request["arguments"].IsString())
+    {
+        Log(LogLevel::Error, "Broken library request");
+        return false;
+    }
+    arguments.Parse(request["arguments"].GetString());
+    if (arguments.HasParseError() || !arguments.IsObject())
+    {
+        Log(LogLevel::Error, "Broken arguments in library request");
+        return false;
+    }
+
+    auto text = [&arguments](const char* name) -> std::string_view
+    {
+        return arguments.HasMember(name) && arguments[name].IsString()
+            ? std::string_view(arguments[name].GetString(), arguments[name].GetStringLength()) : std::string_view();
+    };
+    auto number = [&arguments](const char* name, unsigned int fallback)
+    {
+        return arguments.HasMember(name) && arguments[name].IsUint() ? arguments[name].GetUint() : fallback;
+    };
+
+    /* "video", "audio", "image", "container", anything else for every media item */
+    const std::string_view type = text("type");
+    const int wanted = type == "video" ? MediaType::VIDEO : type == "audio" ? MediaType::AUDIO : type == "image" ? MediaType::IMAGE
+        : type == "container" ? MediaType::CONTAINER : -1;
+    const std::string_view udn = text("uuid");
+    std::string loweredQuery;
+    for (char c : text("query"))
+        loweredQuery += c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c;
+    const unsigned int start = number("start", 0);
+    const unsigned int count = number("count", 1000);
+
+    std::vector<std::shared_ptr<const LibraryIndex>> indexes;
+    bool indexing = false;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (directory.empty())
+        {
+            Log(LogLevel::Warning, "Library request while indexing is off");
+            return false;
+        }
+        for (const auto& [serverUDN, server] : servers)
+        {
+            if (!udn.empty() && serverUDN != udn)
+                continue;
+            indexing |= server->crawling || !server->verified;
+            if (server->index)
+                indexes.push_back(server->index);
+        }
+    }
+
+    /* Servers list the same media under several containers ("All videos", "Folders"...), a resource is listed once */
+    rapidjson::StringBuffer buffer;
+    rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
+    writer.StartObject();
+    writer.Key("version");
+    writer.String(request["version"].GetString());
+    writer.Key("method");
+    writer.String("DLNALibraryResponse");
+    writer.Key("request_body");
+    request.Accept(writer);
+    writer.Key("results");
+    writer.StartArray();
+
+    std::unordered_set<std::string_view> urls;
+    unsigned int matches = 0;
+    unsigned int returned = 0;
+    for (const std::shared_ptr<const LibraryIndex>& index : indexes)
+    {
+        for (size_t i = 0; i < index->ItemCount(); i++)
+        {
+            const MediaType::MEDIA_TYPE itemType = index->TypeAt(i);
+            if (wanted < 0 ? itemType == MediaType::CONTAINER : itemType != wanted)
+                continue;
+            if (!loweredQuery.empty() && !ContainsIgnoringCase(index->TitleAt(i), loweredQuery))
+                continue;
+
+            const ItemView item = index->ItemAt(i);
+            if (!item.url.empty() && !urls.insert(item.url).second)
+                continue;
+            if (matches++ >= start && returned < count)
+            {
+                WriteItem(writer, item);
+                returned++;
+            }
+        }
+    }
+
+    writer.EndArray();
+    writer.Key("startingIndex");
+    writer.Uint(start);
+    writer.Key("numberReturned");
+    writer.Uint(returned);
+    writer.Key("totalMatches");
+    writer.Uint(matches);
+    writer.Key("indexing");
+    writer.Bool(indexing);
+    writer.Key("status");
+    writer.Int(0);
+    writer.EndObject();
+
+    callback(buffer.GetString());
+    return true;
+}
@@ -0,0 +1,75 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <filesystem>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "DeviceRegistry.h"
+#include "LibraryIndex.h"
+#include "UpnpCommand.h"
+#include "WorkerPool.h"
+
+/*
+ * Background crawl of every MediaServer into a LibraryIndex per server, off by default.
+ *
+ * Crawls run on their own two threads at a lower OS priority, one request at a time per
+ * server. A server is crawled whole when it has no index yet or its SystemUpdateID moved
+ * while nobody was listening. Afterwards ContainerUpdateIDs events only send the
+ * containers they name, with their new update ID, to be browsed again; containers they
+ * list that disappeared are dropped with everything below them. Servers evented without
+ * ContainerUpdateIDs are crawled whole on every SystemUpdateID change.
+ *
+ * Queries read the mapped indexes and never touch the network.
+ */
+class LibraryIndexer
+{
+public:
+    ~LibraryIndexer();
+
+    // An empty directory stops crawling and forgets the indexes, files are kept.
+    void Enable(const std::filesystem::path& directory);
+    void Stop();
+
+    void Track(const DeviceRegistry::Device& device);
+    void Untrack(const std::string& udn);
+    // A ContentDirectory event, containers are the (object ID, update ID) pairs of ContainerUpdateIDs.
+    void OnContentChanged(const std::string& udn, std::optional<uint64_t> systemUpdateID, const std::vector<std::pair<std::string, uint32_t>>& containers);
+
+    // Answers a DLNALibraryRequest before returning, false when the request is broken or indexing is off.
+    bool Query(const char* json, BrowseDLNAFolderCallback callback);
+
+private:
+    struct Server
+    {
+        DeviceRegistry::Device device;
+        std::string host;
+        std::filesystem::path path;                 // Current index file, empty when there is none
+        uint64_t generation = 0;                    // Of the current file, the next one is written as generation + 1
+        std::shared_ptr<const LibraryIndex> index;
+        std::map<std::string, uint32_t> changed;    // Containers to browse again, with their new update ID
+        bool wholeTree = false;                     // Changes events can't locate
+        bool verified = false;                      // SystemUpdateID compared with the index since tracked
+        bool crawling = false;
+        std::atomic<bool> cancelled{ false };
+    };
+
+    struct Crawled;
+
+    void Load(Server& server);
+    void Schedule(const std::shared_ptr<Server>& server);
+    void Refresh(const std::shared_ptr<Server>& server);
+    bool Crawl(Server& server, const UpnpDevice& device, const LibraryIndex* previous, const std::map<std::string, uint32_t>& changed, uint64_t systemUpdateID);
+    int BrowseChildren(Server& server, const UpnpDevice& device, const std::string& objectID, Crawled& crawled);
+
+    std::mutex mutex;
+    std::filesystem::path directory;
+    std::map<std::string, std::shared_ptr<Server>, std::less<>> servers; // By UDN
+    WorkerPool workers{ 2, 256, 1 };
+};
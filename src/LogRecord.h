@@ -0,0 +1,112 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+/*
+ * Layout of the binary log (ENABLE_BINARY_LOG), shared by logger.cpp and the decoder tool.
+ *
+ * The file starts with Magic, then holds records of [uint32 size][uint8 RecordType][payload],
+ * size counting the whole record, all integers little endian. A call site is described by
+ * a CallSite record before its first Entry in each file, entries only carry its ID.
+ */
+namespace logger::binary {
+    constexpr char Magic[8] = { 'D', 'L', 'N', 'A', 'L', 'O', 'G', '1' };
+    constexpr size_t MaxStringLength = 4096; // Longer string arguments are cut
+
+    enum class RecordType : uint8_t
+    {
+        CallSite = 1,   // uint32 id, uint32 line, uint32 column, string format, string file, string function
+        Entry = 2,      // uint32 id, char level, int64 nanoseconds since epoch, uint64 thread, arguments
+        Dropped = 3     // uint64 count
+    };
+
+    /* Each argument is a tag followed by its value, strings are uint32 length and bytes */
+    enum class ArgumentTag : char
+    {
+        Null = 'N',         // Compile-time nullptr
+        NullString = 'Z',   // Runtime nullptr
+        Bool = 'B',         // uint8
+        Char = 'C',         // char
+        Signed = 'I',       // int64
+        Unsigned = 'U',     // uint64
+        Double = 'D',       // double
+        Pointer = 'P',      // uint64
+        String = 'S'
+    };
+
+    template <typename T>
+    void Put(std::string& out, T value)
+    {
+        static_assert(std::is_trivially_copyable_v<T>);
+        out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+    }
+
+    inline void PutString(std::string& out, std::string_view value)
+    {
+        if (value.size() > MaxStringLength)
+            value = value.substr(0, MaxStringLength);
+        Put(out, static_cast<uint32_t>(value.size()));
+        out.append(value);
+    }
+
+    // Starts a record, EndRecord() fills its size in.
+    inline size_t BeginRecord(std::string& out, RecordType type)
+    {
+        const size_t start = out.size();
+        Put(out, uint32_t{ 0 });
+        Put(out, type);
+        return start;
+    }
+
+    inline void EndRecord(std::string& out, size_t start)
+    {
+        const uint32_t size = static_cast<uint32_t>(out.size() - start);
+        memcpy(out.data() + start, &size, sizeof(size));
+    }
+
+    /* Bounds checked reads, a failed read leaves the reader invalid */
+    class Reader
+    {
+    public:
+        explicit Reader(std::string_view data) : data(data) {}
+
+        template <typename T>
+        T Get()
+        {
+            T value{};
+            if (data.size() < sizeof(T))
+            {
+                valid = false;
+                data = {};
+                return value;
+            }
+            memcpy(&value, data.data(), sizeof(T));
+            data.remove_prefix(sizeof(T));
+            return value;
+        }
+
+        std::string_view GetString()
+        {
+            const uint32_t size = Get<uint32_t>();
+            if (data.size() < size)
+            {
+                valid = false;
+                data = {};
+                return {};
+            }
+            std::string_view value = data.substr(0, size);
+            data.remove_prefix(size);
+            return value;
+        }
+
+        bool Empty() const { return data.empty(); }
+        bool Valid() const { return valid; }
+
+    private:
+        std::string_view data;
+        bool valid = true;
+    };
+}
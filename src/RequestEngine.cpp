@@ -0,0 +1,101 @@
+#include <algorithm>
+
+#include "RequestEngine.h"
+
+RequestEngine::Request::Request(uint32_t id, Clock::duration timeout)
+    : id(id)
+    , begun(Clock::now())
+    , deadline(begun + timeout)
+{
+}
+
+std::chrono::milliseconds RequestEngine::Request::Remaining(std::chrono::milliseconds limit) const
+{
+    auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - Clock::now());
+    return std::clamp(left, std::chrono::milliseconds(0), limit);
+}
+
+RequestEngine::RequestEngine(size_t maxInFlight)
+    : maxInFlight(maxInFlight)
+{
+}
+
+RequestEngine::Handle RequestEngine::Begin(std::chrono::milliseconds timeout)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (inFlight.size() >= maxInFlight)
+    {
+        refused++;
+        return nullptr;
+    }
+
+    /* 0 is never given out, it tells Unity the request didn't start */
+    do
+        lastId++;
+    while (lastId == 0 || inFlight.count(lastId));
+
+    Request* request = new Request(lastId, timeout);
+    inFlight.emplace(request->id, request);
+    return Handle(request, [this](const Request* request)
+        {
+            Finish(*request);
+            delete request;
+        });
+}
+
+bool RequestEngine::Cancel(uint32_t id)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    auto request = inFlight.find(id);
+    if (request == inFlight.end())
+        return false;
+    request->second->cancelled.store(true, std::memory_order_relaxed);
+    return true;
+}
+
+void RequestEngine::Finish(const Request& request)
+{
+    const Clock::time_point now = Clock::now();
+    const auto latency = std::chrono::duration_cast<std::chrono::milliseconds>(now - request.begun).count();
+
+    std::lock_guard<std::mutex> lock(mutex);
+    inFlight.erase(request.id);
+    if (request.Cancelled())
+        cancelled++;
+    else if (now >= request.deadline)
+        expired++;
+    else
+        completed++;
+    latencies[finished++ % latencies.size()] = static_cast<uint32_t>(std::min<long long>(latency, UINT32_MAX));
+}
+
+DLNARequestStats RequestEngine::Stats() const
+{
+    std::array<uint32_t, std::tuple_size_v<decltype(latencies)>> recent;
+    DLNARequestStats stats{};
+    size_t count;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stats.inFlight = static_cast<uint32_t>(inFlight.size());
+        stats.completed = completed;
+        stats.cancelled = cancelled;
+        stats.expired = expired;
+        stats.refused = refused;
+        count = std::min(finished, latencies.size());
+        std::copy_n(latencies.begin(), count, recent.begin());
+    }
+
+    if (count)
+    {
+        auto percentile = [&](size_t percent)
+        {
+            auto nth = recent.begin() + std::min(count - 1, count * percent / 100);
+            std::nth_element(recent.begin(), nth, recent.begin() + count);
+            return *nth;
+        };
+        stats.latencyP50Ms = percentile(50);
+        stats.latencyP95Ms = percentile(95);
+        stats.latencyMaxMs = *std::max_element(recent.begin(), recent.begin() + count);
+    }
+    return stats;
+}
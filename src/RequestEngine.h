@@ -0,0 +1,83 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+/* Counters of the requests Unity started, mirrored by managed code */
+struct DLNARequestStats
+{
+    uint32_t inFlight;       // Started and not finished
+    uint32_t queuedActions;  // ContentDirectory actions waiting for a worker thread
+    uint32_t completed;      // Since startup, by outcome
+    uint32_t cancelled;
+    uint32_t expired;
+    uint32_t refused;        // Not started, too many in flight
+    uint32_t latencyP50Ms;   // Start to finish, over the last finished requests
+    uint32_t latencyP95Ms;
+    uint32_t latencyMaxMs;
+};
+static_assert(sizeof(DLNARequestStats) == 9 * sizeof(uint32_t), "DLNARequestStats is mirrored by managed code");
+
+/*
+ * Browse and search requests of Unity, from the call starting them to their last response.
+ *
+ * Every request gets a nonzero ID, returned to Unity so it can cancel it, and a deadline.
+ * No more than maxInFlight requests are in flight, Begin refuses more. The handle Begin
+ * returns is shared by whatever works for the request, which finishes when the last of
+ * them lets it go. Work for a cancelled or expired request stops at its next check, a
+ * response arriving for it is dropped unparsed.
+ */
+class RequestEngine
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    class Request
+    {
+    public:
+        uint32_t Id() const { return id; }
+        bool Cancelled() const { return cancelled.load(std::memory_order_relaxed); }
+        bool Expired() const { return Clock::now() >= deadline; }
+        bool Abandoned() const { return Cancelled() || Expired(); }
+        // Time left before the deadline, no more than limit.
+        std::chrono::milliseconds Remaining(std::chrono::milliseconds limit) const;
+
+    private:
+        friend class RequestEngine;
+        Request(uint32_t id, Clock::duration timeout);
+
+        const uint32_t id;
+        const Clock::time_point begun;
+        const Clock::time_point deadline;
+        std::atomic<bool> cancelled{ false };
+    };
+    using Handle = std::shared_ptr<const Request>;
+
+    explicit RequestEngine(size_t maxInFlight);
+
+    // nullptr when maxInFlight requests are in flight already.
+    Handle Begin(std::chrono::milliseconds timeout);
+    // False when no request of that ID is in flight.
+    bool Cancel(uint32_t id);
+    // queuedActions is left 0, the engine doesn't see the worker queues.
+    DLNARequestStats Stats() const;
+
+private:
+    void Finish(const Request& request);
+
+    const size_t maxInFlight;
+
+    mutable std::mutex mutex;
+    std::unordered_map<uint32_t, Request*> inFlight;
+    uint32_t lastId = 0;
+    uint32_t completed = 0;
+    uint32_t cancelled = 0;
+    uint32_t expired = 0;
+    uint32_t refused = 0;
+    std::array<uint32_t, 256> latencies{}; // Milliseconds, a ring of the last finished requests
+    size_t finished = 0;
+};
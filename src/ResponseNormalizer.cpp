@@ -0,0 +1,357 @@
+#include <cstring>
+#include <string_view>
+#include <vector>
+
+#include "ResponseNormalizer.h"
+#include "URLHandler.h"
+
+namespace
+{
+    bool IsSpace(char c)
+    {
+        return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+    }
+
+    bool IsNameChar(char c, bool first)
+    {
+        const unsigned char u = static_cast<unsigned char>(c);
+        if ((u | 0x20) >= 'a' && (u | 0x20) <= 'z')
+            return true;
+        if (c == '_' || c == ':' || u >= 0x80)
+            return true;
+        return !first && ((c >= '0' && c <= '9') || c == '-' || c == '.');
+    }
+
+    /* Length of the predefined entity at text, 0 for anything else */
+    size_t EntityLength(std::string_view text)
+    {
+        for (std::string_view entity : { "&lt;", "&gt;", "&amp;", "&apos;", "&quot;" })
+            if (text.starts_with(entity))
+                return entity.size();
+        return 0;
+    }
+
+    /*
+     * Appends what ixml prints for text once it has parsed it: the five predefined entities
+     * are decoded then escaped again, so they are copied, and the characters ixml escapes
+     * on output are escaped. Fails on any other reference or control character.
+     */
+    bool AppendText(std::string& out, std::string_view text)
+    {
+        size_t run = 0;
+        for (size_t i = 0; i < text.size();)
+        {
+            const char c = text[i];
+            const char* escaped = nullptr;
+            if (c == '&')
+            {
+                size_t length = EntityLength(text.substr(i));
+                if (!length)
+                    return false;
+                i += length;
+                continue;
+            }
+            else if (c == '>')
+                escaped = "&gt;";
+            else if (c == '\'')
+                escaped = "&apos;";
+            else if (c == '"')
+                escaped = "&quot;";
+            else if (static_cast<unsigned char>(c) < 0x20 && !IsSpace(c))
+                return false;
+
+            if (escaped)
+            {
+                out.append(text.data() + run, i - run);
+                out.append(escaped);
+                run = i + 1;
+            }
+            i++;
+        }
+        out.append(text.data() + run, text.size() - run);
+        return true;
+    }
+
+    class Normalizer
+    {
+    public:
+        explicit Normalizer(std::string& out)
+            : out(out)
+        {
+        }
+
+        bool Element(IXML_Node* element);
+
+    private:
+        bool Markup(std::string_view text);
+        bool StartTag(std::string_view text, size_t& pos);
+        bool EndTag(std::string_view text, size_t& pos);
+        bool Declared(std::string_view name) const;
+        void Declare(std::string_view attribute);
+
+        std::string& out;
+        std::string scratch;
+        std::vector<std::string_view> prefixes;     // In scope namespace prefixes, innermost last
+        std::vector<std::string_view> openElements; // Opened by the current text node
+        std::vector<size_t> scopes;                 // Size of prefixes when each of openElements started
+        std::vector<std::string_view> attributePrefixes;
+    };
+
+    /* Element and attribute names of the response only go through ConvertHTMLtoXML, which mustn't change them */
+    bool IsPlainName(const char* name)
+    {
+        return name && *name && !strpbrk(name, "&<>\"'\xc3") && !strstr(name, "unknown");
+    }
+
+    bool Normalizer::Declared(std::string_view name) const
+    {
+        size_t colon = name.find(':');
+        if (colon == std::string_view::npos)
+            return true;
+        std::string_view prefix = name.substr(0, colon);
+        for (auto it = prefixes.rbegin(); it != prefixes.rend(); ++it)
+            if (*it == prefix)
+                return true;
+        return false;
+    }
+
+    void Normalizer::Declare(std::string_view attribute)
+    {
+        if (attribute.starts_with("xmlns:"))
+            prefixes.push_back(attribute.substr(6));
+    }
+
+    bool Normalizer::Element(IXML_Node* element)
+    {
+        const char* name = ixmlNode_getNodeName(element);
+        if (!IsPlainName(name))
+            return false;
+
+        const size_t scope = prefixes.size();
+        out += '<';
+        out += name;
+        for (IXML_Node* attribute = element->firstAttr; attribute; attribute = ixmlNode_getNextSibling(attribute))
+        {
+            const char* attributeName = ixmlNode_getNodeName(attribute);
+            const char* value = ixmlNode_getNodeValue(attribute);
+            if (!IsPlainName(attributeName))
+                return false;
+
+            /* Printed escaped then decoded, the value is back to what the DOM holds except for ConvertHTMLtoXML */
+            scratch.assign(value ? value : "");
+            scratch.resize(ConvertHTMLtoXML(scratch.data(), scratch.size()));
+            for (char c : scratch)
+            {
+                if (c == '<' || c == '&' || c == '"' || static_cast<unsigned char>(c) < 0x20)
+                    return false;
+            }
+            out += ' ';
+            out += attributeName;
+            out += "=\"";
+            AppendText(out, scratch);
+            out += '"';
+            Declare(attributeName);
+        }
+        out += '>';
+
+        for (IXML_Node* child = ixmlNode_getFirstChild(element); child; child = ixmlNode_getNextSibling(child))
+        {
+            switch (ixmlNode_getNodeType(child))
+            {
+            case eELEMENT_NODE:
+                if (!Element(child))
+                    return false;
+                break;
+            case eTEXT_NODE:
+            {
+                const char* value = ixmlNode_getNodeValue(child);
+                scratch.assign(value ? value : "");
+                scratch.resize(ConvertHTMLtoXML(scratch.data(), scratch.size()));
+                if (!Markup(scratch))
+                    return false;
+                break;
+            }
+            default:
+                return false;
+            }
+        }
+
+        out += "</";
+        out += name;
+        out += '>';
+        prefixes.resize(scope);
+        return true;
+    }
+
+    /*
+     * A decoded text node: ixml would parse it as content of the enclosing element, drop the
+     * runs of white space between tags, turn empty element tags into a start and end tag and
+     * print attributes with double quotes after a single space.
+     */
+    bool Normalizer::Markup(std::string_view text)
+    {
+        size_t pos = 0;
+        while (pos < text.size())
+        {
+            size_t tag = text.find('<', pos);
+            std::string_view content = text.substr(pos, tag == std::string_view::npos ? std::string_view::npos : tag - pos);
+            for (char c : content)
+            {
+                if (!IsSpace(c))
+                {
+                    if (!AppendText(out, content))
+                        return false;
+                    break;
+                }
+            }
+            if (tag == std::string_view::npos)
+                break;
+
+            pos = tag + 1;
+            if (pos == text.size())
+                return false;
+            if (text[pos] == '/')
+            {
+                if (!EndTag(text, pos))
+                    return false;
+            }
+            else if (!StartTag(text, pos))
+                return false;
+        }
+        return openElements.empty();
+    }
+
+    bool Normalizer::StartTag(std::string_view text, size_t& pos)
+    {
+        auto readName = [&](std::string_view& name) {
+            size_t start = pos;
+            if (pos == text.size() || !IsNameChar(text[pos], true))
+                return false;
+            while (pos < text.size() && IsNameChar(text[pos], false))
+                pos++;
+            name = text.substr(start, pos - start);
+            return true;
+        };
+        auto skipSpaces = [&]() {
+            size_t start = pos;
+            while (pos < text.size() && IsSpace(text[pos]))
+                pos++;
+            return pos != start;
+        };
+
+        std::string_view name;
+        if (!readName(name))
+            return false;
+
+        const size_t scope = prefixes.size();
+        attributePrefixes.clear();
+        out += '<';
+        out += name;
+        bool empty = false;
+        for (;;)
+        {
+            const bool spaced = skipSpaces();
+            if (pos == text.size())
+                return false;
+            if (text[pos] == '>')
+            {
+                pos++;
+                break;
+            }
+            if (text[pos] == '/')
+            {
+                if (++pos == text.size() || text[pos] != '>')
+                    return false;
+                pos++;
+                empty = true;
+                break;
+            }
+
+            std::string_view attribute;
+            if (!spaced || !readName(attribute))
+                return false;
+            skipSpaces();
+            if (pos == text.size() || text[pos] != '=')
+                return false;
+            pos++;
+            skipSpaces();
+            if (pos == text.size() || (text[pos] != '"' && text[pos] != '\''))
+                return false;
+            size_t end = text.find(text[pos], pos + 1);
+            if (end == std::string_view::npos)
+                return false;
+            std::string_view value = text.substr(pos + 1, end - pos - 1);
+            pos = end + 1;
+            if (value.find_first_of("<\t\r\n") != std::string_view::npos)
+                return false;
+
+            out += ' ';
+            out += attribute;
+            out += "=\"";
+            if (!AppendText(out, value))
+                return false;
+            out += '"';
+
+            if (attribute.starts_with("xmlns:"))
+            {
+                if (attribute.size() == 6)
+                    return false;
+                Declare(attribute);
+            }
+            else if (attribute != "xmlns")
+                attributePrefixes.push_back(attribute);
+        }
+
+        /* ixml resolves prefixes with the declarations of the element itself */
+        if (!Declared(name) || name.starts_with("xmlns"))
+            return false;
+        for (std::string_view attribute : attributePrefixes)
+        {
+            if (!Declared(attribute))
+                return false;
+        }
+
+        out += '>';
+        if (empty)
+        {
+            out += "</";
+            out += name;
+            out += '>';
+            prefixes.resize(scope);
+        }
+        else
+        {
+            openElements.push_back(name);
+            scopes.push_back(scope);
+        }
+        return true;
+    }
+
+    bool Normalizer::EndTag(std::string_view text, size_t& pos)
+    {
+        pos++;
+        size_t end = text.find('>', pos);
+        if (end == std::string_view::npos || openElements.empty() || text.substr(pos, end - pos) != openElements.back())
+            return false;
+
+        out += "</";
+        out += openElements.back();
+        out += '>';
+        prefixes.resize(scopes.back());
+        openElements.pop_back();
+        scopes.pop_back();
+        pos = end + 1;
+        return true;
+    }
+}
+
+bool NormalizeResponse(IXML_Document* response, std::string& out)
+{
+    out.assign("<?xml version=\"1.0\"?>\r\n");
+    IXML_Node* root = ixmlNode_getFirstChild(reinterpret_cast<IXML_Node*>(response));
+    if (!root || ixmlNode_getNodeType(root) != eELEMENT_NODE || ixmlNode_getNextSibling(root))
+        return false;
+
+    Normalizer normalizer(out);
+    return normalizer.Element(root);
+}
@@ -0,0 +1,17 @@
+#pragma once
+#include <string>
+
+#include "ixml.h"
+
+/*
+ * Single pass replacement for what the v1.0 browse path used to do with a response:
+ * ixmlDocumenttoString, ConvertHTMLtoXML on the text, ixmlParseBuffer and
+ * ixmlDocumenttoString again.
+ *
+ * The response DOM is walked once, every text node is decoded in place and the markup
+ * it turns into is written out the way ixml would print it after parsing, so no second
+ * DOM is built. Anything whose outcome through ixml isn't certain (comments, CDATA,
+ * character references, undeclared prefixes...) makes it return false, callers are
+ * then expected to go through ixml.
+ */
+bool NormalizeResponse(IXML_Document* response, std::string& out);
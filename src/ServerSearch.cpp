@@ -0,0 +1,490 @@
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_set>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#include "rapidjson/document.h"
+#include "rapidjson/stringbuffer.h"
+#include "rapidjson/writer.h"
+
+#include "ixml.h"
+
+#include "DLNAModule.h"
+#include "ServerSearch.h"
+#include "URLHandler.h"
+#include "logger.h"
+
+namespace
+{
+    std::mutex capabilitiesMutex;
+    std::map<std::string, bool, std::less<>> titleSearchable; // By UDN, for the servers that answered GetSearchCapabilities
+
+    /* Sent for the search request, so its deadline and cancellation cover the probe too */
+    bool IsTitleSearchable(const UpnpDevice& server, const RequestEngine::Request* request)
+    {
+        {
+            std::lock_guard<std::mutex> lock(capabilitiesMutex);
+            auto known = titleSearchable.find(server.UDN);
+            if (known != titleSearchable.end())
+                return known->second;
+        }
+
+        IXML_Document* response;
+        int res = SendContentDirectoryAction(server.location, "GetSearchCapabilities", {}, &response, request);
+        if (res != UPNP_E_SUCCESS)
+        {
+            Log(LogLevel::Debug, "GetSearchCapabilities of %s failed: %d", server.friendlyName.c_str(), res);
+            return false;
+        }
+
+        /* Comma separated property names, "*" for all of them */
+        bool searchable = false;
+        const char* capabilities = ixmlElement_getFirstChildElementValue((IXML_Element*)response, "SearchCaps");
+        for (std::string_view rest = capabilities ? capabilities : ""; !rest.empty() && !searchable;)
+        {
+            size_t comma = rest.find(',');
+            std::string_view capability = rest.substr(0, comma);
+            rest = comma == std::string_view::npos ? std::string_view() : rest.substr(comma + 1);
+            while (!capability.empty() && capability.front() == ' ')
+                capability.remove_prefix(1);
+            while (!capability.empty() && capability.back() == ' ')
+                capability.remove_suffix(1);
+            searchable = capability == "*" || capability == "dc:title";
+        }
+        ixmlDocument_free(response);
+
+        std::lock_guard<std::mutex> lock(capabilitiesMutex);
+        titleSearchable[server.UDN] = searchable;
+        return searchable;
+    }
+
+    void ForgetTitleSearch(const std::string& udn)
+    {
+        std::lock_guard<std::mutex> lock(capabilitiesMutex);
+        titleSearchable[udn] = false;
+    }
+
+    char ToLower(char c)
+    {
+        return c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c;
+    }
+
+    class Search : public std::enable_shared_from_this<Search>
+    {
+    public:
+        Search(rapidjson::Document&& request, BrowseDLNAFolderCallback callback, std::string_view query,
+            RequestEngine::Handle handle, unsigned int concurrency, unsigned int maxResults, unsigned int pageSize);
+
+        bool Start(const std::vector<DeviceRegistry::Device>& devices);
+
+    private:
+        struct Server
+        {
+            DeviceRegistry::Device device;
+            std::string host;
+            std::deque<std::string> containers; // Left to browse when the server can't search
+            std::unordered_set<std::string> queued; // Every container ever put in containers, aliases and loops reach some twice
+            unsigned int running = 0;           // Jobs working for this server
+            unsigned int found = 0;
+            int status = UPNP_E_SUCCESS;
+            bool timedOut = false;
+        };
+
+        struct Page
+        {
+            unsigned int numberReturned = 0;
+            unsigned int totalMatches = 0;
+        };
+
+        bool Submit(Server& server, std::function<void(Search&, Server&)> job);
+        void SearchServer(Server& server);
+        bool SearchTitles(Server& server);
+        void Crawl(Server& server);
+        int BrowseContainer(Server& server, const std::string& objectID, std::vector<std::string>& children);
+        int Fetch(Server& server, const std::string* objectID, unsigned int start, Page& page, std::vector<std::string>* children);
+        bool Abandoned() const { return handle->Abandoned(); }
+        void Deliver(Server& server, const BrowseResult& result, bool matchTitles);
+        void Finish(Server& server);
+        void Respond(const Server& server, bool serverComplete);
+
+        const rapidjson::Document request;
+        const BrowseDLNAFolderCallback callback;
+        std::string criteria;
+        std::string loweredQuery;
+        const RequestEngine::Handle handle;
+        const unsigned int concurrency;
+        const unsigned int maxResults;
+        const unsigned int pageSize;
+
+        std::mutex mutex; // Guards everything below and serializes the callback
+        std::vector<Server> servers;
+        size_t serversLeft = 0;
+        unsigned long jobs = 0;
+        std::unordered_set<std::string> sent; // Resource URLs, or UDN and object ID when there is none
+        std::vector<ItemView> selected;
+        rapidjson::StringBuffer buffer;
+    };
+
+    Search::Search(rapidjson::Document&& request, BrowseDLNAFolderCallback callback, std::string_view query,
+        RequestEngine::Handle handle, unsigned int concurrency, unsigned int maxResults, unsigned int pageSize)
+        : request(std::move(request))
+        , callback(callback)
+        , handle(std::move(handle))
+        , concurrency(concurrency)
+        , maxResults(maxResults)
+        , pageSize(pageSize)
+    {
+        /* Quoted string of the ContentDirectory search grammar, '"' and '\' are escaped */
+        criteria = "dc:title contains \"";
+        for (char c : query)
+        {
+            if (c == '"' || c == '\\')
+                criteria += '\\';
+            criteria += c;
+            loweredQuery += ToLower(c);
+        }
+        criteria += '"';
+    }
+
+    bool Search::Start(const std::vector<DeviceRegistry::Device>& devices)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        servers.resize(devices.size());
+        serversLeft = servers.size();
+        bool started = false;
+        for (size_t i = 0; i < servers.size(); i++)
+        {
+            Server& server = servers[i];
+            server.device = devices[i];
+            server.host = WorkerHostKey(server.device->location, server.device->UDN);
+
+            if (Submit(server, &Search::SearchServer))
+            {
+                started = true;
+                continue;
+            }
+            /* Nothing was sent yet when the pool can't take any job, the caller is told right away */
+            if (!started)
+                return false;
+            server.status = -1;
+            Finish(server);
+        }
+        return true;
+    }
+
+    /* Called with mutex held */
+    bool Search::Submit(Server& server, std::function<void(Search&, Server&)> job)
+    {
+        const std::string key = "search/" + std::to_string(handle->Id()) + "/" + std::to_string(jobs++);
+        bool submitted = DLNAModule::GetInstance().searchWorkers.Submit(key, server.host, [self = shared_from_this(), &server, job = std::move(job)]
+            {
+                job(*self, server);
+            });
+        if (submitted)
+            server.running++;
+        return submitted;
+    }
+
+    void Search::SearchServer(Server& server)
+    {
+        const bool searchable = IsTitleSearchable(*server.device, handle.get());
+        if (searchable && SearchTitles(server))
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            server.running--;
+            Finish(server);
+            return;
+        }
+        if (searchable)
+        {
+            Log(LogLevel::Warning, "%s refused to search, browsing it instead", server.device->friendlyName.c_str());
+            ForgetTitleSearch(server.device->UDN);
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            server.containers.push_back("0");
+            server.queued.insert("0");
+        }
+        Crawl(server);
+    }
+
+    /* Returns false when the server rejects the first Search, nothing was delivered then */
+    bool Search::SearchTitles(Server& server)
+    {
+        for (unsigned int start = 0;;)
+        {
+            if (Abandoned())
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                server.timedOut = true;
+                return true;
+            }
+
+            Page page;
+            int res = Fetch(server, nullptr, start, page, nullptr);
+            if (res != UPNP_E_SUCCESS)
+            {
+                /* Dropped for the request, not refused by the server */
+                if (!start && !Abandoned())
+                    return false;
+                std::lock_guard<std::mutex> lock(mutex);
+                if (Abandoned())
+                    server.timedOut = true;
+                else
+                    server.status = res;
+                return true;
+            }
+
+            const bool last = IsLastPage(start, page.numberReturned, page.totalMatches, pageSize);
+            start += page.numberReturned;
+            std::lock_guard<std::mutex> lock(mutex);
+            if (last || server.found >= maxResults)
+                return true;
+        }
+    }
+
+    void Search::Crawl(Server& server)
+    {
+        std::vector<std::string> children;
+        for (;;)
+        {
+            std::string container;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (!server.containers.empty() && (server.found >= maxResults || Abandoned()))
+                {
+                    if (server.found < maxResults)
+                        server.timedOut = true;
+                    server.containers.clear();
+                }
+                if (server.containers.empty())
+                {
+                    if (--server.running == 0)
+                        Finish(server);
+                    return;
+                }
+                container = std::move(server.containers.front());
+                server.containers.pop_front();
+            }
+
+            children.clear();
+            int res = BrowseContainer(server, container, children);
+
+            std::lock_guard<std::mutex> lock(mutex);
+            if (res != UPNP_E_SUCCESS && !Abandoned())
+                server.status = res;
+            for (std::string& child : children)
+                if (server.queued.insert(child).second)
+                    server.containers.push_back(std::move(child));
+            /* More hands for the containers waiting, this job takes the next one itself */
+            while (server.running < concurrency && server.running < server.containers.size())
+            {
+                if (!Submit(server, &Search::Crawl))
+                    break;
+            }
+        }
+    }
+
+    int Search::BrowseContainer(Server& server, const std::string& objectID, std::vector<std::string>& children)
+    {
+        for (unsigned int start = 0;;)
+        {
+            Page page;
+            int res = Fetch(server, &objectID, start, page, &children);
+            if (res != UPNP_E_SUCCESS)
+                return res;
+
+            if (IsLastPage(start, page.numberReturned, page.totalMatches, pageSize))
+                return UPNP_E_SUCCESS;
+            start += page.numberReturned;
+            if (Abandoned())
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                server.timedOut = true;
+                return UPNP_E_SUCCESS;
+            }
+        }
+    }
+
+    /* One page of Search results, or of the children of objectID when it is given */
+    int Search::Fetch(Server& server, const std::string* objectID, unsigned int start, Page& page, std::vector<std::string>* children)
+    {
+        const std::string startingIndex = std::to_string(start);
+        const std::string requestedCount = std::to_string(pageSize);
+        IXML_Document* response;
+        int res = objectID
+            ? SendContentDirectoryAction(server.device->location, "Browse", { { "ObjectID", objectID->c_str() }, { "BrowseFlag", "BrowseDirectChildren" },
+                { "Filter", "*" }, { "StartingIndex", startingIndex.c_str() }, { "RequestedCount", requestedCount.c_str() }, { "SortCriteria", "" } }, &response, handle.get())
+            : SendContentDirectoryAction(server.device->location, "Search", { { "ContainerID", "0" }, { "SearchCriteria", criteria.c_str() },
+                { "Filter", "*" }, { "StartingIndex", startingIndex.c_str() }, { "RequestedCount", requestedCount.c_str() }, { "SortCriteria", "" } }, &response, handle.get());
+        if (res == UPNP_E_CANCELED)
+            return res;
+        if (res != UPNP_E_SUCCESS)
+        {
+            Log(LogLevel::Warning, "%s of %s on %s failed: %d", objectID ? "Browse" : "Search", objectID ? objectID->c_str() : criteria.c_str(),
+                server.device->friendlyName.c_str(), res);
+            return res;
+        }
+
+        const char* numberReturned = ixmlElement_getFirstChildElementValue((IXML_Element*)response, "NumberReturned");
+        const char* totalMatches = ixmlElement_getFirstChildElementValue((IXML_Element*)response, "TotalMatches");
+        page.numberReturned = numberReturned ? strtoul(numberReturned, nullptr, 10) : 0;
+        page.totalMatches = totalMatches ? strtoul(totalMatches, nullptr, 10) : 0;
+
+        std::variant<BrowseResult, int> parsed = Resolve2(response);
+        ixmlDocument_free(response);
+        if (const int* error = std::get_if<int>(&parsed))
+            return *error;
+
+        const BrowseResult& result = std::get<BrowseResult>(parsed);
+        if (children)
+        {
+            for (size_t i = 0; i < result.size() && result.Type(i) == MediaType::CONTAINER; i++)
+                children->emplace_back(result.Field(i, ObjectIDField));
+        }
+        Deliver(server, result, children != nullptr);
+        return UPNP_E_SUCCESS;
+    }
+
+    void Search::Deliver(Server& server, const BrowseResult& result, bool matchTitles)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        selected.clear();
+        for (size_t i = 0; i < result.size(); i++)
+        {
+            if (server.found >= maxResults)
+                break;
+            if (matchTitles && !ContainsIgnoringCase(result.Field(i, TitleField), loweredQuery))
+                continue;
+
+            const ItemView item = result[i];
+            /* Servers list the same media under several containers, and sometimes other servers proxy it */
+            std::string key = item.url.empty() ? server.device->UDN + '\n' + std::string(item.objectID) : std::string(item.url);
+            if (!sent.insert(std::move(key)).second)
+                continue;
+            selected.push_back(item);
+            server.found++;
+        }
+        if (!selected.empty())
+            Respond(server, false);
+    }
+
+    /* Called with mutex held, once per server */
+    void Search::Finish(Server& server)
+    {
+        serversLeft--;
+        Log(LogLevel::Info, "Search on %s done: %u results, status %d%s", server.device->friendlyName.c_str(), server.found, server.status,
+            server.timedOut ? ", timed out" : "");
+        selected.clear();
+        Respond(server, true);
+    }
+
+    /* Called with mutex held */
+    void Search::Respond(const Server& server, bool serverComplete)
+    {
+        if (handle->Cancelled())
+            return;
+
+        buffer.Clear();
+        rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
+        writer.StartObject();
+        writer.Key("version");
+        writer.String(request["version"].GetString());
+        writer.Key("method");
+        writer.String("DLNASearchResponse");
+        writer.Key("request_body");
+        request.Accept(writer);
+        writer.Key("requestId");
+        writer.Uint(handle->Id());
+
+        writer.Key("results");
+        writer.StartArray();
+        for (const ItemView& item : selected)
+            WriteItem(writer, item);
+        writer.EndArray();
+
+        writer.Key("server");
+        writer.String(server.device->UDN.c_str(), static_cast<rapidjson::SizeType>(server.device->UDN.size()));
+        writer.Key("status");
+        writer.Int(server.status);
+        writer.Key("serverComplete");
+        writer.Bool(serverComplete);
+        if (serverComplete)
+        {
+            writer.Key("timedOut");
+            writer.Bool(server.timedOut);
+        }
+        writer.Key("complete");
+        writer.Bool(serverComplete && serversLeft == 0);
+        writer.EndObject();
+
+        callback(buffer.GetString());
+    }
+}
+
+uint32_t SearchServersByUnity(const char* json, BrowseDLNAFolderCallback OnSearchResultCallback)
+{
+    if (!json || !OnSearchResultCallback)
+        return 0;
+
+    rapidjson::Document request, arguments;
+    request.Parse(json);
+    if (request.HasParseError() || !request.IsObject() || !request.HasMember("version") || !request["version"].IsString()
+        || !request.HasMember("arguments") || !request["arguments"].IsString())
+    {
+        Log(LogLevel::Error, "Broken search request");
+        return 0;
+    }
+
+    arguments.Parse(request["arguments"].GetString());
+    if (arguments.HasParseError() || !arguments.IsObject() || !arguments.HasMember("query") || !arguments["query"].IsString()
+        || !arguments["query"].GetStringLength())
+    {
+        Log(LogLevel::Error, "Broken arguments in search request");
+        return 0;
+    }
+
+    auto argument = [&arguments](const char* name, unsigned int fallback)
+    {
+        return arguments.HasMember(name) && arguments[name].IsUint() && arguments[name].GetUint() ? arguments[name].GetUint() : fallback;
+    };
+    const std::string_view query(arguments["query"].GetString(), arguments["query"].GetStringLength());
+    const std::chrono::milliseconds timeout(argument("timeout", 10000));
+    const unsigned int concurrency = std::min(argument("concurrency", 2), 4u);
+    const unsigned int maxResults = argument("maxResults", 1000);
+    const unsigned int pageSize = argument("pagesize", 200);
+
+    std::vector<DeviceRegistry::Device> servers;
+    for (const auto& [udn, device] : *DLNAModule::GetInstance().devices.Load())
+    {
+        if (device->deviceType == UpnpDevice::MediaServer && !device->location.empty())
+            servers.push_back(device);
+    }
+    if (servers.empty())
+    {
+        Log(LogLevel::Warning, "Search request without any MediaServer known");
+        return 0;
+    }
+
+    RequestEngine::Handle handle = DLNAModule::GetInstance().requests.Begin(timeout);
+    if (!handle)
+    {
+        Log(LogLevel::Warning, "Search request refused, too many requests in flight");
+        return 0;
+    }
+
+    const uint32_t id = handle->Id();
+    Log(LogLevel::Info, "SearchRequest %u: query=%s, servers=%u, timeout=%ums", id, query, servers.size(), timeout.count());
+    auto search = std::make_shared<Search>(std::move(request), OnSearchResultCallback, query, std::move(handle), concurrency, maxResults, pageSize);
+    return search->Start(servers) ? id : 0;
+}
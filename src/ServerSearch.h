@@ -0,0 +1,23 @@
+#pragma once
+#include "UpnpCommand.h"
+
+/*
+ * Title search over every known MediaServer at once.
+ *
+ * Servers whose SearchCapabilities include dc:title get a ContentDirectory Search, the
+ * others are walked with BrowseDirectChildren from the root and their titles matched
+ * here. Every server is asked in parallel on DLNAModule::searchWorkers, with at most
+ * "concurrency" requests in flight per server and no request started past "timeout".
+ * A cancelled search sends no further request and no further response.
+ *
+ * The callback gets a DLNASearchResponse as each page of matches arrives. Results are
+ * merged across servers and pages: an object whose resource URL was already sent is
+ * not sent again. Each server ends with one response carrying its "server" UDN, its
+ * "status" and "timedOut", the last of them has "complete" set. Like browse responses,
+ * the callback runs on worker threads, one call at a time.
+ *
+ * arguments: {"query": "...", "timeout": ms, "concurrency": n, "maxResults": n per server,
+ *             "pagesize": n}, only query is mandatory.
+ */
+// Returns the request ID, 0 when the search could not start.
+uint32_t SearchServersByUnity(const char* json, BrowseDLNAFolderCallback OnSearchResultCallback);
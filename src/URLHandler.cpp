@@ -1,4 +1,15 @@
-﻿#include <sstream>
+﻿#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstring>
+#include <sstream>
+#include <string_view>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
 
 #include "URLHandler.h"
 
@@ -44,65 +55,151 @@ std::string ReplaceAll(const char* src, int srcLen, const char* oldValue, const
     return ret;
 }
 
-std::string ConvertHTMLtoXML(const char* src)
+namespace
 {
-    std::string srcstr(src);
-
-    int lengthBefore = 0;
-    do
+    /* Next byte that can start a replacement: '&' or the lead byte of U+00D7 */
+    char* FindEntityOrTimes(char* cur, char* end)
     {
-        lengthBefore = srcstr.length();
-        srcstr = ReplaceAll(srcstr.data(), srcstr.length(), "\xc3\x97", "x");
-    } while (lengthBefore != srcstr.length());
-
-    do
-    {
-        lengthBefore = srcstr.length();
-        srcstr = ReplaceAll(srcstr.data(), srcstr.length(), "&amp;", "&");
-    } while (lengthBefore != srcstr.length());
-
-    do
-    {
-        lengthBefore = srcstr.length();
-        srcstr = ReplaceAll(srcstr.data(), srcstr.length(), "&quot;", "\"");
-    } while (lengthBefore != srcstr.length());
+#if defined(__SSE2__) || defined(_M_X64)
+        const __m128i amp = _mm_set1_epi8('&');
+        const __m128i lead = _mm_set1_epi8('\xc3');
+        for (; end - cur >= 16; cur += 16)
+        {
+            __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(cur));
+            unsigned int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(chunk, amp), _mm_cmpeq_epi8(chunk, lead)));
+            if (mask)
+                return cur + std::countr_zero(mask);
+        }
+#elif defined(__ARM_NEON)
+        const uint8x16_t amp = vdupq_n_u8('&');
+        const uint8x16_t lead = vdupq_n_u8(0xc3);
+        for (; end - cur >= 16; cur += 16)
+        {
+            uint8x16_t chunk = vld1q_u8(reinterpret_cast<const uint8_t*>(cur));
+            uint8x16_t hits = vorrq_u8(vceqq_u8(chunk, amp), vceqq_u8(chunk, lead));
+            /* Narrow every byte of the comparison to a nibble to get a 64 bits mask */
+            uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(hits), 4)), 0);
+            if (mask)
+                return cur + (std::countr_zero(mask) >> 2);
+        }
+#endif
+        for (; cur < end; cur++)
+        {
+            if (*cur == '&' || *cur == '\xc3')
+                return cur;
+        }
+        return end;
+    }
 
-    do
+    bool StartsWith(const char* cur, const char* end, std::string_view prefix)
     {
-        lengthBefore = srcstr.length();
-        srcstr = ReplaceAll(srcstr.data(), srcstr.length(), "&gt;", ">");
-    } while (lengthBefore != srcstr.length());
+        return static_cast<size_t>(end - cur) >= prefix.size() && memcmp(cur, prefix.data(), prefix.size()) == 0;
+    }
+}
 
-    do
+size_t ConvertHTMLtoXML(char* buffer, size_t length)
+{
+    char* const end = buffer + length;
+    char* in = buffer;
+    char* out = buffer;
+
+    /*
+     * Same result as replacing, one after the other and each until nothing changes,
+     * "\xc3\x97" by "x", "&amp;" by "&", then &quot; &gt; &lt; &apos; by their character.
+     * None of these replacements can build a match for a later one except "&amp;", whose
+     * '&' may start another entity, so an '&' swallows every "amp;" following it first.
+     */
+    while (in < end)
     {
-        lengthBefore = srcstr.length();
-        srcstr = ReplaceAll(srcstr.data(), srcstr.length(), "&lt;", "<");
-    } while (lengthBefore != srcstr.length());
+        char* next = FindEntityOrTimes(in, end);
+        if (out != in)
+            memmove(out, in, next - in);
+        out += next - in;
+        in = next;
+        if (in == end)
+            break;
+
+        if (*in == '\xc3')
+        {
+            bool times = in + 1 < end && in[1] == '\x97';
+            *out++ = times ? 'x' : *in;
+            in += times ? 2 : 1;
+            continue;
+        }
 
-    do
-    {
-        lengthBefore = srcstr.length();
-        srcstr = ReplaceAll(srcstr.data(), srcstr.length(), "&apos;", "'");
-    } while (lengthBefore != srcstr.length());
+        char* entity = in + 1;
+        while (StartsWith(entity, end, "amp;"))
+            entity += 4;
+
+        char c = '&';
+        if (StartsWith(entity, end, "quot;"))
+            c = '"', entity += 5;
+        else if (StartsWith(entity, end, "gt;"))
+            c = '>', entity += 3;
+        else if (StartsWith(entity, end, "lt;"))
+            c = '<', entity += 3;
+        else if (StartsWith(entity, end, "apos;"))
+            c = '\'', entity += 5;
+        *out++ = c;
+        in = entity;
+    }
 
-    do
+    /*
+     * Then "<unknown>" becomes "unknown" until nothing changes, which strips as many
+     * '<' before and '>' after every "unknown" as can be paired.
+     */
+    std::string_view decoded(buffer, out - buffer);
+    size_t found = decoded.find("<unknown>");
+    if (found == std::string_view::npos)
+        return decoded.size();
+
+    const std::string_view core = "unknown";
+    in = out = buffer + found + 1;
+    char* const decodedEnd = buffer + decoded.size();
+    while (in < decodedEnd)
     {
-        lengthBefore = srcstr.length();
-        srcstr = ReplaceAll(srcstr.data(), srcstr.length(), "<unknown>", "unknown");
-    } while (lengthBefore != srcstr.length());
+        size_t pos = std::string_view(in, decodedEnd - in).find(core);
+        char* next = pos == std::string_view::npos ? decodedEnd : in + pos;
+        if (out != in)
+            memmove(out, in, next - in);
+        out += next - in;
+        in = next;
+        if (in == decodedEnd)
+            break;
+
+        size_t opening = 0;
+        while (out - opening > buffer && *(out - opening - 1) == '<')
+            opening++;
+        size_t closing = 0;
+        while (in + core.size() + closing < decodedEnd && in[core.size() + closing] == '>')
+            closing++;
+
+        size_t pairs = std::min(opening, closing);
+        out -= pairs;
+        memmove(out, in, core.size());
+        out += core.size();
+        in += core.size() + pairs;
+    }
+    return out - buffer;
+}
 
+std::string ConvertHTMLtoXML(const char* src)
+{
+    std::string srcstr(src);
+    srcstr.resize(ConvertHTMLtoXML(srcstr.data(), srcstr.size()));
     return srcstr;
 }
 
 std::string GetIconURL(IXML_Element* device, const char* baseURL)
 {
     std::string res;
-    URLInfo url;
+    URLView url;
+    char scratch[256];
     IXML_NodeList* iconLists = nullptr;
     IXML_Element* iconList = nullptr;
 
-    if (ParseUrl(&url, baseURL) < 0)
-        goto end;
+    if (!baseURL || !ParseUrlView(baseURL, url, scratch))
+        return res;
 
     iconLists = ixmlElement_getElementsByTagName(device, "iconList");
     iconList = (IXML_Element*)ixmlNodeList_item(iconLists, 0);
@@ -138,16 +235,12 @@ std::string GetIconURL(IXML_Element* device, const char* baseURL)
 
     if (!res.empty())
     {
-        std::ostringstream oss;
-        oss << url.protocol << "://" << url.host << ":" << url.port << res;
-        res = oss.str();
+        std::string resolved;
+        if (ResolveUrl(baseURL, res, resolved))
+            res = std::move(resolved);
+        else
+            res.clear();
     }
-
-end:
-    if (url.host != nullptr)
-        free(url.host);
-    if (url.buffer != nullptr)
-        free(url.buffer);
     return res;
 }
 
@@ -398,4 +491,312 @@ int ParseUrl(URLInfo* url, const char* str)
     }
 
     return ret;
+}
+
+namespace
+{
+    enum CharClass : uint8_t
+    {
+        Unreserved = 1,     // RFC 3986 2.3 unreserved and 2.2 sub-delims
+        HexDigit = 2,
+        SchemeChar = 4,
+        Alpha = 8,
+        AuthorityEnd = 16,  // '/', '?' and '#'
+        PathEnd = 32        // '?' and '#'
+    };
+
+    constexpr std::array<uint8_t, 256> MakeCharClasses()
+    {
+        std::array<uint8_t, 256> classes{};
+        for (int c = 0; c < 256; c++)
+        {
+            const bool alpha = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+            const bool digit = c >= '0' && c <= '9';
+            if (alpha || digit || std::string_view("-._~!$&'()*+,;=").find(static_cast<char>(c)) != std::string_view::npos)
+                classes[c] |= Unreserved;
+            if (digit || (c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F'))
+                classes[c] |= HexDigit;
+            if (alpha || digit || c == '+' || c == '-' || c == '.')
+                classes[c] |= SchemeChar;
+            if (alpha)
+                classes[c] |= Alpha;
+            if (c == '/' || c == '?' || c == '#')
+                classes[c] |= AuthorityEnd;
+            if (c == '?' || c == '#')
+                classes[c] |= PathEnd;
+        }
+        return classes;
+    }
+    constexpr std::array<uint8_t, 256> charClasses = MakeCharClasses();
+
+    bool Is(char c, CharClass charClass)
+    {
+        return charClasses[static_cast<unsigned char>(c)] & charClass;
+    }
+
+    bool IsUriValid(std::string_view str, std::string_view extras, bool allowNonAscii)
+    {
+        for (size_t i = 0; i < str.size(); i++)
+        {
+            const char c = str[i];
+            if (Is(c, Unreserved) || (allowNonAscii && static_cast<unsigned char>(c) >= 0x80) || extras.find(c) != std::string_view::npos)
+                continue;
+            if (c == '%' && i + 2 < str.size() && Is(str[i + 1], HexDigit) && Is(str[i + 2], HexDigit))
+            {
+                i += 2;
+                continue;
+            }
+            return false;
+        }
+        return true;
+    }
+
+    int HexValue(char c)
+    {
+        return c <= '9' ? c - '0' : (c | 0x20) - 'a' + 10;
+    }
+
+    /* RFC 3986 appendix B in a single pass, components are never rejected here */
+    void SplitReference(std::string_view str, URLView& url)
+    {
+        url = {};
+        const size_t length = str.size();
+        size_t i = 0;
+        while (i < length && Is(str[i], SchemeChar))
+            i++;
+        if (i > 0 && i < length && str[i] == ':' && Is(str[0], Alpha))
+            url.scheme = str.substr(0, i++);
+        else
+            i = 0;
+
+        if (length - i >= 2 && str[i] == '/' && str[i + 1] == '/')
+        {
+            url.hasAuthority = true;
+            size_t end = i += 2;
+            while (end < length && !Is(str[end], AuthorityEnd))
+                end++;
+            url.authority = str.substr(i, end - i);
+            i = end;
+        }
+
+        size_t end = i;
+        while (end < length && !Is(str[end], PathEnd))
+            end++;
+        url.path = str.substr(i, end - i);
+        i = end;
+
+        if (i < length && str[i] == '?')
+        {
+            url.hasQuery = true;
+            end = ++i;
+            while (end < length && str[end] != '#')
+                end++;
+            url.query = str.substr(i, end - i);
+            i = end;
+        }
+
+        if (i < length)
+        {
+            url.hasFragment = true;
+            url.fragment = str.substr(i + 1);
+        }
+    }
+
+    // RFC 3986 5.2.4 in place, returns the new length.
+    size_t RemoveDotSegments(char* path, size_t length)
+    {
+        size_t in = 0;
+        size_t out = 0;
+        auto PopSegment = [path, &out]
+        {
+            while (out > 0 && path[out - 1] != '/')
+                out--;
+            if (out > 0)
+                out--;
+        };
+
+        while (in < length)
+        {
+            std::string_view rest(path + in, length - in);
+            if (rest.starts_with("../"))
+                in += 3;
+            else if (rest.starts_with("./"))
+                in += 2;
+            else if (rest.starts_with("/./"))
+                in += 2;
+            else if (rest == "/.")
+                path[++in] = '/';
+            else if (rest.starts_with("/../"))
+            {
+                in += 3;
+                PopSegment();
+            }
+            else if (rest == "/..")
+            {
+                in += 2;
+                path[in] = '/';
+                PopSegment();
+            }
+            else if (rest == "." || rest == "..")
+                in = length;
+            else
+            {
+                size_t end = rest.find('/', 1);
+                end = end == std::string_view::npos ? length : in + end;
+                memmove(path + out, path + in, end - in);
+                out += end - in;
+                in = end;
+            }
+        }
+        return out;
+    }
+
+    void AppendPath(std::string& out, std::string_view directory, std::string_view path)
+    {
+        const size_t start = out.size();
+        out.append(directory).append(path);
+        /* Dot segments are rare, only a "." after a slash or at the start can begin one */
+        std::string_view merged = std::string_view(out).substr(start);
+        if (merged.starts_with('.') || merged.find("/.") != std::string_view::npos)
+            out.resize(start + RemoveDotSegments(out.data() + start, out.size() - start));
+    }
+}
+
+bool ParseUrlView(std::string_view str, URLView& url, std::span<char> scratch)
+{
+    SplitReference(str, url);
+
+    if (url.hasAuthority)
+    {
+        std::string_view hostPort = url.authority;
+        size_t at = hostPort.rfind('@');
+        if (at != std::string_view::npos)
+        {
+            url.userInfo = hostPort.substr(0, at);
+            hostPort.remove_prefix(at + 1);
+        }
+
+        std::string_view port;
+        bool hasPort = false;
+        if (hostPort.starts_with('[') && hostPort.find(']') != std::string_view::npos)
+        {   /* IPv6 numeral within brackets */
+            size_t close = hostPort.rfind(']');
+            url.host = hostPort.substr(1, close - 1);
+            hasPort = close + 1 < hostPort.size() && hostPort[close + 1] == ':';
+            if (hasPort)
+                port = hostPort.substr(close + 2);
+        }
+        else
+        {
+            size_t colon = hostPort.find(':');
+            url.host = hostPort.substr(0, colon);
+            hasPort = colon != std::string_view::npos;
+            if (hasPort)
+                port = hostPort.substr(colon + 1);
+
+            if (url.host.find('%') != std::string_view::npos)
+            {
+                /* Decoded into the scratch buffer, the input stays untouched */
+                size_t length = 0;
+                for (size_t i = 0; i < url.host.size(); i++, length++)
+                {
+                    if (length >= scratch.size())
+                        return false;
+                    if (url.host[i] != '%')
+                        scratch[length] = url.host[i];
+                    else if (i + 2 < url.host.size() && Is(url.host[i + 1], HexDigit) && Is(url.host[i + 2], HexDigit))
+                    {
+                        scratch[length] = static_cast<char>(HexValue(url.host[i + 1]) << 4 | HexValue(url.host[i + 2]));
+                        i += 2;
+                    }
+                    else
+                        return false;
+                }
+                url.host = std::string_view(scratch.data(), length);
+            }
+            if (std::any_of(url.host.begin(), url.host.end(), [](char c) { return static_cast<unsigned char>(c) >= 0x80; }))
+                return false;
+        }
+        if (!IsUriValid(url.host, ":", false))
+            return false;
+
+        if (hasPort && !port.empty())
+        {
+            unsigned long value = 0;
+            for (char c : port)
+            {
+                if (c < '0' || c > '9' || value > (UINT_MAX - 9) / 10)
+                    return false;
+                value = value * 10 + (c - '0');
+            }
+            url.port = static_cast<unsigned int>(value);
+        }
+    }
+
+    return IsUriValid(url.path, "/@:", true);
+}
+
+std::string WorkerHostKey(const std::string& location, const std::string& udn)
+{
+    URLView url;
+    char scratch[256];
+    return ParseUrlView(location, url, scratch) && !url.host.empty() ? std::string(url.host) : udn;
+}
+
+bool ResolveUrl(std::string_view base, std::string_view relative, std::string& out)
+{
+    URLView reference;
+    SplitReference(relative, reference);
+    out.clear();
+    out.reserve(base.size() + relative.size());
+
+    std::string_view query = reference.query;
+    bool hasQuery = reference.hasQuery;
+    if (!reference.scheme.empty())
+    {
+        out.append(reference.scheme).push_back(':');
+        if (reference.hasAuthority)
+            out.append("//").append(reference.authority);
+        AppendPath(out, {}, reference.path);
+    }
+    else
+    {
+        URLView target;
+        SplitReference(base, target);
+        if (target.scheme.empty())
+            return false;
+
+        out.append(target.scheme).push_back(':');
+        if (reference.hasAuthority)
+        {
+            out.append("//").append(reference.authority);
+            AppendPath(out, {}, reference.path);
+        }
+        else
+        {
+            if (target.hasAuthority)
+                out.append("//").append(target.authority);
+            if (reference.path.empty())
+            {
+                out.append(target.path);
+                if (!hasQuery)
+                {
+                    query = target.query;
+                    hasQuery = target.hasQuery;
+                }
+            }
+            else if (reference.path.starts_with('/'))
+                AppendPath(out, {}, reference.path);
+            else if (target.hasAuthority && target.path.empty())
+                AppendPath(out, "/", reference.path);
+            else
+                AppendPath(out, target.path.substr(0, target.path.rfind('/') + 1), reference.path);
+        }
+    }
+
+    if (hasQuery)
+        out.append("?").append(query);
+    if (reference.hasFragment)
+        out.append("#").append(reference.fragment);
+    return true;
 }
\ No newline at end of file
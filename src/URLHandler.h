@@ -1,5 +1,7 @@
 #pragma once
+#include <span>
 #include <string>
+#include <string_view>
 
 #include "ixml.h"
 
@@ -15,10 +17,37 @@ struct URLInfo
     char* buffer = nullptr; /* to be freed */
 };
 
+/*
+ * URL components, viewing the parsed string. Only a percent-encoded host is decoded,
+ * into the scratch buffer given to ParseUrlView. Other components are left encoded,
+ * non-ASCII characters included.
+ */
+struct URLView
+{
+    std::string_view scheme;
+    std::string_view authority;
+    std::string_view userInfo;
+    std::string_view host;      // Without the brackets of an IPv6 literal
+    unsigned int port = 0;      // 0 when not given
+    std::string_view path;
+    std::string_view query;
+    std::string_view fragment;
+    bool hasAuthority = false;
+    bool hasQuery = false;
+    bool hasFragment = false;
+};
+
 std::string ReplaceAll(const char* src, int srcLen, const char* old_value, const char* new_value);
 std::string ConvertHTMLtoXML(const char* src);
+size_t ConvertHTMLtoXML(char* buffer, size_t length); // In place, returns the new length
 std::string GetIconURL(IXML_Element* device, const char* baseURL);
 char* iri2uri(const char* iri);
 char* DecodeUri(char* str);
 bool IsUriValidate(const char* str, const char* extras);
-int ParseUrl(URLInfo* url, const char* str);
\ No newline at end of file
+int ParseUrl(URLInfo* url, const char* str);
+// Doesn't allocate, accepts and rejects what ParseUrl does.
+bool ParseUrlView(std::string_view str, URLView& url, std::span<char> scratch);
+// Host of location, the key worker pools spread a server's jobs by. udn stands in when there is none.
+std::string WorkerHostKey(const std::string& location, const std::string& udn);
+// RFC 3986 reference resolution of relative against the absolute base, into out.
+bool ResolveUrl(std::string_view base, std::string_view relative, std::string& out);
\ No newline at end of file
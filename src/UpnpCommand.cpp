@@ -1,8 +1,16 @@
+#include <algorithm>
+#include <functional>
+#include <mutex>
+#include <numeric>
+#include <unordered_map>
 #include <variant>
 
 #include "DLNAModule.h"
 #include "UpnpCommand.h"
-#include "base64.h"
+#include "ActionEnvelope.h"
+#include "Base64Simd.h"
+#include "DIDLLiteReader.h"
+#include "ResponseNormalizer.h"
 
 #include "rapidjson/document.h"
 #include "rapidjson/stringbuffer.h"
@@ -14,60 +22,144 @@
 #include "logger.h"
 #include "URLHandler.h"
 
+/*
+ * Keys of the item objects Unity receives, in the order they are written, with the
+ * ContentDirectory property a Browse Filter must name for the field to be returned
+ */
+static constexpr struct UnityField
+{
+    const char* key;
+    std::string_view ItemView::* member; // nullptr for the media type
+    const char* property;
+} UnityFields[] = {
+    { "objid", &ItemView::objectID, nullptr },
+    { "filename", &ItemView::filename, nullptr },
+    { "url", &ItemView::url, nullptr },
+    { "type", nullptr, nullptr },
+    { "date", &ItemView::date, "dc:date" },
+    { "duration", &ItemView::duration, "res@duration" },
+    { "size", &ItemView::size, "res@size" },
+    { "resolution", &ItemView::resolution, "res@resolution" },
+    { "subtitle", &ItemView::subtitle, "res@pv:subtitleFileUri,sec:CaptionInfo,sec:CaptionInfoEx,pv:subtitlefile" },
+    { "audio", &ItemView::audio_url, nullptr },
+    { "genre", &ItemView::genre, "upnp:genre" },
+    { "album", &ItemView::album, "upnp:album" },
+    { "albumArtist", &ItemView::album_artist, "upnp:albumArtist" },
+    { "albumArtURI", &ItemView::albumArtURI, "upnp:albumArtURI" },
+    { "originalTrackNumber", &ItemView::orig_track_nb, "upnp:originalTrackNumber" },
+};
+
+void WriteItem(rapidjson::Writer<rapidjson::StringBuffer>& writer, const ItemView& it, FieldMask fields)
+{
+    writer.StartObject();
+    for (const UnityField& field : UnityFields)
+    {
+        if (!field.member)
+        {
+            writer.Key(field.key);
+            writer.Int(it.media_type);
+        }
+        else if (fields & FieldBit(field.member))
+        {
+            const std::string_view value = it.*field.member;
+            writer.Key(field.key);
+            writer.String(value.data() ? value.data() : "", static_cast<rapidjson::SizeType>(value.size()));
+        }
+    }
+    writer.EndObject();
+}
+
+/*
+ * The Browse Filter asking for fields only. @id, dc:title and upnp:class are always
+ * returned, res is always asked for since both parsers drop items without one.
+ */
+static std::string BrowseFilter(FieldMask fields)
+{
+    if ((fields & AllFields) == AllFields)
+        return "*";
+    std::string filter = "res";
+    for (const UnityField& field : UnityFields)
+    {
+        if (field.property && (fields & FieldBit(field.member)))
+            filter.append(",").append(field.property);
+    }
+    return filter;
+}
+
 template <typename T>
-const std::string CreateResponse(const std::string& version, const std::string& method, rapidjson::Value& request, const T& result, int status)
-    requires std::is_same_v<T, std::vector<Item>> || std::is_same_v<T, std::string> || std::is_same_v<T, std::nullptr_t>
+static void WriteResults(rapidjson::StringBuffer& buffer, rapidjson::Writer<rapidjson::StringBuffer>& writer, const T& result, FieldMask fields)
 {
-    using namespace rapidjson;
-    rapidjson::Document response(kObjectType);
-    auto& allocator = response.GetAllocator();
-    response.AddMember("version", Value().SetString(version.data(), version.length(), allocator), allocator);
-    response.AddMember("method", Value().SetString(method.data(), method.length(), allocator), allocator);
-    response.AddMember("request_body", request.Move(), allocator);
-
-    if constexpr (std::is_same_v<T, std::vector<Item>>)
-    {
-        rapidjson::Value resultList(kArrayType);
-        for (const Item& it : result)
-            resultList.PushBack(Value().SetObject()
-                .AddMember("objid", Value().SetString(it.objectID.data(), it.objectID.size(), allocator), allocator)
-                .AddMember("filename", Value().SetString(it.filename.data(), it.filename.size(), allocator), allocator)
-                .AddMember("url", Value().SetString(it.url.data(), it.url.size(), allocator), allocator)
-                .AddMember("type", it.media_type, allocator)
-                .AddMember("date", Value().SetString(it.date.data(), it.date.size(), allocator), allocator)
-                .AddMember("duration", Value().SetString(it.duration.data(), it.duration.size(), allocator), allocator)
-                .AddMember("size", Value().SetString(it.size.data(), it.size.size(), allocator), allocator)
-                .AddMember("resolution", Value().SetString(it.resolution.data(), it.resolution.size(), allocator), allocator)
-                .AddMember("subtitle", Value().SetString(it.subtitle.data(), it.subtitle.size(), allocator), allocator)
-                .AddMember("audio", Value().SetString(it.audio_url.data(), it.audio_url.size(), allocator), allocator)
-                .AddMember("genre", Value().SetString(it.genre.data(), it.genre.size(), allocator), allocator)
-                .AddMember("album", Value().SetString(it.album.data(), it.album.size(), allocator), allocator)
-                .AddMember("albumArtist", Value().SetString(it.album_artist.data(), it.album_artist.size(), allocator), allocator)
-                .AddMember("albumArtURI", Value().SetString(it.albumArtURI.data(), it.albumArtURI.size(), allocator), allocator)
-                .AddMember("originalTrackNumber", Value().SetString(it.orig_track_nb.data(), it.orig_track_nb.size(), allocator), allocator)
-                , allocator);
-
-        response.AddMember("results", resultList, allocator);
+    if constexpr (std::is_same_v<T, BrowseResult>)
+    {
+        writer.StartArray();
+        for (size_t i = 0; i < result.size(); i++)
+            WriteItem(writer, result[i], fields);
+        writer.EndArray();
     }
     else if constexpr (std::is_same_v<T, std::string>) {
-        const std::string& b64result = base64_encode(result, false);
-        response.AddMember("results", Value().SetArray().PushBack(Value().SetString(b64result.c_str(), b64result.length(), allocator), allocator), allocator);
+        /* Base64 never needs escaping, it's encoded straight into the response between quotes */
+        const size_t length = Base64EncodedLength(result.size());
+        writer.StartArray();
+        writer.RawValue("", 0, rapidjson::kStringType); // Only for the writer's separators and nesting
+        char* out = buffer.Push(length + 2);
+        out[0] = '"';
+        Base64Encode(reinterpret_cast<const unsigned char*>(result.data()), result.size(), out + 1);
+        out[length + 1] = '"';
+        writer.EndArray();
     }
     else if constexpr (std::is_same_v<T, std::nullptr_t>)
-        response.AddMember("results", "", allocator);
+        writer.String("");
     else
         static_assert(always_false<T>, "Unsupported type");
+}
 
-    response.AddMember("status", status, allocator);
-
-    rapidjson::StringBuffer buffer;
+/*
+ * Serializes the response straight into buffer, which callers keep around between
+ * responses so the memory is reused, and hand buffer.GetString() to Unity
+ */
+template <typename T>
+void CreateResponse(rapidjson::StringBuffer& buffer, std::string_view version, std::string_view method, const rapidjson::Value& request, const T& result, int status, const BrowsePage* page = nullptr)
+    requires std::is_same_v<T, BrowseResult> || std::is_same_v<T, std::string> || std::is_same_v<T, std::nullptr_t> || std::is_same_v<T, CachedPage>
+{
+    buffer.Clear();
     rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
-    response.Accept(writer);
+    writer.StartObject();
+    writer.Key("version");
+    writer.String(version.data(), static_cast<rapidjson::SizeType>(version.size()));
+    writer.Key("method");
+    writer.String(method.data(), static_cast<rapidjson::SizeType>(method.size()));
+    writer.Key("request_body");
+    request.Accept(writer);
+    if (page && page->request)
+    {
+        writer.Key("requestId");
+        writer.Uint(page->request->Id());
+    }
+
+    writer.Key("results");
+    if constexpr (std::is_same_v<T, CachedPage>)
+        writer.RawValue(result.results.data(), result.results.size(), rapidjson::kArrayType);
+    else
+        WriteResults(buffer, writer, result, page ? page->fields : AllFields);
 
-    return buffer.GetString();
+    writer.Key("status");
+    writer.Int(status);
+
+    if (page && page->requestedCount)
+    {
+        writer.Key("startingIndex");
+        writer.Uint(page->startingIndex);
+        writer.Key("numberReturned");
+        writer.Uint(page->numberReturned);
+        writer.Key("totalMatches");
+        writer.Uint(page->totalMatches);
+        writer.Key("complete");
+        writer.Bool(page->complete);
+    }
+    writer.EndObject();
 }
 
-std::variant<std::string, int> Resolve(IXML_Document* p_response)
+std::variant<std::string, int> ResolveByReparsing(IXML_Document* p_response)
 {
     char* rawHTML = ixmlDocumenttoString(p_response);
     if (rawHTML == nullptr)
@@ -98,8 +190,146 @@ std::variant<std::string, int> Resolve(IXML_Document* p_response)
     return result;
 }
 
-std::variant<std::vector<Item>, int> Resolve2(IXML_Document* p_response)
+std::variant<std::string, int> Resolve(IXML_Document* p_response)
+{
+    std::string result;
+    if (NormalizeResponse(p_response, result))
+        return result;
+
+    Log(LogLevel::Debug, "Browse response needs ixml to be normalized");
+    return ResolveByReparsing(p_response);
+}
+
+ItemView BrowseResult::operator[](size_t object) const
+{
+    ItemView view;
+    view.media_type = Type(object);
+    for (size_t field = 0; field < ItemFieldCount; field++)
+        view.*ItemFields[field] = Field(object, field);
+    return view;
+}
+
+void BrowseResult::Reserve(size_t objects)
+{
+    types.reserve(objects);
+    for (std::vector<StringRef>& column : columns)
+        column.reserve(objects);
+}
+
+char* BrowseResult::Adopt(std::string_view didl)
+{
+    text.assign(didl.begin(), didl.end());
+    text.push_back('\0');
+    return text.data();
+}
+
+BrowseResult::StringRef BrowseResult::Store(std::string_view value)
+{
+    if (value.empty())
+        return { 0, 0 };
+    StringRef ref{ static_cast<uint32_t>(text.size()), static_cast<uint32_t>(value.size()) };
+    text.insert(text.end(), value.begin(), value.end());
+    return ref;
+}
+
+void BrowseResult::Append(const ItemView& object)
+{
+    StringRef fields[ItemFieldCount];
+    auto inText = [this](std::string_view value)
+    {
+        const std::less_equal<const char*> notAfter;
+        return notAfter(text.data(), value.data()) && notAfter(value.data() + value.size(), text.data() + text.size());
+    };
+    bool copy[ItemFieldCount] = {};
+    for (size_t field = 0; field < ItemFieldCount; field++)
+    {
+        std::string_view value = object.*ItemFields[field];
+        if (value.empty() || inText(value))
+            fields[field] = { value.empty() ? 0 : static_cast<uint32_t>(value.data() - text.data()), static_cast<uint32_t>(value.size()) };
+        else
+            copy[field] = true;
+    }
+    /* Only once every field was located, a copy may move the text */
+    for (size_t field = 0; field < ItemFieldCount; field++)
+    {
+        if (copy[field])
+            fields[field] = Store(object.*ItemFields[field]);
+    }
+    Append(object.media_type, fields);
+}
+
+void BrowseResult::Append(MediaType::MEDIA_TYPE type, const StringRef (&fields)[ItemFieldCount])
+{
+    types.push_back(static_cast<uint8_t>(type));
+    for (size_t field = 0; field < ItemFieldCount; field++)
+        columns[field].push_back(fields[field]);
+}
+
+void BrowseResult::ContainersFirst()
+{
+    auto isContainer = [this](size_t object) { return types[object] == MediaType::CONTAINER; };
+    std::vector<size_t> order(types.size());
+    std::iota(order.begin(), order.end(), size_t(0));
+    if (std::is_partitioned(order.begin(), order.end(), isContainer))
+        return;
+
+    std::stable_partition(order.begin(), order.end(), isContainer);
+    std::vector<StringRef> reordered(order.size());
+    for (std::vector<StringRef>& column : columns)
+    {
+        for (size_t i = 0; i < order.size(); i++)
+            reordered[i] = column[order[i]];
+        column.swap(reordered);
+    }
+    std::vector<uint8_t> reorderedTypes(order.size());
+    for (size_t i = 0; i < order.size(); i++)
+        reorderedTypes[i] = types[order[i]];
+    types.swap(reorderedTypes);
+}
+
+void BrowseResult::Clear()
+{
+    text.clear();
+    types.clear();
+    for (std::vector<StringRef>& column : columns)
+        column.clear();
+}
+
+/*
+ * Reads the DIDL-Lite Result of a browse response in a single pass, returns false if it
+ * can't, containers are listed before items like the DOM walk in Resolve2 does
+ */
+static bool ReadBrowseResult(IXML_Document* p_response, BrowseResult& result, FieldMask fields)
+{
+    const char* psz_raw_didl = ixmlElement_getFirstChildElementValue((IXML_Element*)p_response, "Result");
+    if (!psz_raw_didl)
+        return false;
+
+    const size_t length = strlen(psz_raw_didl);
+    DIDLLiteReader reader(result.Adopt(std::string_view(psz_raw_didl, length)), length, fields);
+    ItemView view;
+    bool isContainer = false;
+    while (reader.Next(view, isContainer))
+        result.Append(view);
+
+    if (reader.Failed())
+        return false;
+
+    result.ContainersFirst();
+    return true;
+}
+
+std::variant<BrowseResult, int> Resolve2(IXML_Document* p_response, FieldMask fields)
 {
+    BrowseResult result;
+    const char* psz_returned = ixmlElement_getFirstChildElementValue((IXML_Element*)p_response, "NumberReturned");
+    if (psz_returned)
+        result.Reserve(std::min(strtoul(psz_returned, nullptr, 10), 10000ul));
+    if (ReadBrowseResult(p_response, result, fields))
+        return result;
+
+    Log(LogLevel::Warning, "DIDL-Lite reader failed, falling back to the DOM parser");
+    result.Clear();
     IXML_Document* p_result = parseBrowseResult(p_response);
     if (!p_result)
     {
@@ -107,16 +337,31 @@ std::variant<std::vector<Item>, int> Resolve2(IXML_Document* p_response)
         return -1;
     }
 
-    std::vector<Item> itemVector;
+    /* Values shared by the page, genre, album or artist, are copied once. Keys point into the DOM */
+    std::unordered_map<std::string_view, BrowseResult::StringRef> interned;
+    auto append = [&](const ItemView& item)
+    {
+        BrowseResult::StringRef fields[ItemFieldCount];
+        for (size_t field = 0; field < ItemFieldCount; field++)
+        {
+            std::string_view value = item.*ItemFields[field];
+            auto [known, added] = interned.try_emplace(value);
+            if (added)
+                known->second = result.Store(value);
+            fields[field] = known->second;
+        }
+        result.Append(item.media_type, fields);
+    };
+
     IXML_NodeList* containerNodeList = ixmlDocument_getElementsByTagName(p_result, "container");
     if (containerNodeList)
     {
         for (unsigned int i = 0; i < ixmlNodeList_length(containerNodeList); i++)
         {
             auto itemElement = (IXML_Element*)ixmlNodeList_item(containerNodeList, i);
-            auto&& opt = TryParseItem(itemElement, true);
+            auto&& opt = TryParseItem(itemElement, true, fields);
             if (opt)
-                itemVector.push_back(std::move(opt.value()));
+                append(opt.value());
         }
         ixmlNodeList_free(containerNodeList);
     }
@@ -127,73 +372,302 @@ std::variant<std::vector<Item>, int> Resolve2(IXML_Document* p_response)
         for (unsigned int i = 0; i < ixmlNodeList_length(itemNodeList); i++)
         {
             auto itemElement = (IXML_Element*)ixmlNodeList_item(itemNodeList, i);
-            auto&& opt = TryParseItem(itemElement, false);
+            auto&& opt = TryParseItem(itemElement, false, fields);
             if (opt)
-                itemVector.push_back(std::move(opt.value()));
+                append(opt.value());
         }
         ixmlNodeList_free(itemNodeList);
     }
     ixmlDocument_free(p_result);
-    return itemVector;
+    return result;
 }
 
-static int UpnpSendActionCallBack(Upnp_EventType eventType, const void* p_event, void* p_cookie)
+static const size_t MAX_ACTION_RESPONSE_LENGTH = 64 * 1024 * 1024;
+static const unsigned int BROWSE_TIMEOUT = 60000; /* ms, for a whole folder unless the request gives its own */
+static const char* SOAP_ENVELOPE_NAMESPACE = "http://schemas.xmlsoap.org/soap/envelope/";
+
+/* The action response element becomes the root of its own document, the way pupnp hands it over */
+static int ParseActionResponse(const HttpConnectionPool::Response& reply, IXML_Document** response)
 {
-    if (eventType != UPNP_CONTROL_ACTION_COMPLETE)
-        return -1;
+    IXML_Document* envelope = nullptr;
+    if (reply.body.empty() || ixmlParseBufferEx(reply.body.c_str(), &envelope) != IXML_SUCCESS)
+        return UPNP_E_BAD_RESPONSE;
+
+    int res = UPNP_E_BAD_RESPONSE;
+    IXML_NodeList* bodies = ixmlDocument_getElementsByTagNameNS(envelope, SOAP_ENVELOPE_NAMESPACE, "Body");
+    IXML_Node* content = bodies ? ixmlNode_getFirstChild(ixmlNodeList_item(bodies, 0)) : nullptr;
+    while (content && ixmlNode_getNodeType(content) != eELEMENT_NODE)
+        content = ixmlNode_getNextSibling(content);
+    ixmlNodeList_free(bodies);
+
+    if (content && reply.status == 200)
+    {
+        IXML_Document* doc = nullptr;
+        IXML_Node* imported = nullptr;
+        if (ixmlDocument_createDocumentEx(&doc) == IXML_SUCCESS && ixmlDocument_importNode(doc, content, TRUE, &imported) == IXML_SUCCESS)
+        {
+            if (ixmlNode_appendChild(reinterpret_cast<IXML_Node*>(doc), imported) == IXML_SUCCESS)
+            {
+                *response = doc;
+                doc = nullptr;
+                res = UPNP_E_SUCCESS;
+            }
+            else
+                ixmlNode_free(imported);
+        }
+        ixmlDocument_free(doc);
+    }
+    else if (content && reply.status == 500)
+    {
+        /* SOAP fault, its UPnP error code is returned as pupnp does */
+        const char* errorCode = ixmlElement_getFirstChildElementValue(reinterpret_cast<IXML_Element*>(content), "errorCode");
+        const char* errorDescription = ixmlElement_getFirstChildElementValue(reinterpret_cast<IXML_Element*>(content), "errorDescription");
+        if (errorCode && atoi(errorCode) > 0)
+            res = atoi(errorCode);
+        Log(LogLevel::Warning, "Action failed with UPnP error %s: %s", errorCode ? errorCode : "?", errorDescription ? errorDescription : "");
+    }
+    else
+        Log(LogLevel::Warning, "Unexpected action response, http status %d", reply.status);
+    ixmlDocument_free(envelope);
+    return res;
+}
+
+extern const char* CONTENT_DIRECTORY_SERVICE_TYPE;
+
+/* The actions sent for every page, written without building their XML */
+static const ActionEnvelope BrowseEnvelope(CONTENT_DIRECTORY_SERVICE_TYPE, "Browse",
+    { "ObjectID", "BrowseFlag", "Filter", "StartingIndex", "RequestedCount", "SortCriteria" });
+static const ActionEnvelope SearchEnvelope(CONTENT_DIRECTORY_SERVICE_TYPE, "Search",
+    { "ContainerID", "SearchCriteria", "Filter", "StartingIndex", "RequestedCount", "SortCriteria" });
+
+static int AbandonedStatus(const RequestEngine::Request& request)
+{
+    return request.Cancelled() ? UPNP_E_CANCELED : UPNP_E_TIMEDOUT;
+}
+
+/* Posts a ContentDirectory action over the kept connection to its server, what an abandoned request gets back is not parsed */
+static int SendAction(const std::string& controlUrl, const ActionEnvelope& action, std::string_view body, IXML_Document** response, const RequestEngine::Request* request)
+{
+    if (request && request->Abandoned())
+        return AbandonedStatus(*request);
+
+    HttpConnectionPool::Response reply;
+    const std::chrono::milliseconds timeout = request ? request->Remaining(ActionTimeout) : ActionTimeout;
+    int res = DLNAModule::GetInstance().connections.Request("POST", controlUrl, action.Headers(), body, timeout, MAX_ACTION_RESPONSE_LENGTH, reply);
+    if (request && request->Abandoned())
+        return AbandonedStatus(*request);
+    if (res != UPNP_E_SUCCESS)
+    {
+        Log(LogLevel::Warning, "%s action to %s failed: %s", action.Action(), controlUrl.c_str(), UpnpGetErrorMessage(res));
+        return res;
+    }
+    return ParseActionResponse(reply, response);
+}
+
+static std::string CacheKey(Cookie& cookie)
+{
+    const BrowsePage& page = std::get<BrowsePage>(cookie);
+    return BrowseCache::Key(page.udn, page.objectID, page.sortCriteria, page.startingIndex,
+        page.requestedCount ? page.requestedCount : 10000, std::get<rapidjson::Document>(cookie)["version"].GetString(), page.fields);
+}
 
-    CHECK_VARIABLE(p_cookie, "%p");
-    auto& cookie = *static_cast<Cookie*>(p_cookie);
+/*
+ * Browse requests in flight by request text. An identical request arriving before the
+ * first response of the one in flight joins it instead of sending its own actions, it
+ * gets the same responses and request ID. Once a response went out the flight is
+ * closed, later requests would have missed it. A cancelled request is not joined.
+ */
+struct Flight
+{
+    std::weak_ptr<const RequestEngine::Request> request;
+    std::vector<BrowseDLNAFolderCallback> joined;
+};
+static std::mutex flightsMutex;
+static std::unordered_map<std::string, Flight> flights;
 
+static void CloseFlight(BrowsePage& page)
+{
+    if (page.flight.empty())
+        return;
+    std::lock_guard<std::mutex> lock(flightsMutex);
+    auto flight = flights.find(page.flight);
+    if (flight != flights.end() && flight->second.request.lock() == page.request)
+    {
+        page.joined = std::move(flight->second.joined);
+        flights.erase(flight);
+    }
+    page.flight.clear();
+}
+
+bool IsLastPage(unsigned int start, unsigned int returned, unsigned int total, unsigned int requested)
+{
+    return returned == 0 || (total ? start + returned >= total : returned < requested);
+}
+
+static void UpdateCompletion(BrowsePage& page)
+{
+    if (page.requestedCount)
+        page.complete = IsLastPage(page.startingIndex, page.numberReturned, page.totalMatches, page.requestedCount);
+}
+
+/* Hands one page to Unity, returns true when the folder has more pages to fetch */
+template <typename T>
+static bool DeliverPage(Cookie& cookie, const T& result, int status)
+{
 #if __clang__ // lambda can capture struct-binding since C++20, supported by MSVC and GCC but not Clang(<=15.0)
     rapidjson::Document& request = std::get<0>(cookie);
     BrowseDLNAFolderCallback OnBrowseResultCallback = std::get<BrowseDLNAFolderCallback>(cookie);
+    BrowsePage& page = std::get<BrowsePage>(cookie);
 #else
-    auto& [request, OnBrowseResultCallback] = cookie;
+    auto& [request, OnBrowseResultCallback, page] = cookie;
 #endif
+    if (status)
+        page.complete = true;
+    CloseFlight(page);
+    if (page.request && page.request->Cancelled())
+    {
+        page.complete = true;
+        return false;
+    }
+
+    /* Browse responses are handled on the action worker threads, every thread keeps its buffer */
+    thread_local rapidjson::StringBuffer response;
+    const std::string_view version = request["version"].GetString();
+    if (version == "1.0" || version == "2.0")
+        CreateResponse(response, version, "DLNABrowseResponse", request, result, status, &page);
+    else
+        response.Clear();
 
-    IXML_Document* p_response = UpnpActionComplete_get_ActionResult((UpnpActionComplete*)p_event);
-    if (!p_response)
+    if (OnBrowseResultCallback)
     {
-        Log(LogLevel::Error, "No response from browse() action");
-        return -1;
+        OnBrowseResultCallback(response.GetString());
     }
-    Log(LogLevel::Debug, "%s", ixmlPrintDocument(p_response));
+    for (BrowseDLNAFolderCallback joined : page.joined)
+        joined(response.GetString());
+    return !page.complete;
+}
 
-    std::string response;
-    if (strcmp(request["version"].GetString(), "1.0") == 0)
+/* Takes the response of a Browse sent for the cookie, and the cookie itself once the folder is done */
+static void OnBrowseActionComplete(Cookie* p_cookie, IXML_Document* p_response, int error)
+{
+    auto& cookie = *p_cookie;
+    rapidjson::Document& request = std::get<rapidjson::Document>(cookie);
+    BrowsePage& page = std::get<BrowsePage>(cookie);
+
+    if (error != UPNP_E_SUCCESS || !p_response)
+    {
+        /* Still answered, requests that joined this one wait for it too */
+        if (error == UPNP_E_CANCELED)
+            Log(LogLevel::Debug, "Browse request %u cancelled", page.request->Id());
+        else
+            Log(LogLevel::Error, "No response from browse() action: %d", error);
+        ixmlDocument_free(p_response);
+        page.numberReturned = 0;
+        DeliverPage(cookie, nullptr, error != UPNP_E_SUCCESS ? error : UPNP_E_BAD_RESPONSE);
+        delete (&cookie);
+        return;
+    }
+    if (IsLogEnabled(LogLevel::Debug))
     {
-        std::visit([&](auto&& var) {
-            using T = std::decay_t<decltype(var)>;
-        if constexpr (std::is_same_v<T, std::string>)
+        if (DOMString printed = ixmlPrintDocument(p_response))
         {
-            response = CreateResponse("1.0", "DLNABrowseResponse", request, var, 0);
+            Log(LogLevel::Debug, "%s", printed);
+            ixmlFreeDOMString(printed);
         }
-        else if constexpr (std::is_same_v<T, int>)
-            response = CreateResponse("1.0", "DLNABrowseResponse", request, nullptr, var);
-        else static_assert(always_false<T>, "Unsupported type");
-            }, Resolve(p_response));
     }
-    else if (strcmp(request["version"].GetString(), "2.0") == 0)
+
+    const char* numberReturned = ixmlElement_getFirstChildElementValue((IXML_Element*)p_response, "NumberReturned");
+    const char* totalMatches = ixmlElement_getFirstChildElementValue((IXML_Element*)p_response, "TotalMatches");
+    page.numberReturned = numberReturned ? strtoul(numberReturned, nullptr, 10) : 0;
+    page.totalMatches = totalMatches ? strtoul(totalMatches, nullptr, 10) : 0;
+    UpdateCompletion(page);
+
+    auto deliver = [&](auto&& var) -> bool {
+        using T = std::decay_t<decltype(var)>;
+        if constexpr (std::is_same_v<T, int>)
+            return DeliverPage(cookie, nullptr, var);
+        else
+        {
+            if (!page.cacheGeneration)
+                return DeliverPage(cookie, var, 0);
+
+            /* Serialized once, for this response and for the next time the page is asked for */
+            thread_local rapidjson::StringBuffer results;
+            results.Clear();
+            rapidjson::Writer<rapidjson::StringBuffer> writer(results);
+            WriteResults(results, writer, var, page.fields);
+            auto cached = std::make_shared<CachedPage>();
+            cached->results.assign(results.GetString(), results.GetSize());
+            cached->numberReturned = page.numberReturned;
+            cached->totalMatches = page.totalMatches;
+            DLNAModule::GetInstance().browseCache.Store(CacheKey(cookie), page.udn, page.objectID, page.cacheGeneration, cached);
+            return DeliverPage(cookie, *cached, 0);
+        }
+    };
+
+    bool more;
+    const std::string_view version = request["version"].GetString();
+    if (version == "1.0")
+        more = std::visit(deliver, Resolve(p_response));
+    else if (version == "2.0")
+        more = std::visit(deliver, Resolve2(p_response, page.fields));
+    else
+        more = DeliverPage(cookie, nullptr, 0);
+    ixmlDocument_free(p_response);
+
+    if (more)
     {
-        std::visit([&](auto&& var) {
-            using T = std::decay_t<decltype(var)>;
-        if constexpr (std::is_same_v<T, std::vector<Item>>)
-            response = CreateResponse("2.0", "DLNABrowseResponse", request, var, 0);
-        else if constexpr (std::is_same_v<T, int>)
-            response = CreateResponse("2.0", "DLNABrowseResponse", request, nullptr, var);
-        else static_assert(always_false<T>, "Unsupported type");
-            }, Resolve2(p_response));
+        page.startingIndex += page.numberReturned;
+        int res = BrowseNextPage(&cookie);
+        if (res == UPNP_E_SUCCESS)
+            return;
+
+        /* The next page could not be requested, still let the caller know this folder is done */
+        page.numberReturned = 0;
+        DeliverPage(cookie, nullptr, res);
     }
 
-    ixmlDocument_free(p_response);
     delete (&cookie);
+}
 
-    if (OnBrowseResultCallback)
+int BrowseNextPage(Cookie* p_cookie)
+{
+    BrowsePage& page = std::get<BrowsePage>(*p_cookie);
+    BrowseCache& cache = DLNAModule::GetInstance().browseCache;
+
+    /* Pages still cached are answered right away, the way the action callback would */
+    bool delivered = false;
+    for (;;)
     {
-        OnBrowseResultCallback(response.data());
+        page.cacheGeneration = cache.Generation(page.udn);
+        std::shared_ptr<const CachedPage> cached = page.cacheGeneration ? cache.Find(CacheKey(*p_cookie)) : nullptr;
+        if (!cached)
+            break;
+
+        page.numberReturned = cached->numberReturned;
+        page.totalMatches = cached->totalMatches;
+        UpdateCompletion(page);
+        delivered = true;
+        if (!DeliverPage(*p_cookie, *cached, 0))
+        {
+            delete p_cookie;
+            return UPNP_E_SUCCESS;
+        }
+        page.startingIndex += page.numberReturned;
     }
-    return 0;
+
+    const std::string startingIndex = std::to_string(page.startingIndex);
+    const std::string requestedCount = page.requestedCount ? std::to_string(page.requestedCount) : "10000";
+    const std::string filter = BrowseFilter(page.fields);
+    int res = BrowseAction(page.objectID.c_str(), "BrowseDirectChildren", filter.c_str(), startingIndex.c_str(), requestedCount.c_str(), page.sortCriteria.c_str(), page.controlUrl.c_str(), p_cookie);
+    if (res == UPNP_E_SUCCESS || !delivered)
+        return res;
+
+    /* Part of the folder went to Unity already, finish it like a failed follow-up page */
+    page.numberReturned = 0;
+    DeliverPage(*p_cookie, nullptr, res);
+    delete p_cookie;
+    return UPNP_E_SUCCESS;
 }
 
 int BrowseAction(const char* objectID,
@@ -205,74 +679,82 @@ int BrowseAction(const char* objectID,
     const char* controlUrl,
     Cookie* p_cookie)
 {
-    extern const char* CONTENT_DIRECTORY_SERVICE_TYPE;
-    IXML_Document* actionDoc = nullptr;
-    IXML_Document* browseResultXMLDocument = nullptr;
-
-    int res = UpnpAddToAction(&actionDoc, "Browse",
-        CONTENT_DIRECTORY_SERVICE_TYPE, "ObjectID", objectID);
-
-    if (res != UPNP_E_SUCCESS)
+    std::string envelope;
+    BrowseEnvelope.Write(envelope, { objectID, flag, filter, startingIndex, requestCount, sortCriteria });
+
+    /* Run by the action workers instead of pupnp's thread pool, so the connection to the server is kept */
+    std::string host = WorkerHostKey(controlUrl, std::get<BrowsePage>(*p_cookie).udn);
+    /* Not the cookie address, the job frees the cookie before the pool forgets its key and a new one may reuse it */
+    std::string key = "browse/" + std::to_string(std::get<BrowsePage>(*p_cookie).request->Id()) + '/' + startingIndex;
+    /* A job dropped before it ran, the workers stopping, still frees the cookie and so finishes the request */
+    auto owner = std::make_shared<std::unique_ptr<Cookie>>(p_cookie);
+    bool submitted = DLNAModule::GetInstance().actionWorkers.Submit(key, host, [controlUrl = std::string(controlUrl), envelope = std::move(envelope), owner]
+        {
+            Cookie* p_cookie = owner->release();
+            IXML_Document* response = nullptr;
+            int res = SendAction(controlUrl, BrowseEnvelope, envelope, &response, std::get<BrowsePage>(*p_cookie).request.get());
+            OnBrowseActionComplete(p_cookie, response, res);
+        });
+    if (!submitted)
     {
-        goto browseActionCleanup;
+        owner->release();
+        Log(LogLevel::Error, "Browse action for %s not queued", controlUrl);
+        return UPNP_E_OUTOF_MEMORY;
     }
+    return UPNP_E_SUCCESS;
+}
 
-    res = UpnpAddToAction(&actionDoc, "Browse",
-        CONTENT_DIRECTORY_SERVICE_TYPE, "BrowseFlag", flag);
-
-    if (res != UPNP_E_SUCCESS)
+int SendContentDirectoryAction(const std::string& controlUrl, const char* action, std::initializer_list<std::pair<const char*, const char*>> arguments, IXML_Document** response,
+    const RequestEngine::Request* request)
+{
+    *response = nullptr;
+    std::string_view names[8];
+    std::string_view values[std::size(names)];
+    if (arguments.size() > std::size(names))
+        return UPNP_E_INVALID_PARAM;
+    size_t count = 0;
+    for (const auto& [name, value] : arguments)
     {
-        goto browseActionCleanup;
+        names[count] = name;
+        values[count++] = value;
     }
 
-    res = UpnpAddToAction(&actionDoc, "Browse",
-        CONTENT_DIRECTORY_SERVICE_TYPE, "Filter", filter);
-
-    if (res != UPNP_E_SUCCESS)
+    /* Browse and Search come with their precompiled envelope, the other actions are rare enough to make theirs */
+    auto matches = [&](const ActionEnvelope& known)
     {
-        goto browseActionCleanup;
-    }
-
-    res = UpnpAddToAction(&actionDoc, "Browse",
-        CONTENT_DIRECTORY_SERVICE_TYPE, "StartingIndex", startingIndex);
-    if (res != UPNP_E_SUCCESS)
+        return known.Action() == action && std::equal(known.Arguments().begin(), known.Arguments().end(), names, names + count);
+    };
+    std::optional<ActionEnvelope> made;
+    const ActionEnvelope* envelope = matches(BrowseEnvelope) ? &BrowseEnvelope : matches(SearchEnvelope) ? &SearchEnvelope : nullptr;
+    if (!envelope)
+        envelope = &made.emplace(CONTENT_DIRECTORY_SERVICE_TYPE, action, std::span<const std::string_view>(names, count));
+
+    /* Sent from a few long lived threads, every thread keeps its buffer */
+    thread_local std::string body;
+    envelope->Write(body, std::span<const std::string_view>(values, count));
+    int res = SendAction(controlUrl, *envelope, body, response, request);
+    if (res != UPNP_E_SUCCESS && *response)
     {
-        goto browseActionCleanup;
+        ixmlDocument_free(*response);
+        *response = nullptr;
     }
+    return res;
+}
 
-    res = UpnpAddToAction(&actionDoc, "Browse",
-        CONTENT_DIRECTORY_SERVICE_TYPE, "RequestedCount", requestCount);
-
-    if (res != UPNP_E_SUCCESS)
-    {
-        goto browseActionCleanup;
-    }
-
-    res = UpnpAddToAction(&actionDoc, "Browse",
-        CONTENT_DIRECTORY_SERVICE_TYPE, "SortCriteria", sortCriteria);
-
-    if (res != UPNP_E_SUCCESS)
-    {
-        goto browseActionCleanup;
-    }
-
-    res = UpnpSendActionAsync(DLNAModule::GetInstance().handle,
-        controlUrl,
-        CONTENT_DIRECTORY_SERVICE_TYPE,
-        nullptr, /* ignored in SDK, must be NULL */
-        actionDoc,
-        UpnpSendActionCallBack,
-        p_cookie);
-
-    if (res != UPNP_E_SUCCESS)
+bool ContainsIgnoringCase(std::string_view text, std::string_view loweredPattern)
+{
+    auto lower = [](char c) { return c >= 'A' && c <= 'Z' ? static_cast<char>(c - 'A' + 'a') : c; };
+    if (loweredPattern.size() > text.size())
+        return false;
+    for (size_t at = 0; at + loweredPattern.size() <= text.size(); at++)
     {
-        Log(LogLevel::Error, "UpnpSendActionAsync return %s", UpnpGetErrorMessage(res));
-        goto browseActionCleanup;
+        size_t i = 0;
+        while (i < loweredPattern.size() && lower(text[at + i]) == loweredPattern[i])
+            i++;
+        if (i == loweredPattern.size())
+            return true;
     }
-
-browseActionCleanup:
-    ixmlDocument_free(actionDoc);
-    return res;
+    return false;
 }
 
 #if _WIN32
@@ -358,7 +840,7 @@ IXML_Document* parseBrowseResult(IXML_Document* p_doc)
     return (IXML_Document*)p_node;
 }
 
-std::optional<Item> TryParseItem(IXML_Element* itemElement, bool AsDirectory)
+std::optional<ItemView> TryParseItem(IXML_Element* itemElement, bool AsDirectory, FieldMask fields)
 {
     const char* objectID,
         * title,
@@ -377,17 +859,22 @@ std::optional<Item> TryParseItem(IXML_Element* itemElement, bool AsDirectory)
     title = ixmlElement_getFirstChildElementValue(itemElement, "dc:title");
     if (!title)
         return {};
-    const char* psz_subtitles = ixmlElement_getFirstChildElementValue(itemElement, "sec:CaptionInfo");
+    /* Every lookup walks the children of the element, fields not asked for are skipped */
+    auto value = [itemElement, fields](const char* name, std::string_view ItemView::* member) -> const char*
+    {
+        return fields & FieldBit(member) ? ixmlElement_getFirstChildElementValue(itemElement, name) : nullptr;
+    };
+    const char* psz_subtitles = value("sec:CaptionInfo", &ItemView::subtitle);
     if (!psz_subtitles &&
-        !(psz_subtitles = ixmlElement_getFirstChildElementValue(itemElement, "sec:CaptionInfoEx")))
-        psz_subtitles = ixmlElement_getFirstChildElementValue(itemElement, "pv:subtitlefile");
-    psz_artist = ixmlElement_getFirstChildElementValue(itemElement, "upnp:artist");
-    psz_genre = ixmlElement_getFirstChildElementValue(itemElement, "upnp:genre");
-    psz_album = ixmlElement_getFirstChildElementValue(itemElement, "upnp:album");
-    psz_date = ixmlElement_getFirstChildElementValue(itemElement, "dc:date");
-    psz_orig_track_nb = ixmlElement_getFirstChildElementValue(itemElement, "upnp:originalTrackNumber");
-    psz_album_artist = ixmlElement_getFirstChildElementValue(itemElement, "upnp:albumArtist");
-    psz_albumArtURI = ixmlElement_getFirstChildElementValue(itemElement, "upnp:albumArtURI");
+        !(psz_subtitles = value("sec:CaptionInfoEx", &ItemView::subtitle)))
+        psz_subtitles = value("pv:subtitlefile", &ItemView::subtitle);
+    psz_artist = value("upnp:artist", &ItemView::artist);
+    psz_genre = value("upnp:genre", &ItemView::genre);
+    psz_album = value("upnp:album", &ItemView::album);
+    psz_date = value("dc:date", &ItemView::date);
+    psz_orig_track_nb = value("upnp:originalTrackNumber", &ItemView::orig_track_nb);
+    psz_album_artist = value("upnp:albumArtist", &ItemView::album_artist);
+    psz_albumArtURI = value("upnp:albumArtURI", &ItemView::albumArtURI);
     const char* psz_media_type = ixmlElement_getFirstChildElementValue(itemElement, "upnp:class");
     if (strncmp(psz_media_type, "object.item.videoItem", 21) == 0)
         media_type = Item::VIDEO;
@@ -400,7 +887,7 @@ std::optional<Item> TryParseItem(IXML_Element* itemElement, bool AsDirectory)
     else
         return {};
 
-    Item file;
+    ItemView file;
     file.objectID = objectID ? objectID : "";
     file.filename = title ? title : "";
     file.media_type = media_type;
@@ -500,13 +987,17 @@ std::optional<Item> TryParseItem(IXML_Element* itemElement, bool AsDirectory)
         }
     }
     ixmlNodeList_free(p_resource_list);
+
+    /* Samsung servers give the subtitle as sec:CaptionInfo rather than on the video resource */
+    if (media_type == Item::VIDEO && file.subtitle.empty() && psz_subtitles)
+        file.subtitle = psz_subtitles;
     return file;
 }
 
-bool BrowseFolderByUnity(const char* json, BrowseDLNAFolderCallback OnBrowseResultCallback)
+uint32_t BrowseFolderByUnity(const char* json, BrowseDLNAFolderCallback OnBrowseResultCallback)
 {
     if (!json || !OnBrowseResultCallback)
-        return false;
+        return 0;
 
     using namespace rapidjson;
     rapidjson::Document request, arguments;
@@ -514,13 +1005,13 @@ bool BrowseFolderByUnity(const char* json, BrowseDLNAFolderCallback OnBrowseResu
     if (int errorCode = request.GetParseError())
     {
         Log(LogLevel::Error, "GetParseError%d", errorCode);
-        return false;
+        return 0;
     }
 
     if (!request.HasMember("arguments"))
     {
         Log(LogLevel::Error, "No arguments parsed");
-        return false;
+        return 0;
     }
 
     arguments.CopyFrom(request["arguments"], request.GetAllocator());
@@ -531,18 +1022,74 @@ bool BrowseFolderByUnity(const char* json, BrowseDLNAFolderCallback OnBrowseResu
     if (!uuid || !objid)
     {
         Log(LogLevel::Error, "Broken arguments in browse request");
-        return false;
+        return 0;
     }
 
-    auto&& server = [](const std::string& uuid)->std::optional<UpnpDevice>
+    DeviceRegistry::Device server = DLNAModule::GetInstance().devices.Find(uuid);
+    if (!server)
     {
-        std::lock_guard<std::mutex> lock(DLNAModule::GetInstance().UpnpDeviceMapMutex);
-        auto it = DLNAModule::GetInstance().UpnpDeviceMap.find(uuid);
-        if (it != DLNAModule::GetInstance().UpnpDeviceMap.end())
-            return it->second;
-        return {};
-    }(uuid);
+        Log(LogLevel::Error, "Browse request to unknown server %s", uuid);
+        return 0;
+    }
 
-    Log(LogLevel::Info, "BrowseRequest: ObjID=%s, name=%s, location=%s", objid, server->friendlyName.c_str(), server->location.c_str());
-    return BrowseAction(objid, "BrowseDirectChildren", "*", "0", "10000", "", server->location.data(), new Cookie(std::move(request), OnBrowseResultCallback)) == 0;
+    BrowsePage page;
+    page.objectID = objid;
+    page.udn = uuid;
+    page.controlUrl = server->location;
+    if (arguments.HasMember("pagesize") && arguments["pagesize"].IsUint())
+        page.requestedCount = arguments["pagesize"].GetUint();
+    if (arguments.HasMember("fields") && arguments["fields"].IsArray())
+    {
+        /* "type" is always sent, it has no bit */
+        page.fields = 0;
+        for (const rapidjson::Value& name : arguments["fields"].GetArray())
+        {
+            auto field = std::find_if(std::begin(UnityFields), std::end(UnityFields),
+                [&name](const UnityField& field) { return name.IsString() && strcmp(name.GetString(), field.key) == 0; });
+            if (field != std::end(UnityFields))
+                page.fields |= FieldBit(field->member);
+            else
+                Log(LogLevel::Warning, "Unknown field in browse request ignored");
+        }
+    }
+
+    const unsigned int timeout = arguments.HasMember("timeout") && arguments["timeout"].IsUint() && arguments["timeout"].GetUint()
+        ? arguments["timeout"].GetUint() : BROWSE_TIMEOUT;
+
+    {
+        std::lock_guard<std::mutex> lock(flightsMutex);
+        auto [flight, leading] = flights.try_emplace(json);
+        RequestEngine::Handle leader = leading ? nullptr : flight->second.request.lock();
+        if (leader && !leader->Cancelled())
+        {
+            flight->second.joined.push_back(OnBrowseResultCallback);
+            Log(LogLevel::Debug, "BrowseRequest: ObjID=%s joined the identical request %u in flight", objid, leader->Id());
+            return leader->Id();
+        }
+
+        page.request = DLNAModule::GetInstance().requests.Begin(std::chrono::milliseconds(timeout));
+        if (!page.request)
+        {
+            flights.erase(flight);
+            Log(LogLevel::Warning, "BrowseRequest: ObjID=%s refused, too many requests in flight", objid);
+            return 0;
+        }
+        flight->second = Flight{ page.request, {} };
+        page.flight = flight->first;
+    }
+
+    const uint32_t id = page.request->Id();
+    Log(LogLevel::Info, "BrowseRequest %u: ObjID=%s, name=%s, location=%s, pagesize=%u", id, objid, server->friendlyName.c_str(), server->location.c_str(), page.requestedCount);
+    Cookie* p_cookie = new Cookie(std::move(request), OnBrowseResultCallback, std::move(page));
+    int res = BrowseNextPage(p_cookie);
+    if (res != UPNP_E_SUCCESS)
+    {
+        /* This caller is told by the return value, the ones that joined meanwhile by a response */
+        std::get<BrowseDLNAFolderCallback>(*p_cookie) = nullptr;
+        std::get<BrowsePage>(*p_cookie).numberReturned = 0;
+        DeliverPage(*p_cookie, nullptr, res);
+        delete p_cookie;
+        return 0;
+    }
+    return id;
 }
\ No newline at end of file
@@ -1,13 +1,23 @@
 #pragma once
 #include <string>
+#include <string_view>
+#include <chrono>
+#include <cstdint>
+#include <initializer_list>
+#include <iterator>
 #include <optional>
+#include <utility>
 #include <variant>
+#include <vector>
 
 #include "ixml.h"
+#include "RequestEngine.h"
 #include "upnp.h"
 #include "rapidjson/document.h"
+#include "rapidjson/stringbuffer.h"
+#include "rapidjson/writer.h"
 
-struct Item
+struct MediaType
 {
     enum MEDIA_TYPE
     {
@@ -15,9 +25,15 @@ struct Item
         AUDIO,
         IMAGE,
         CONTAINER
-    }media_type;
+    };
+};
+
+template <typename String>
+struct BasicItem : MediaType
+{
+    MEDIA_TYPE media_type;
 
-    std::string objectID,
+    String objectID,
         filename,
         url,
         duration,
@@ -33,6 +49,29 @@ struct Item
         album_artist,
         albumArtURI;
 
+    BasicItem() = default;
+
+    template <typename OtherString>
+    explicit BasicItem(const BasicItem<OtherString>& other)
+        : media_type(other.media_type)
+        , objectID(other.objectID)
+        , filename(other.filename)
+        , url(other.url)
+        , duration(other.duration)
+        , date(other.date)
+        , size(other.size)
+        , resolution(other.resolution)
+        , subtitle(other.subtitle)
+        , audio_url(other.audio_url)
+        , artist(other.artist)
+        , genre(other.genre)
+        , album(other.album)
+        , orig_track_nb(other.orig_track_nb)
+        , album_artist(other.album_artist)
+        , albumArtURI(other.albumArtURI)
+    {
+    }
+
     //Item() {}
     //Item(Item&& other) noexcept
     //    :objectID(std::move(other.objectID))
@@ -49,14 +88,134 @@ struct Item
     //{}
 };
 
+using Item = BasicItem<std::string>;
+using ItemView = BasicItem<std::string_view>; // Fields point into a buffer owned by the parser
+
+/* Every string field of an item, in the column order of BrowseResult and LibraryIndex files */
+inline constexpr std::string_view ItemView::* ItemFields[] = {
+    &ItemView::objectID,
+    &ItemView::filename,
+    &ItemView::url,
+    &ItemView::duration,
+    &ItemView::date,
+    &ItemView::size,
+    &ItemView::resolution,
+    &ItemView::subtitle,
+    &ItemView::audio_url,
+    &ItemView::artist,
+    &ItemView::genre,
+    &ItemView::album,
+    &ItemView::orig_track_nb,
+    &ItemView::album_artist,
+    &ItemView::albumArtURI,
+};
+inline constexpr size_t ItemFieldCount = std::size(ItemFields);
+inline constexpr size_t ObjectIDField = 0;
+inline constexpr size_t TitleField = 1;
+
+using FieldMask = uint32_t; // Bit i stands for ItemFields[i]
+inline constexpr FieldMask AllFields = (FieldMask(1) << ItemFieldCount) - 1;
+
+constexpr FieldMask FieldBit(std::string_view ItemView::* member)
+{
+    for (size_t field = 0; field < ItemFieldCount; field++)
+    {
+        if (ItemFields[field] == member)
+            return FieldMask(1) << field;
+    }
+    return 0;
+}
+
+/*
+ * Objects of a browse response, containers first, stored one column per field.
+ *
+ * Fields are offset and length into a single text buffer that is only appended to and
+ * freed with the result: the DIDL-Lite text, decoded in place by the reader, followed by
+ * the values copied out of the DOM when the reader gave up. Objects are assembled into
+ * an ItemView on access, moving the result keeps those views valid.
+ */
+class BrowseResult
+{
+public:
+    struct StringRef
+    {
+        uint32_t offset;
+        uint32_t length;
+    };
+
+    size_t size() const { return types.size(); }
+    bool empty() const { return types.empty(); }
+    MediaType::MEDIA_TYPE Type(size_t object) const { return static_cast<MediaType::MEDIA_TYPE>(types[object]); }
+    std::string_view Field(size_t object, size_t field) const { return String(columns[field][object]); }
+    ItemView operator[](size_t object) const;
+
+    void Reserve(size_t objects);
+    // Replaces the text with a nul terminated copy of didl, for a reader to decode in place.
+    // The copy moves the first time a string is stored after it.
+    char* Adopt(std::string_view didl);
+    // Copies text to the end of the buffer, references stay valid as it grows.
+    StringRef Store(std::string_view text);
+    // Adds an object, its fields are copied unless they already point into the text.
+    void Append(const ItemView& object);
+    void Append(MediaType::MEDIA_TYPE type, const StringRef (&fields)[ItemFieldCount]);
+    // Moves containers before items, keeping their order.
+    void ContainersFirst();
+    void Clear();
+
+private:
+    std::string_view String(StringRef ref) const { return std::string_view(text.data() + ref.offset, ref.length); }
+
+    std::vector<char> text;
+    std::vector<uint8_t> types;
+    std::vector<StringRef> columns[ItemFieldCount];
+};
+
 using BrowseDLNAFolderCallback = std::add_pointer<void(const char*)>::type;
-using Cookie = std::tuple<rapidjson::Document, BrowseDLNAFolderCallback>;
 
+struct BrowsePage
+{
+    std::string udn;
+    std::string objectID;
+    std::string sortCriteria;
+    std::string controlUrl;
+    unsigned int requestedCount = 0; // 0 browses the whole folder with a single request
+    unsigned int startingIndex = 0;
+    unsigned int numberReturned = 0;
+    unsigned int totalMatches = 0;
+    bool complete = true;
+    FieldMask fields = AllFields;    // Requested by Unity, the others are neither asked for nor sent
+    uint64_t cacheGeneration = 0;    // Browse cache generation of the server when the page was requested, 0 if not cached
+    std::string flight;              // Request text while identical requests may still join this one
+    std::vector<BrowseDLNAFolderCallback> joined; // Callbacks of the identical requests that did, they get every response too
+    RequestEngine::Handle request;   // Shared with the requests that joined, cancelling it cancels them too
+};
+
+using Cookie = std::tuple<rapidjson::Document, BrowseDLNAFolderCallback, BrowsePage>;
+
+int BrowseNextPage(Cookie* p_cookie);
 int BrowseAction(const char* objectID, const char* flag, const char* filter, const char* startingIndex, const char* requestCount, const char* sortCriteria, const char* controlUrl, Cookie* p_cookie);
-std::variant<std::vector<Item>, int> Resolve2(IXML_Document * p_response);
-static int UpnpSendActionCallBack(Upnp_EventType eventType, const void* p_event, void* p_cookie);
-bool BrowseFolderByUnity(const char* json, BrowseDLNAFolderCallback OnBrowseResultCallback);
-std::optional<Item> TryParseItem(IXML_Element* itemElement, bool AsDirectory);
+// Longest a ContentDirectory action may take, sending it and reading the response.
+inline constexpr std::chrono::seconds ActionTimeout(30);
+// Sends a ContentDirectory action and waits for its answer, response is only set on success. An action sent for
+// a request is given no more than the time it has left, and its response is not parsed once it was abandoned.
+int SendContentDirectoryAction(const std::string& controlUrl, const char* action, std::initializer_list<std::pair<const char*, const char*>> arguments, IXML_Document** response,
+    const RequestEngine::Request* request = nullptr);
+// True when a page of a Browse or Search that started at start ends the list. TotalMatches may be 0 when the
+// server can't compute it, then only a short page does.
+bool IsLastPage(unsigned int start, unsigned int returned, unsigned int total, unsigned int requested);
+// ASCII case insensitive, the way servers usually implement "contains".
+bool ContainsIgnoringCase(std::string_view text, std::string_view loweredPattern);
+// Writes the JSON object Unity receives for an item, leaving out the fields not in fields.
+void WriteItem(rapidjson::Writer<rapidjson::StringBuffer>& writer, const ItemView& it, FieldMask fields = AllFields);
+std::variant<std::string, int> Resolve(IXML_Document* p_response);
+std::variant<std::string, int> ResolveByReparsing(IXML_Document* p_response); // Resolve through a second ixml DOM
+// Fields not in fields may be left empty, the title is always read.
+std::variant<BrowseResult, int> Resolve2(IXML_Document * p_response, FieldMask fields = AllFields);
+// Arguments are uuid, objid, then optionally pagesize, fields, the item keys to send (all of them by default), and
+// timeout, in ms for the whole folder. Returns the request ID, that of the identical request joined if any, 0 on failure.
+uint32_t BrowseFolderByUnity(const char* json, BrowseDLNAFolderCallback OnBrowseResultCallback);
+// Fields of the returned item point into the DOM of itemElement.
+std::optional<ItemView> TryParseItem(IXML_Element* itemElement, bool AsDirectory, FieldMask fields = AllFields);
 IXML_Document* parseBrowseResult(IXML_Document* p_doc);
 
 // Make a way to use static_assert(false) while this template is specialized.  Cf. https://www.open-std.org/jtc1/sc22/wg21/docs/papers/2022/p2593r0.html
@@ -0,0 +1,45 @@
+#pragma once
+#include <string>
+
+struct UpnpDevice
+{
+    std::string UDN;
+    std::string friendlyName;
+    std::string location;
+    std::string iconUrl;
+    std::string manufacturer;
+    std::string eventUrl; // ContentDirectory eventSubURL, resolved
+    enum DeviceType
+    {
+        UnknownDevice = 0,
+        MediaServer = 1,
+        MediaRenderer = 2,
+    }deviceType;
+
+    UpnpDevice(const UpnpDevice& other)
+        : UDN(other.UDN)
+        , friendlyName(other.friendlyName)
+        , location(other.location)
+        , iconUrl(other.iconUrl)
+        , manufacturer(other.manufacturer)
+        , eventUrl(other.eventUrl)
+        , deviceType(other.deviceType)
+    {
+    }
+
+    UpnpDevice(const std::string& udn)
+        : UDN(udn)
+        , deviceType(UnknownDevice)
+    {
+    }
+
+    UpnpDevice(const std::string& udn, const std::string& friendlyName, const std::string& location, const std::string& iconUrl, const std::string& manufacturer)
+        : UDN(udn)
+        , friendlyName(friendlyName)
+        , location(location)
+        , iconUrl(iconUrl)
+        , manufacturer(manufacturer)
+        , deviceType(UnknownDevice)
+    {
+    }
+};
@@ -0,0 +1,94 @@
+#include <algorithm>
+
+#include "WorkerPool.h"
+
+WorkerPool::WorkerPool(unsigned int threadCount, size_t maxQueued, unsigned int maxPerHost)
+    : threadCount(threadCount)
+    , maxQueued(maxQueued)
+    , maxPerHost(maxPerHost)
+{
+}
+
+WorkerPool::~WorkerPool()
+{
+    Stop();
+}
+
+void WorkerPool::Start()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (running)
+        return;
+    running = true;
+    for (unsigned int i = 0; i < threadCount; i++)
+        threads.emplace_back(&WorkerPool::Run, this);
+}
+
+void WorkerPool::Stop()
+{
+    std::vector<std::thread> stopping;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        running = false;
+        for (const Job& job : queue)
+            pendingKeys.erase(job.key);
+        queue.clear();
+        stopping.swap(threads);
+    }
+    jobAvailable.notify_all();
+    for (std::thread& thread : stopping)
+        thread.join();
+}
+
+bool WorkerPool::Submit(const std::string& key, const std::string& host, std::function<void()> job)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!running || queue.size() >= maxQueued || !pendingKeys.insert(key).second)
+            return false;
+        queue.push_back({ key, host, std::move(job) });
+    }
+    jobAvailable.notify_one();
+    return true;
+}
+
+size_t WorkerPool::Queued()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return queue.size();
+}
+
+void WorkerPool::Run()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    for (;;)
+    {
+        /* Oldest job whose host still has a free slot */
+        auto next = queue.end();
+        jobAvailable.wait(lock, [this, &next]
+            {
+                next = std::find_if(queue.begin(), queue.end(), [this](const Job& job)
+                    {
+                        auto hostJobs = runningPerHost.find(job.host);
+                        return hostJobs == runningPerHost.end() || hostJobs->second < maxPerHost;
+                    });
+                return !running || next != queue.end();
+            });
+        if (!running)
+            return;
+
+        Job job = std::move(*next);
+        queue.erase(next);
+        runningPerHost[job.host]++;
+
+        lock.unlock();
+        job.run();
+        lock.lock();
+
+        if (--runningPerHost[job.host] == 0)
+            runningPerHost.erase(job.host);
+        pendingKeys.erase(job.key);
+        /* A job held back by the per-host limit may be runnable now */
+        jobAvailable.notify_all();
+    }
+}
@@ -0,0 +1,55 @@
+#pragma once
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+/*
+ * Fixed set of threads running jobs off a bounded queue.
+ *
+ * A job carries a key and a host: a key that is already queued or running is not
+ * accepted twice, and no more than maxPerHost jobs of the same host run at once, so
+ * one slow server can't hold every thread.
+ */
+class WorkerPool
+{
+public:
+    WorkerPool(unsigned int threadCount, size_t maxQueued, unsigned int maxPerHost);
+    ~WorkerPool();
+
+    void Start();
+    // Drops the jobs still queued and waits for the running ones.
+    void Stop();
+
+    // Returns false when the key is pending, the queue is full or the pool is stopped.
+    bool Submit(const std::string& key, const std::string& host, std::function<void()> job);
+    // Jobs waiting for a thread.
+    size_t Queued();
+
+private:
+    struct Job
+    {
+        std::string key;
+        std::string host;
+        std::function<void()> run;
+    };
+
+    void Run();
+
+    const unsigned int threadCount;
+    const size_t maxQueued;
+    const unsigned int maxPerHost;
+
+    std::mutex mutex;
+    std::condition_variable jobAvailable;
+    std::deque<Job> queue;
+    std::set<std::string> pendingKeys;
+    std::map<std::string, unsigned int> runningPerHost;
+    std::vector<std::thread> threads;
+    bool running = false;
+};
@@ -1,16 +1,464 @@
+#include <atomic>
+#include <condition_variable>
+#include <cstring>
+#include <ctime>
+#include <iomanip>
+#include <memory>
+#include <thread>
+#include <vector>
+
 #include "logger.h"
 
 namespace logger {
 
+    namespace
+    {
+        constexpr size_t RingCapacity = 64 * 1024; // Per thread, power of two
+        constexpr size_t MaxLineLength = RingCapacity / 8;
+
+#if ENABLE_BINARY_LOG
+        struct CallSite
+        {
+            std::string_view format;
+            const char* file;
+            uint32_t line;
+            uint32_t column;
+            const char* function;
+        };
+
+        std::mutex callSitesMutex;
+        std::vector<CallSite> callSites; // ID - 1
+#endif
+        constexpr auto FlushInterval = std::chrono::milliseconds(100);
+
+        /* Single producer (the owning thread), single consumer (whoever holds Writer::drainMutex) */
+        struct Ring
+        {
+            std::atomic<size_t> head{ 0 };
+            std::atomic<size_t> tail{ 0 };
+            std::atomic<bool> retired{ false };
+            char data[RingCapacity];
+
+            bool Push(std::string_view line)
+            {
+                const uint32_t length = static_cast<uint32_t>(line.size());
+                const size_t position = head.load(std::memory_order_relaxed);
+                if (RingCapacity - (position - tail.load(std::memory_order_acquire)) < sizeof(length) + length)
+                    return false;
+                CopyIn(position, &length, sizeof(length));
+                CopyIn(position + sizeof(length), line.data(), length);
+                head.store(position + sizeof(length) + length, std::memory_order_release);
+                return true;
+            }
+
+            bool Drain(std::string& out)
+            {
+                size_t position = tail.load(std::memory_order_relaxed);
+                const size_t end = head.load(std::memory_order_acquire);
+                if (position == end)
+                    return false;
+                while (position != end)
+                {
+                    uint32_t length;
+                    CopyOut(position, &length, sizeof(length));
+                    const size_t offset = out.size();
+                    out.resize(offset + length);
+                    CopyOut(position + sizeof(length), out.data() + offset, length);
+                    position += sizeof(length) + length;
+                }
+                tail.store(position, std::memory_order_release);
+                return true;
+            }
+
+        private:
+            void CopyIn(size_t position, const void* source, size_t size)
+            {
+                const size_t offset = position & (RingCapacity - 1);
+                const size_t first = std::min(size, RingCapacity - offset);
+                memcpy(data + offset, source, first);
+                memcpy(data, static_cast<const char*>(source) + first, size - first);
+            }
+
+            void CopyOut(size_t position, void* destination, size_t size) const
+            {
+                const size_t offset = position & (RingCapacity - 1);
+                const size_t first = std::min(size, RingCapacity - offset);
+                memcpy(destination, data + offset, first);
+                memcpy(static_cast<char*>(destination) + first, data, size - first);
+            }
+        };
+
+        /*
+         * Owns the log file and the thread writing to it. Logging threads only touch their
+         * own ring, rings of exited threads are released once drained.
+         */
+        class Writer
+        {
+        public:
+            ~Writer()
+            {
+                Stop();
+            }
+
+            void SetPath(const std::filesystem::path& newPath)
+            {
+                std::lock_guard<std::mutex> lock(drainMutex);
+                path = newPath;
+                file.close();
+            }
+
+            std::shared_ptr<Ring> Register()
+            {
+                auto ring = std::make_shared<Ring>();
+                std::lock_guard<std::mutex> lock(ringsMutex);
+                rings.push_back(ring);
+                return ring;
+            }
+
+            void Submit(Ring& ring, std::string_view line, bool urgent)
+            {
+                if (!running.load(std::memory_order_acquire))
+                    Start();
+                if (!ring.Push(line))
+                {
+                    dropped.fetch_add(1, std::memory_order_relaxed);
+                    urgent = true;
+                }
+                else if (ring.head.load(std::memory_order_relaxed) - ring.tail.load(std::memory_order_relaxed) > RingCapacity / 2)
+                    urgent = true;
+                if (urgent && !pending.exchange(true, std::memory_order_acq_rel))
+                    wakeup.notify_one();
+            }
+
+            void Drop()
+            {
+                dropped.fetch_add(1, std::memory_order_relaxed);
+            }
+
+            void Flush()
+            {
+                std::lock_guard<std::mutex> lock(drainMutex);
+                Drain();
+            }
+
+            void Stop()
+            {
+                {
+                    std::lock_guard<std::mutex> lock(threadMutex);
+                    if (!thread.joinable())
+                        return;
+                    running = false;
+                    stopping = true;
+                }
+                wakeup.notify_one();
+                thread.join();
+                Flush();
+            }
+
+        private:
+            void Start()
+            {
+                std::lock_guard<std::mutex> lock(threadMutex);
+                if (thread.joinable())
+                    return;
+                stopping = false;
+                running = true;
+                thread = std::thread(&Writer::Run, this);
+            }
+
+            void Run()
+            {
+                std::unique_lock<std::mutex> lock(threadMutex);
+                while (!stopping)
+                {
+                    wakeup.wait_for(lock, FlushInterval, [this] { return stopping || pending.load(std::memory_order_acquire); });
+                    pending = false;
+                    lock.unlock();
+                    Flush();
+                    lock.lock();
+                }
+            }
+
+            // Called with drainMutex held.
+            void Drain()
+            {
+                batch.clear();
+                {
+                    std::lock_guard<std::mutex> lock(ringsMutex);
+                    for (auto it = rings.begin(); it != rings.end();)
+                    {
+                        /* Read retired before draining, so a line pushed right before exit isn't lost */
+                        const bool retired = (*it)->retired.load(std::memory_order_acquire);
+                        if (!(*it)->Drain(batch) && retired)
+                            it = rings.erase(it);
+                        else
+                            ++it;
+                    }
+                }
+#if ENABLE_BINARY_LOG
+                if (uint64_t count = dropped.exchange(0, std::memory_order_relaxed))
+                {
+                    const size_t start = binary::BeginRecord(batch, binary::RecordType::Dropped);
+                    binary::Put(batch, count);
+                    binary::EndRecord(batch, start);
+                }
+                if (batch.empty() || !Open())
+                    return;
+                DescribeCallSites();
+                file.write(definitions.data(), definitions.size());
+                file.write(batch.data(), batch.size());
+                file.flush();
+#else
+                if (uint64_t count = dropped.exchange(0, std::memory_order_relaxed))
+                    batch += "[W] " + std::to_string(count) + " log messages dropped, logging threads outran the writer\n";
+                if (batch.empty())
+                    return;
+
+                if (!file.is_open() && !path.empty())
+                    file.open(path, std::ios::out | std::ios::app | std::ios::binary);
+                std::ostream& os = file.is_open() ? static_cast<std::ostream&>(file) : std::cout;
+                os.write(batch.data(), batch.size());
+                os.flush();
+#endif
+            }
+
+#if ENABLE_BINARY_LOG
+            // Binary lines have nowhere to go without a file.
+            bool Open()
+            {
+                if (file.is_open())
+                    return true;
+                if (path.empty())
+                    return false;
+
+                std::error_code error;
+                const bool empty = !std::filesystem::exists(path, error) || std::filesystem::file_size(path, error) == 0;
+                file.open(path, std::ios::out | std::ios::app | std::ios::binary);
+                if (!file.is_open())
+                    return false;
+                if (empty)
+                    file.write(binary::Magic, sizeof(binary::Magic));
+                /* Appending to an older log, call sites may have been numbered differently */
+                described.clear();
+                return true;
+            }
+
+            // Fills definitions with the call sites seen first in batch.
+            void DescribeCallSites()
+            {
+                definitions.clear();
+                for (size_t offset = 0; offset < batch.size();)
+                {
+                    binary::Reader reader{ std::string_view(batch).substr(offset) };
+                    const uint32_t size = reader.Get<uint32_t>();
+                    if (size < sizeof(uint32_t) + sizeof(binary::RecordType))
+                        break;
+                    if (reader.Get<binary::RecordType>() == binary::RecordType::Entry)
+                    {
+                        const uint32_t id = reader.Get<uint32_t>();
+                        if (id > described.size())
+                            described.resize(id, false);
+                        if (id && !described[id - 1])
+                        {
+                            CallSite site;
+                            {
+                                std::lock_guard<std::mutex> lock(callSitesMutex);
+                                site = callSites[id - 1];
+                            }
+                            const size_t start = binary::BeginRecord(definitions, binary::RecordType::CallSite);
+                            binary::Put(definitions, id);
+                            binary::Put(definitions, site.line);
+                            binary::Put(definitions, site.column);
+                            binary::PutString(definitions, site.format);
+                            binary::PutString(definitions, site.file);
+                            binary::PutString(definitions, site.function);
+                            binary::EndRecord(definitions, start);
+                            described[id - 1] = true;
+                        }
+                    }
+                    offset += size;
+                }
+            }
+#endif
+
+            std::mutex ringsMutex;
+            std::vector<std::shared_ptr<Ring>> rings;
+
+            std::mutex drainMutex;
+            std::filesystem::path path;
+            std::ofstream file;
+            std::string batch;
+#if ENABLE_BINARY_LOG
+            std::string definitions;
+            std::vector<bool> described; // ID - 1, call sites already in the current file
+#endif
+
+            std::mutex threadMutex;
+            std::condition_variable wakeup;
+            std::thread thread;
+            bool stopping = false;
+            std::atomic<bool> running{ false };
+            std::atomic<bool> pending{ false };
+            std::atomic<uint64_t> dropped{ 0 };
+        };
+
+        Writer& GetWriter()
+        {
+            static Writer writer;
+            return writer;
+        }
+
+        struct ThreadRing
+        {
+            std::shared_ptr<Ring> ring = GetWriter().Register();
+            ~ThreadRing()
+            {
+                ring->retired.store(true, std::memory_order_release);
+            }
+        };
+
+        Ring& CurrentRing()
+        {
+            thread_local ThreadRing threadRing;
+            return *threadRing.ring;
+        }
+
+        void Submit(LogLevel level, std::string_view line)
+        {
+            Writer& writer = GetWriter();
+            /* Errors are written before returning, a Fatal is often the last thing before an abort */
+            const bool urgent = level == LogLevel::Error || level == LogLevel::Fatal;
+            writer.Submit(CurrentRing(), line, false);
+            if (urgent)
+                writer.Flush();
+        }
+    }
+
     const std::filesystem::path logFile;
     bool SetLogFile(const char* path)
     {
-        return std::filesystem::exists(const_cast<std::filesystem::path&>(logFile) = std::filesystem::u8path(path)); //TODO: change all string to u8string.
+        const_cast<std::filesystem::path&>(logFile) = std::filesystem::u8path(path); //TODO: change all string to u8string.
+        GetWriter().SetPath(logFile);
+        return std::filesystem::exists(logFile);
+    }
+
+    std::atomic<int> minimumSeverity{ Severity(LogLevel::Trace) };
+    extern "C" void SetLogLevel(LogLevel level)
+    {
+        minimumSeverity.store(Severity(level), std::memory_order_relaxed);
     }
 
     extern "C" void ExternalLog(LogLevel level, const char* format)
     {
-        Log(level, format);
+        /* The message is an argument, so it isn't mistaken for a format */
+        static const FormatSpec external{ "%s" };
+        if (format && IsLogEnabled(level))
+            LogLine(level, external, format);
+    }
+
+    FormatSpec::FormatSpec(const char* format)
+        : format(format)
+    {
+        size_t literal = 0;
+        for (size_t i = 0; i < this->format.size(); i++)
+        {
+            if (this->format[i] != '%')
+                continue;
+            literals.push_back(this->format.substr(literal, i - literal));
+            placeholders.push_back(this->format.substr(i, 2));
+            literal = std::min(i + 2, this->format.size());
+            i = literal - 1;
+        }
+        literals.push_back(this->format.substr(literal));
+    }
+
+    std::ostream& BeginLine()
+    {
+        thread_local std::ostringstream line;
+        line.str({});
+        line.clear();
+        return line;
+    }
+
+    void CommitLine(LogLevel level, std::ostream& line)
+    {
+        std::string_view text = static_cast<std::ostringstream&>(line).view();
+        if (text.size() > MaxLineLength)
+        {
+            thread_local std::string truncated;
+            truncated.assign(text.substr(0, MaxLineLength - 12)).append("[truncated]\n");
+            text = truncated;
+        }
+        Submit(level, text);
+    }
+
+#if ENABLE_BINARY_LOG
+    std::string& RecordBuffer()
+    {
+        thread_local std::string record;
+        record.clear();
+        return record;
+    }
+
+    void CommitRecord(LogLevel level, const std::string& record)
+    {
+        if (record.size() > MaxLineLength)
+            GetWriter().Drop();
+        else
+            Submit(level, record);
+    }
+
+    uint32_t RegisterCallSite(const FormatSpec& spec, const char* file, uint32_t line, uint32_t column, const char* function)
+    {
+        std::lock_guard<std::mutex> lock(callSitesMutex);
+        uint32_t id = spec.id.load(std::memory_order_relaxed);
+        if (!id)
+        {
+            callSites.push_back({ spec.format, file, line, column, function });
+            id = static_cast<uint32_t>(callSites.size());
+            spec.id.store(id, std::memory_order_release);
+        }
+        return id;
+    }
+
+    uint64_t CurrentThreadID()
+    {
+#if _WIN64
+        return std::hash<std::thread::id>{}(std::this_thread::get_id());
+#else
+        return static_cast<uint64_t>(gettid());
+#endif
+    }
+#endif
+
+    void WriteTimestamp(std::ostream& os)
+    {
+        /* Formatting the date is the expensive part, it only changes once a second */
+        thread_local time_t cachedTime = -1;
+        thread_local char cached[32];
+        const time_t current = std::time(nullptr);
+        if (current != cachedTime)
+        {
+            std::tm local{};
+#if _WIN64
+            localtime_s(&local, &current);
+#else
+            localtime_r(&current, &local);
+#endif
+            strftime(cached, sizeof(cached), "%F %T ", &local);
+            cachedTime = current;
+        }
+        os << cached;
+    }
+
+    void FlushLog()
+    {
+        GetWriter().Flush();
+    }
+
+    void StopLogWriter()
+    {
+        GetWriter().Stop();
     }
 
 }// namespace logger
@@ -1,10 +1,16 @@
 #pragma once
 
+#include <atomic>
+#include <chrono>
 #include <mutex>
 #include <iostream>
 #include <ostream>
 #include <fstream>
 #include <filesystem>
+#include <iomanip>
+#include <sstream>
+#include <string_view>
+#include <vector>
 
 #if __cpp_lib_format
 #include <format>
@@ -14,11 +20,17 @@
 #include <source_location>
 #endif
 
+#if ENABLE_BINARY_LOG
+#include "LogRecord.h"
+#endif
+
 #if _WIN64
 #define gettid() std::this_thread::get_id()
 #elif __ANDROID__
 #include <android/log.h>
 #include <unistd.h>
+#else
+#include <unistd.h>
 #endif
 
 namespace logger {
@@ -38,20 +50,173 @@ namespace logger {
     extern "C" bool SetLogFile(const char* path);
     extern "C" void ExternalLog(LogLevel level, const char* format);
 
+    /* Lines are formatted by the logging thread and written to logFile by a background thread */
+    std::ostream& BeginLine();
+    void CommitLine(LogLevel level, std::ostream& line);
+    void WriteTimestamp(std::ostream& os);
+    // Writes out everything logged so far.
+    void FlushLog();
+    // Flushes and joins the writer thread, the next line starts it again.
+    void StopLogWriter();
+
+    // Lowest level compiled in, DLNA_LOG_MIN_LEVEL is set by CMake.
+#ifndef DLNA_LOG_MIN_LEVEL
+#define DLNA_LOG_MIN_LEVEL Trace
+#endif
+    constexpr int Severity(LogLevel level)
+    {
+        switch (level)
+        {
+        case LogLevel::Trace: return 0;
+        case LogLevel::Debug: return 1;
+        case LogLevel::Info: return 2;
+        case LogLevel::Warning: return 3;
+        case LogLevel::Error: return 4;
+        default: return 5;
+        }
+    }
+    constexpr int CompiledSeverity = Severity(LogLevel::DLNA_LOG_MIN_LEVEL);
+
+    extern std::atomic<int> minimumSeverity;
+    extern "C" void SetLogLevel(LogLevel level);
+
+    inline bool IsLogEnabled(LogLevel level)
+    {
+        return Severity(level) >= CompiledSeverity && Severity(level) >= minimumSeverity.load(std::memory_order_relaxed);
+    }
+
+    /* A format string split around its placeholders, '%' and the character after it */
+    struct FormatSpec
+    {
+        explicit FormatSpec(const char* format);
+
+        std::string_view format;
+        std::vector<std::string_view> literals; // One more than placeholders
+        std::vector<std::string_view> placeholders;
+#if ENABLE_BINARY_LOG
+        mutable std::atomic<uint32_t> id{ 0 }; // Call site in the binary log, 0 until registered
+#endif
+    };
+
+#if ENABLE_BINARY_LOG
+    /* Lines are recorded as a call site ID and the raw arguments, LogDecoder turns them back into text */
+    std::string& RecordBuffer();
+    void CommitRecord(LogLevel level, const std::string& record);
+    uint32_t RegisterCallSite(const FormatSpec& spec, const char* file, uint32_t line, uint32_t column, const char* function);
+    uint64_t CurrentThreadID();
+
+    template <typename T>
+    void EncodeArgument(std::string& record, const T& obj)
+    {
+        using namespace binary;
+        if constexpr (std::is_null_pointer_v<T>)
+            Put(record, ArgumentTag::Null);
+        else if constexpr (std::is_same_v<T, bool>)
+        {
+            Put(record, ArgumentTag::Bool);
+            Put(record, static_cast<uint8_t>(obj));
+        }
+        else if constexpr (std::is_same_v<T, char>)
+        {
+            Put(record, ArgumentTag::Char);
+            Put(record, obj);
+        }
+        else if constexpr (std::is_integral_v<T> && std::is_signed_v<T>)
+        {
+            Put(record, ArgumentTag::Signed);
+            Put(record, static_cast<int64_t>(obj));
+        }
+        else if constexpr (std::is_integral_v<T>)
+        {
+            Put(record, ArgumentTag::Unsigned);
+            Put(record, static_cast<uint64_t>(obj));
+        }
+        else if constexpr (std::is_floating_point_v<T>)
+        {
+            Put(record, ArgumentTag::Double);
+            Put(record, static_cast<double>(obj));
+        }
+        else if constexpr (std::is_convertible_v<const T&, const char*>)
+        {
+            const char* text = obj;
+            if (text == nullptr)
+                Put(record, ArgumentTag::NullString);
+            else
+            {
+                Put(record, ArgumentTag::String);
+                PutString(record, text);
+            }
+        }
+        else if constexpr (std::is_pointer_v<T>)
+        {
+            Put(record, ArgumentTag::Pointer);
+            Put(record, static_cast<uint64_t>(reinterpret_cast<uintptr_t>(obj)));
+        }
+        else if constexpr (std::is_convertible_v<const T&, std::string_view>)
+        {
+            Put(record, ArgumentTag::String);
+            PutString(record, obj);
+        }
+        else
+        {
+            std::ostringstream stream;
+            stream << obj;
+            Put(record, ArgumentTag::String);
+            PutString(record, stream.view());
+        }
+    }
+
+    template <typename... Args>
+    struct LogLine
+    {
+        LogLine(LogLevel level, const FormatSpec& spec, Args&&... args
+#if __cpp_lib_source_location
+            , const std::source_location& location = std::source_location::current()
+#endif
+        )
+        {
+            uint32_t id = spec.id.load(std::memory_order_acquire);
+            if (!id)
+#if __cpp_lib_source_location
+                id = RegisterCallSite(spec, location.file_name(), location.line(), location.column(), location.function_name());
+#else
+                id = RegisterCallSite(spec, "", 0, 0, "");
+#endif
+            std::string& record = RecordBuffer();
+            const size_t start = binary::BeginRecord(record, binary::RecordType::Entry);
+            binary::Put(record, id);
+            binary::Put(record, static_cast<char>(level));
+            binary::Put(record, static_cast<int64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count()));
+            binary::Put(record, CurrentThreadID());
+            (EncodeArgument(record, args), ...);
+            binary::EndRecord(record, start);
+            CommitRecord(level, record);
+        }
+    };
+#else
+    template <typename T>
+    void WriteArgument(std::ostream& os, const T& obj)
+    {
+        if constexpr (std::is_null_pointer_v<T>)
+            os << "(compile-time nullptr)";
+        else if constexpr (std::is_pointer_v<T>)
+            obj == nullptr ? os << "(runtime nullptr)" : os << obj;
+        else
+            os << obj;
+    }
+
     template <typename... Args>
-    struct Log
+    struct LogLine
     {
-        Log(LogLevel level, const char* format, Args&&... args
+        LogLine(LogLevel level, const FormatSpec& spec, Args&&... args
 #if __cpp_lib_source_location
             , const std::source_location& location = std::source_location::current()
 #endif
         )
         {
-            std::ofstream logStream{ logFile, std::ios::out | std::ios::app };
-            std::ostream* os = logStream.is_open() ? &logStream : &std::cout;
-            time_t current = std::time(nullptr);
+            std::ostream* os = &BeginLine();
+            WriteTimestamp(*os);
             *os << std::left
-                << std::put_time(std::localtime(&current), "%F %T ")
                 << "[" << static_cast<char>(level) << "]"
                 << "[thread " << gettid() << "] ";
 #if __cpp_lib_source_location
@@ -61,44 +226,41 @@ namespace logger {
                 << "): ";
 #endif
 #if __cpp_lib_format and ENABLE_STD_FORMAT
-            * os << std::vformat(std::string_view{ format }, std::make_format_args(args...)) << "\n";
+            * os << std::vformat(spec.format, std::make_format_args(args...)) << "\n";
 #else
-            std::string_view sv{ format };
-            auto it = sv.begin();
-            auto TryInsert = [&sv, &it, &os]<typename T>(size_t n, T obj)
+            size_t index = 0;
+            [[maybe_unused]] auto Insert = [&spec, &index, &os](const auto& obj)
             {
-                for (; it != sv.end(); ++it)
+                if (index < spec.placeholders.size())
                 {
-                    if (*it == '%')
-                    {
-                        if constexpr (std::is_null_pointer_v<T>)
-                            *os << "(compile-time nullptr)";
-                        else if constexpr (std::is_pointer_v<T>)
-                            obj == nullptr ? *os << "(runtime nullptr)" : *os << obj;
-                        else
-                            *os << obj;
-                        it += 2;
-                        break;
-                    }
-                    else
-                    {
-                        *os << *it;
-                    }
+                    *os << spec.literals[index++];
+                    WriteArgument(*os, obj);
                 }
             };
-
-            [&] <std::size_t... N>(std::index_sequence<N...>)
-            {
-                ((TryInsert(N, std::get<N>(std::forward_as_tuple(args...)))), ...);
-            }(std::index_sequence_for<Args...>{});
-
-            *os << "\n";
+            (Insert(args), ...);
+            for (; index < spec.placeholders.size(); index++)
+                *os << spec.literals[index] << spec.placeholders[index];
+            *os << spec.literals.back() << "\n";
 #endif // ENABLE_STD_FORMAT
+            CommitLine(level, *os);
         }
     };
+#endif // ENABLE_BINARY_LOG
 
     template <typename... Args>
-    Log(LogLevel, const char*, Args&&...) -> Log<Args...>;
+    LogLine(LogLevel, const FormatSpec&, Args&&...) -> LogLine<Args...>;
+
+    /*
+     * Arguments are only evaluated when the level is enabled, and the format is split
+     * once per call site. The format must be a string literal.
+     */
+#define Log(level, format, ...) do {                                        \
+    if (::logger::IsLogEnabled(level))                                      \
+    {                                                                       \
+        static const ::logger::FormatSpec logFormatSpec{ format };          \
+        ::logger::LogLine(level, logFormatSpec, ##__VA_ARGS__);             \
+    }                                                                       \
+} while (0)
 #else // ENABLE_SLOG
 #include "slog.h"
     enum LogLevel
@@ -113,6 +275,7 @@ namespace logger {
 #define Log(x, y, ...) do {                                    \
     slog_tag("DLNAModule", x, y"\n", ##__VA_ARGS__);            \
 } while (0)
+    inline bool IsLogEnabled(LogLevel) { return true; }
 #endif // ENABLE_SLOG
 }
 using namespace logger;
@@ -0,0 +1,17 @@
+#pragma once
+#include <cstdio>
+
+/*
+ * Checks shared by the unit tests: a failed check is reported and counted, and
+ * main returns failures ? 1 : 0 once every check ran.
+ */
+inline int failures = 0;
+
+inline void Check(bool condition, const char* what)
+{
+    if (!condition)
+    {
+        fprintf(stderr, "FAILED: %s\n", what);
+        failures++;
+    }
+}
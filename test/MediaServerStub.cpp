@@ -0,0 +1,321 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string_view>
+#include <thread>
+
+#include "ixml.h"
+#include "MediaServerStub.h"
+
+namespace
+{
+    const char* CONTENT_DIRECTORY = "urn:schemas-upnp-org:service:ContentDirectory:1";
+
+    std::string MakeUDN()
+    {
+        std::random_device random;
+        char udn[64];
+        snprintf(udn, sizeof(udn), "uuid:0dd1a0de-%04x-%04x-%04x-%08x%04x", random() & 0xffff, random() & 0xffff, random() & 0xffff, random(), random() & 0xffff);
+        return udn;
+    }
+
+    void AppendEscaped(std::string& out, std::string_view text)
+    {
+        for (char c : text)
+            switch (c)
+            {
+            case '&': out += "&amp;"; break;
+            case '<': out += "&lt;"; break;
+            case '>': out += "&gt;"; break;
+            case '"': out += "&quot;"; break;
+            default: out += c; break;
+            }
+    }
+
+    unsigned int ToUnsigned(const char* value)
+    {
+        return value ? static_cast<unsigned int>(strtoul(value, nullptr, 10)) : 0;
+    }
+
+    /* Browse Filter, "*" or comma separated property names */
+    bool Requested(std::string_view filter, std::string_view property)
+    {
+        if (filter == "*")
+            return true;
+        while (!filter.empty())
+        {
+            size_t comma = filter.find(',');
+            if (filter.substr(0, comma) == property)
+                return true;
+            filter.remove_prefix(comma == std::string_view::npos ? filter.size() : comma + 1);
+        }
+        return false;
+    }
+}
+
+MediaServerStub::MediaServerStub(const MediaServerOptions& options)
+    : options(options)
+    , udn(MakeUDN())
+{
+}
+
+MediaServerStub::~MediaServerStub()
+{
+    Stop();
+}
+
+int MediaServerStub::Start()
+{
+    const char* ip = UpnpGetServerIpAddress();
+    if (!ip || !*ip)
+        return UPNP_E_INVALID_PARAM;
+    mediaBaseUrl = "http://" + std::string(ip) + ":" + std::to_string(UpnpGetServerPort()) + "/media/";
+
+    const std::string description =
+        "<?xml version=\"1.0\"?>"
+        "<root xmlns=\"urn:schemas-upnp-org:device-1-0\">"
+        "<specVersion><major>1</major><minor>0</minor></specVersion>"
+        "<device>"
+        "<deviceType>urn:schemas-upnp-org:device:MediaServer:1</deviceType>"
+        "<friendlyName>DLNAModule bench server</friendlyName>"
+        "<manufacturer>DLNAModule</manufacturer>"
+        "<modelName>MediaServerStub</modelName>"
+        "<UDN>" + udn + "</UDN>"
+        "<serviceList><service>"
+        "<serviceType>" + std::string(CONTENT_DIRECTORY) + "</serviceType>"
+        "<serviceId>urn:upnp-org:serviceId:ContentDirectory</serviceId>"
+        "<SCPDURL>/cds.xml</SCPDURL>"
+        "<controlURL>/upnp/control/cds</controlURL>"
+        "<eventSubURL>/upnp/event/cds</eventSubURL>"
+        "</service></serviceList>"
+        "</device>"
+        "</root>";
+
+    int res = UpnpRegisterRootDevice2(UPNPREG_BUF_DESC, description.c_str(), description.length(), 1, Callback, this, &handle);
+    if (res != UPNP_E_SUCCESS)
+    {
+        handle = -1;
+        return res;
+    }
+    return UpnpSendAdvertisement(handle, 100);
+}
+
+void MediaServerStub::Stop()
+{
+    if (handle == -1)
+        return;
+    UpnpUnRegisterRootDevice(handle);
+    handle = -1;
+}
+
+int MediaServerStub::Callback(Upnp_EventType eventType, const void* event, void* cookie)
+{
+    MediaServerStub* server = static_cast<MediaServerStub*>(cookie);
+    switch (eventType)
+    {
+    case UPNP_CONTROL_ACTION_REQUEST:
+        return server->Control((UpnpActionRequest*)event);
+
+    case UPNP_EVENT_SUBSCRIPTION_REQUEST:
+        return server->AcceptSubscription((UpnpSubscriptionRequest*)event);
+
+    default:
+        return UPNP_E_SUCCESS;
+    }
+}
+
+int MediaServerStub::Control(UpnpActionRequest* request)
+{
+    const char* action = UpnpString_get_String(UpnpActionRequest_get_ActionName(request));
+    IXML_Element* arguments = (IXML_Element*)UpnpActionRequest_get_ActionRequest(request);
+    std::string response;
+    if (action && !strcmp(action, "GetSearchCapabilities"))
+    {
+        response = "<u:GetSearchCapabilitiesResponse xmlns:u=\"" + std::string(CONTENT_DIRECTORY) + "\"><SearchCaps>"
+            + (options.searchable ? "dc:title,upnp:class" : "") + "</SearchCaps></u:GetSearchCapabilitiesResponse>";
+    }
+    else if (action && (!strcmp(action, "Browse") || (options.searchable && !strcmp(action, "Search"))))
+    {
+        const bool browse = !strcmp(action, "Browse");
+        std::string didl =
+            "<DIDL-Lite xmlns=\"urn:schemas-upnp-org:metadata-1-0/DIDL-Lite/\" xmlns:dc=\"http://purl.org/dc/elements/1.1/\" "
+            "xmlns:upnp=\"urn:schemas-upnp-org:metadata-1-0/upnp/\" xmlns:pv=\"http://www.pv.com/pvns/\" xmlns:sec=\"http://www.sec.co.kr/\">";
+        unsigned int returned = 0;
+        unsigned int total = 0;
+        if (!(browse ? Browse(arguments, didl, returned, total) : Search(arguments, didl, returned, total)))
+        {
+            UpnpActionRequest_set_ErrCode(request, 708); /* Unsupported or invalid search criteria */
+            return UPNP_E_SUCCESS;
+        }
+        didl += "</DIDL-Lite>";
+
+        response = "<u:" + std::string(action) + "Response xmlns:u=\"" + std::string(CONTENT_DIRECTORY) + "\"><Result>";
+        AppendEscaped(response, didl);
+        response += "</Result><NumberReturned>" + std::to_string(returned)
+            + "</NumberReturned><TotalMatches>" + std::to_string(total)
+            + "</TotalMatches><UpdateID>1</UpdateID></u:" + action + "Response>";
+
+        if (options.latency.count())
+            std::this_thread::sleep_for(options.latency);
+    }
+    else
+    {
+        UpnpActionRequest_set_ErrCode(request, 401); /* Invalid Action */
+        return UPNP_E_SUCCESS;
+    }
+
+    IXML_Document* result = ixmlParseBuffer(response.c_str());
+    if (!result)
+    {
+        UpnpActionRequest_set_ErrCode(request, 501); /* Action Failed */
+        return UPNP_E_SUCCESS;
+    }
+    UpnpActionRequest_set_ErrCode(request, UPNP_E_SUCCESS);
+    UpnpActionRequest_set_ActionResult(request, result);
+    return UPNP_E_SUCCESS;
+}
+
+bool MediaServerStub::Browse(IXML_Element* arguments, std::string& didl, unsigned int& returned, unsigned int& total)
+{
+    browseRequests++;
+    const char* objectID = ixmlElement_getFirstChildElementValue(arguments, "ObjectID");
+    unsigned int start = ToUnsigned(ixmlElement_getFirstChildElementValue(arguments, "StartingIndex"));
+    unsigned int count = ToUnsigned(ixmlElement_getFirstChildElementValue(arguments, "RequestedCount"));
+    const char* filter = ixmlElement_getFirstChildElementValue(arguments, "Filter");
+    AppendChildren(didl, objectID ? objectID : "0", filter ? filter : "*", start, count ? count : UINT32_MAX, returned, total);
+    return true;
+}
+
+bool MediaServerStub::Search(IXML_Element* arguments, std::string& didl, unsigned int& returned, unsigned int& total)
+{
+    searchRequests++;
+    const char* criteria = ixmlElement_getFirstChildElementValue(arguments, "SearchCriteria");
+    std::string_view prefix = "dc:title contains \"";
+    if (!criteria || !std::string_view(criteria).starts_with(prefix) || !std::string_view(criteria).ends_with("\""))
+        return false;
+    std::string pattern;
+    for (const char* c = criteria + prefix.size(); c[1]; c++)
+    {
+        if (*c == '\\' && c[2])
+            c++;
+        pattern += *c;
+    }
+
+    unsigned int start = ToUnsigned(ixmlElement_getFirstChildElementValue(arguments, "StartingIndex"));
+    unsigned int count = ToUnsigned(ixmlElement_getFirstChildElementValue(arguments, "RequestedCount"));
+    if (!count)
+        count = UINT32_MAX;
+    for (unsigned int folder = 0; folder < options.folders; folder++)
+    {
+        for (unsigned int index = 0; index < options.itemsPerFolder; index++)
+        {
+            std::string item;
+            AppendItem(item, folder, index, "*");
+            size_t title = item.find("<dc:title>") + 10;
+            if (std::string_view(item).substr(title, item.find("</dc:title>") - title).find(pattern) == std::string_view::npos)
+                continue;
+            if (total++ >= start && returned < count)
+            {
+                didl += item;
+                returned++;
+            }
+        }
+    }
+    return true;
+}
+
+int MediaServerStub::AcceptSubscription(UpnpSubscriptionRequest* request)
+{
+    /* Content never changes, the initial SystemUpdateID is the only event sent */
+    const char* names[] = { "SystemUpdateID" };
+    const char* values[] = { "1" };
+    return UpnpAcceptSubscription(handle, UpnpSubscriptionRequest_get_UDN_cstr(request), UpnpSubscriptionRequest_get_ServiceId_cstr(request),
+        names, values, 1, UpnpSubscriptionRequest_get_SID_cstr(request));
+}
+
+void MediaServerStub::AppendChildren(std::string& didl, const std::string& objectID, std::string_view filter, unsigned int start, unsigned int count, unsigned int& returned, unsigned int& total) const
+{
+    if (objectID == "0")
+    {
+        total = options.folders;
+        for (unsigned int folder = start; folder < total && returned < count; folder++, returned++)
+        {
+            const std::string id = "f" + std::to_string(folder);
+            didl += "<container id=\"" + id + "\" parentID=\"0\" restricted=\"1\" childCount=\"" + std::to_string(options.itemsPerFolder) + "\">"
+                "<dc:title>Folder " + std::to_string(folder) + "</dc:title>"
+                "<upnp:class>object.container.storageFolder</upnp:class>"
+                "</container>";
+        }
+        return;
+    }
+
+    if (objectID.size() < 2 || objectID[0] != 'f')
+        return;
+    const unsigned int folder = ToUnsigned(objectID.c_str() + 1);
+    if (folder >= options.folders)
+        return;
+
+    total = options.itemsPerFolder + (options.rootAlias ? 1 : 0);
+    if (options.rootAlias && start == 0 && returned < count)
+    {
+        didl += "<container id=\"0\" parentID=\"" + objectID + "\" restricted=\"1\"><dc:title>Root</dc:title>"
+            "<upnp:class>object.container.storageFolder</upnp:class></container>";
+        returned++;
+    }
+    for (unsigned int index = start ? start - (options.rootAlias ? 1 : 0) : 0; index < options.itemsPerFolder && returned < count; index++, returned++)
+        AppendItem(didl, folder, index, filter);
+}
+
+void MediaServerStub::AppendItem(std::string& didl, unsigned int folder, unsigned int index, std::string_view filter) const
+{
+    static const char* const classes[] = { "object.item.videoItem", "object.item.audioItem.musicTrack", "object.item.imageItem.photo" };
+    static const char* const mimes[] = { "video/mp4", "audio/mpeg", "image/jpeg" };
+    static const char* const extensions[] = { "mp4", "mp3", "jpg" };
+    const unsigned int kind = index % 3;
+
+    const std::string parent = "f" + std::to_string(folder);
+    const std::string id = parent + "/" + std::to_string(index);
+    const std::string url = mediaBaseUrl + parent + "/" + std::to_string(index) + "." + extensions[kind];
+
+    didl += "<item id=\"" + id + "\" parentID=\"" + parent + "\" restricted=\"1\"><dc:title>";
+    if (options.richMetadata)
+        didl += "Title &amp; &quot;subtitle&quot; #" + std::to_string(index);
+    else
+        didl += "Item " + std::to_string(index);
+    didl += "</dc:title><upnp:class>" + std::string(classes[kind]) + "</upnp:class>";
+
+    /* Properties left out by the filter are not sent, @id, dc:title, upnp:class and res@protocolInfo always are */
+    auto property = [&](const char* name, const std::string& value)
+    {
+        if (options.richMetadata && Requested(filter, name))
+            didl += std::string("<") + name + ">" + value + "</" + name + ">";
+    };
+    property("dc:date", "2023-05-17T10:00:00");
+    property("upnp:artist", "Artist " + std::to_string(index % 17));
+    property("upnp:genre", "Genre " + std::to_string(index % 5));
+    property("upnp:album", "Album " + std::to_string(index % 31));
+    property("upnp:albumArtist", "Album artist");
+    property("upnp:originalTrackNumber", std::to_string(index % 12 + 1));
+    property("upnp:albumArtURI", mediaBaseUrl + "art/" + std::to_string(index % 31) + ".jpg");
+    if (options.captionInfo && kind == 0 && Requested(filter, "sec:CaptionInfo"))
+        didl += "<sec:CaptionInfo sec:type=\"srt\">" + mediaBaseUrl + parent + "/" + std::to_string(index) + ".srt</sec:CaptionInfo>";
+
+    if (Requested(filter, "res"))
+    {
+        didl += "<res protocolInfo=\"http-get:*:" + std::string(mimes[kind]) + ":*\"";
+        if (Requested(filter, "res@size"))
+            didl += " size=\"" + std::to_string(1048576 + index) + "\"";
+        if (kind != 2 && Requested(filter, "res@duration"))
+            didl += " duration=\"0:03:" + std::to_string(10 + index % 50) + ".000\"";
+        if (kind != 1 && Requested(filter, "res@resolution"))
+            didl += " resolution=\"1920x1080\"";
+        if (options.richMetadata && !options.captionInfo && kind == 0 && Requested(filter, "res@pv:subtitleFileUri"))
+            didl += " pv:subtitleFileUri=\"" + mediaBaseUrl + parent + "/" + std::to_string(index) + ".srt\"";
+        didl += ">" + url + "</res>";
+
+        if (options.richMetadata && kind != 2)
+            didl += "<res protocolInfo=\"http-get:*:image/jpeg:DLNA.ORG_PN=JPEG_TN\">" + mediaBaseUrl + "thumb/" + id + ".jpg</res>";
+    }
+    didl += "</item>";
+}
@@ -0,0 +1,56 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <string_view>
+
+#include "upnp.h"
+
+struct MediaServerOptions
+{
+    unsigned int folders = 4;               // Containers under the root object "0"
+    unsigned int itemsPerFolder = 1000;
+    bool richMetadata = false;              // Artist, album, genre, album art, subtitles and escaped titles
+    std::chrono::milliseconds latency{ 0 }; // Added to every Browse answer
+    bool searchable = false;                // Answers Search on dc:title, otherwise reports no SearchCapabilities
+    bool captionInfo = false;               // Video subtitles as sec:CaptionInfo, the way Samsung servers send them, instead of on the res
+    bool rootAlias = false;                 // Every folder ends with an alias of the root container, a loop in the tree
+};
+
+/*
+ * Synthetic MediaServer:1 with a ContentDirectory:1 service, registered through pupnp's
+ * device API in the calling process. UpnpInit2 must have been called already.
+ *
+ * Folder "f<i>" holds items "f<i>/<j>", videos, songs and pictures in turn.
+ * Browse honours the Filter argument. Search only understands 'dc:title contains "..."',
+ * case sensitive.
+ */
+class MediaServerStub
+{
+public:
+    explicit MediaServerStub(const MediaServerOptions& options);
+    ~MediaServerStub();
+
+    int Start();
+    void Stop();
+
+    const std::string& UDN() const { return udn; }
+    unsigned long BrowseRequests() const { return browseRequests.load(); }
+    unsigned long SearchRequests() const { return searchRequests.load(); }
+
+private:
+    static int Callback(Upnp_EventType eventType, const void* event, void* cookie);
+    int Control(UpnpActionRequest* request);
+    bool Browse(IXML_Element* arguments, std::string& didl, unsigned int& returned, unsigned int& total);
+    bool Search(IXML_Element* arguments, std::string& didl, unsigned int& returned, unsigned int& total);
+    int AcceptSubscription(UpnpSubscriptionRequest* request);
+    void AppendChildren(std::string& didl, const std::string& objectID, std::string_view filter, unsigned int start, unsigned int count, unsigned int& returned, unsigned int& total) const;
+    void AppendItem(std::string& didl, unsigned int folder, unsigned int index, std::string_view filter) const;
+
+    const MediaServerOptions options;
+    const std::string udn;
+    std::string mediaBaseUrl;
+    UpnpDevice_Handle handle = -1;
+    std::atomic<unsigned long> browseRequests{ 0 };
+    std::atomic<unsigned long> searchRequests{ 0 };
+};
@@ -0,0 +1,102 @@
+/*
+ * Base64Encode against base64_encode: every encoder this CPU has must match it byte for
+ * byte, then both are timed on a browse-sized DIDL document.
+ *
+ * bench_base64 [megabytes] [iterations]
+ */
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+
+#include "base64.h"
+#include "Base64Simd.h"
+
+namespace
+{
+    using Clock = std::chrono::steady_clock;
+
+    const char* Name(Base64Isa isa)
+    {
+        switch (isa)
+        {
+        case Base64Isa::SSSE3: return "ssse3";
+        case Base64Isa::AVX2: return "avx2";
+        case Base64Isa::NEON: return "neon";
+        default: return "scalar";
+        }
+    }
+
+    double MegabytesPerSecond(size_t bytes, Clock::duration duration)
+    {
+        return bytes / 1048576.0 / std::chrono::duration<double>(duration).count();
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    const size_t megabytes = argc > 1 ? strtoul(argv[1], nullptr, 10) : 8;
+    const unsigned int iterations = argc > 2 ? atoi(argv[2]) : 5;
+
+    std::mt19937 random(42);
+    std::string data(4096, '\0');
+    for (char& c : data)
+        c = static_cast<char>(random());
+
+    /* Every length up to a few vectors, so each loop and tail is exercised */
+    for (Base64Isa isa : { Base64Isa::Scalar, Base64Isa::SSSE3, Base64Isa::AVX2, Base64Isa::NEON })
+    {
+        std::string encoded;
+        if (!Base64EncodeWith(isa, nullptr, 0, encoded.data()))
+            continue;
+        for (bool url : { false, true })
+        {
+            for (size_t length = 0; length <= 400; length++)
+            {
+                for (size_t offset : { size_t{ 0 }, size_t{ 1 }, size_t{ 7 } })
+                {
+                    const auto* in = reinterpret_cast<const unsigned char*>(data.data() + offset);
+                    encoded.assign(Base64EncodedLength(length), '\0');
+                    Base64EncodeWith(isa, in, length, encoded.data(), url);
+                    if (encoded != base64_encode(in, length, url))
+                    {
+                        fprintf(stderr, "%s encoder differs from base64_encode, length %zu, offset %zu, url %d\n", Name(isa), length, offset, url);
+                        return 1;
+                    }
+                }
+            }
+        }
+        printf("%s matches base64_encode\n", Name(isa));
+    }
+
+    /* Markup compresses to a small alphabet, like the DIDL documents sent in v1.0 responses */
+    std::string didl;
+    didl.reserve(megabytes * 1048576);
+    while (didl.size() < megabytes * 1048576)
+        didl += "<item id=\"f1/" + std::to_string(didl.size()) + "\" parentID=\"f1\" restricted=\"1\"><dc:title>Item</dc:title>"
+            "<upnp:class>object.item.videoItem</upnp:class><res protocolInfo=\"http-get:*:video/mp4:*\">http://192.168.1.2/v.mp4</res></item>";
+
+    Clock::duration legacy{};
+    Clock::duration simd{};
+    std::string encoded(Base64EncodedLength(didl.size()), '\0');
+    for (unsigned int i = 0; i < iterations; i++)
+    {
+        Clock::time_point start = Clock::now();
+        std::string result = base64_encode(didl, false);
+        legacy += Clock::now() - start;
+
+        start = Clock::now();
+        Base64Encode(reinterpret_cast<const unsigned char*>(didl.data()), didl.size(), encoded.data());
+        simd += Clock::now() - start;
+        if (result != encoded)
+        {
+            fprintf(stderr, "Base64Encode differs from base64_encode on the document\n");
+            return 1;
+        }
+    }
+
+    printf("base64_encode       %8.1f MB/s\n", MegabytesPerSecond(didl.size() * iterations, legacy));
+    printf("Base64Encode %-6s %8.1f MB/s\n", Name(Base64BestIsa()), MegabytesPerSecond(didl.size() * iterations, simd));
+    return 0;
+}
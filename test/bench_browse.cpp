@@ -0,0 +1,440 @@
+/*
+ * Discovery and browse benchmark against MediaServerStub, through the exported DLNAModule API.
+ *
+ * bench_browse [--folders N] [--items N] [--rich] [--latency MS] [--pagesize N] [--iterations N] [--timeout S] [--burst N]
+ *              [--fields KEY,...] [--captions] [--cancel]
+ *
+ * --burst sends every folder request N times at once as well: they must share the actions of
+ * the first one and all get the whole folder.
+ *
+ * --fields asks for those item keys only, results carrying any other key but "type" are errors.
+ *
+ * --captions has the server give video subtitles as sec:CaptionInfo, every video must come
+ * back with its subtitle.
+ *
+ * --cancel cancels the browse of the first folder once its first page arrived: no page may
+ * follow, and the request must be counted as cancelled.
+ *
+ * Iterations run with the browse cache disabled, so they time the browse path. The same
+ * number of iterations then runs once the cache is filled, and is reported as cached.
+ * Bursts and --cancel run without the cache again.
+ *
+ * Returns 1 when a browse reports an error or misses items, 77 when no usable network interface
+ * was found (DLNA_IFNAME selects one).
+ */
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "rapidjson/document.h"
+#include "rapidjson/stringbuffer.h"
+#include "rapidjson/writer.h"
+
+#include "MediaServerStub.h"
+
+extern "C"
+{
+#if not ENABLE_SLOG
+    bool SetLogFile(const char* path);
+#endif
+    void SKYBOXStartupDLNA();
+    void SKYBOXShutdownDLNA();
+    void SKYBOXDLNAUpdate();
+    bool BrowseDLNAFolder2(const char* json, void (*OnBrowseResultCallback)(const char*));
+    uint32_t BrowseDLNAFolder3(const char* json, void (*OnBrowseResultCallback)(const char*));
+    bool CancelDLNARequest(uint32_t requestID);
+    void GetDLNARequestStats(struct DLNARequestStats* stats);
+    void SetDLNABrowseCacheBudget(unsigned int bytes);
+    void SetAddDLNADeviceCallback(void (*OnAddDLNADevice)(const char* uuid, int uuidLength, const char* title, int titleLength, const char* iconurl, int iconLength, const char* manufacturer, int manufacturerLength));
+    void SetRemoveDLNADeviceCallback(void (*OnRemoveDLNADevice)(const char* uuid, int uuidLength));
+}
+
+struct DLNARequestStats
+{
+    uint32_t inFlight, queuedActions, completed, cancelled, expired, refused, latencyP50Ms, latencyP95Ms, latencyMaxMs;
+};
+
+namespace
+{
+    using Clock = std::chrono::steady_clock;
+
+    constexpr unsigned int BrowseCacheBudget = 16 * 1024 * 1024; // What DLNAModule starts with
+
+    std::string serverUDN;
+    std::atomic<bool> serverFound{ false };
+    std::vector<std::string> fields; // Sent with every request when not empty
+    bool captions = false;
+
+    std::mutex browseMutex;
+    std::condition_variable browseDone;
+    struct
+    {
+        unsigned long objects = 0;
+        unsigned long long bytes = 0;
+        int status = 0;
+        bool complete = false;
+        unsigned int completed = 0; // Browses done, for bursts
+        unsigned int responses = 0;
+    } browse;
+
+    void OnAddDevice(const char* uuid, int uuidLength, const char*, int, const char*, int, const char*, int)
+    {
+        if (std::string(uuid, uuidLength) == serverUDN)
+            serverFound = true;
+    }
+
+    void OnRemoveDevice(const char*, int)
+    {
+    }
+
+    void OnBrowseResult(const char* json)
+    {
+        rapidjson::Document response;
+        response.Parse(json);
+
+        std::lock_guard<std::mutex> lock(browseMutex);
+        browse.bytes += strlen(json);
+        browse.responses++;
+        if (response.HasParseError() || !response.IsObject())
+        {
+            browse.status = -1;
+            browse.complete = true;
+        }
+        else
+        {
+            if (response.HasMember("results") && response["results"].IsArray())
+            {
+                browse.objects += response["results"].Size();
+                for (const rapidjson::Value& object : response["results"].GetArray())
+                {
+                    /* Type 0 is a video */
+                    if (captions && object.HasMember("type") && object["type"] == 0
+                        && (!object.HasMember("subtitle") || !object["subtitle"].IsString() || !object["subtitle"].GetStringLength()))
+                        browse.status = -1;
+                    for (auto member = object.MemberBegin(); !fields.empty() && member != object.MemberEnd(); ++member)
+                    {
+                        const std::string_view key = member->name.GetString();
+                        if (key != "type" && std::find(fields.begin(), fields.end(), key) == fields.end())
+                            browse.status = -1;
+                    }
+                }
+            }
+            if (response.HasMember("status") && response["status"].IsInt() && response["status"].GetInt())
+                browse.status = response["status"].GetInt();
+            browse.complete = !response.HasMember("complete") || response["complete"].GetBool();
+        }
+        if (browse.complete)
+            browse.completed++;
+        browseDone.notify_all();
+    }
+
+    std::string BrowseRequest(const std::string& objectID, unsigned int pageSize)
+    {
+        rapidjson::StringBuffer arguments;
+        {
+            rapidjson::Writer<rapidjson::StringBuffer> writer(arguments);
+            writer.StartObject();
+            writer.Key("uuid");
+            writer.String(serverUDN.c_str());
+            writer.Key("objid");
+            writer.String(objectID.c_str());
+            if (pageSize)
+            {
+                writer.Key("pagesize");
+                writer.Uint(pageSize);
+            }
+            if (!fields.empty())
+            {
+                writer.Key("fields");
+                writer.StartArray();
+                for (const std::string& field : fields)
+                    writer.String(field.c_str());
+                writer.EndArray();
+            }
+            writer.EndObject();
+        }
+
+        rapidjson::StringBuffer request;
+        rapidjson::Writer<rapidjson::StringBuffer> writer(request);
+        writer.StartObject();
+        writer.Key("version");
+        writer.String("2.0");
+        writer.Key("method");
+        writer.String("DLNABrowseRequest");
+        writer.Key("arguments");
+        writer.String(arguments.GetString());
+        writer.EndObject();
+        return request.GetString();
+    }
+
+    // Returns the number of objects received, or -1 on error or timeout. Adds the size of the responses to bytes.
+    long Browse(const std::string& objectID, unsigned int pageSize, std::chrono::seconds timeout, unsigned long long& bytes)
+    {
+        {
+            std::lock_guard<std::mutex> lock(browseMutex);
+            browse = {};
+        }
+        if (!BrowseDLNAFolder2(BrowseRequest(objectID, pageSize).c_str(), OnBrowseResult))
+            return -1;
+
+        std::unique_lock<std::mutex> lock(browseMutex);
+        if (!browseDone.wait_for(lock, timeout, [] { return browse.complete; }) || browse.status)
+            return -1;
+        bytes += browse.bytes;
+        return static_cast<long>(browse.objects);
+    }
+
+    // Sends the same request count times at once, returns the objects all of them received, or -1.
+    long BrowseBurst(const std::string& objectID, unsigned int pageSize, unsigned int count, std::chrono::seconds timeout)
+    {
+        {
+            std::lock_guard<std::mutex> lock(browseMutex);
+            browse = {};
+        }
+        const std::string request = BrowseRequest(objectID, pageSize);
+        for (unsigned int i = 0; i < count; i++)
+        {
+            if (!BrowseDLNAFolder2(request.c_str(), OnBrowseResult))
+                return -1;
+        }
+
+        std::unique_lock<std::mutex> lock(browseMutex);
+        if (!browseDone.wait_for(lock, timeout, [count] { return browse.completed >= count; }) || browse.status)
+            return -1;
+        return static_cast<long>(browse.objects);
+    }
+
+    // Cancels a paged browse after its first page, returns false when a page came after or the request was not cancelled.
+    bool BrowseCancelled(const std::string& objectID, unsigned int pageSize, std::chrono::seconds timeout)
+    {
+        {
+            std::lock_guard<std::mutex> lock(browseMutex);
+            browse = {};
+        }
+        const uint32_t id = BrowseDLNAFolder3(BrowseRequest(objectID, pageSize).c_str(), OnBrowseResult);
+        if (!id)
+            return false;
+        {
+            std::unique_lock<std::mutex> lock(browseMutex);
+            if (!browseDone.wait_for(lock, timeout, [] { return browse.responses > 0; }) || browse.complete)
+                return false;
+        }
+        if (!CancelDLNARequest(id))
+            return false;
+        unsigned int responses;
+        {
+            std::lock_guard<std::mutex> lock(browseMutex);
+            responses = browse.responses;
+        }
+
+        /* The action in flight is answered and dropped, then the request finishes */
+        DLNARequestStats stats{};
+        const Clock::time_point cancelled = Clock::now();
+        do
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            GetDLNARequestStats(&stats);
+        } while (stats.inFlight && Clock::now() - cancelled < timeout);
+
+        std::lock_guard<std::mutex> lock(browseMutex);
+        printf("cancelled after %u of %lu objects, %u requests cancelled\n", responses, browse.objects, stats.cancelled);
+        return !stats.inFlight && stats.cancelled >= 1 && browse.responses == responses && !CancelDLNARequest(id);
+    }
+
+    long PeakResidentKiB()
+    {
+        std::ifstream status("/proc/self/status");
+        std::string line;
+        while (std::getline(status, line))
+            if (line.rfind("VmHWM:", 0) == 0)
+                return strtol(line.c_str() + 6, nullptr, 10);
+        return -1;
+    }
+
+    double Milliseconds(Clock::duration duration)
+    {
+        return std::chrono::duration<double, std::milli>(duration).count();
+    }
+
+    // Browses the root and every folder once, returns false when one of them misses objects.
+    bool BrowseAll(MediaServerStub& server, const MediaServerOptions& options, unsigned int pageSize, std::chrono::seconds timeout, const char* label)
+    {
+        unsigned long objects = 0;
+        unsigned long long bytes = 0;
+        const unsigned long requestsBefore = server.BrowseRequests();
+        const Clock::time_point start = Clock::now();
+        long folders = Browse("0", pageSize, timeout, bytes);
+        if (folders != static_cast<long>(options.folders))
+        {
+            fprintf(stderr, "Root listed %ld folders, expected %u\n", folders, options.folders);
+            return false;
+        }
+        objects += folders;
+
+        for (unsigned int folder = 0; folder < options.folders; folder++)
+        {
+            long items = Browse("f" + std::to_string(folder), pageSize, timeout, bytes);
+            if (items != static_cast<long>(options.itemsPerFolder))
+            {
+                fprintf(stderr, "Folder f%u listed %ld items, expected %u\n", folder, items, options.itemsPerFolder);
+                return false;
+            }
+            objects += items;
+        }
+
+        const double elapsed = Milliseconds(Clock::now() - start);
+        printf("%s: %lu objects, %lu requests, %.1f ms, %.0f items/s, %llu bytes of responses\n", label, objects,
+            server.BrowseRequests() - requestsBefore, elapsed, objects * 1000.0 / elapsed, bytes);
+        return true;
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    MediaServerOptions options;
+    unsigned int pageSize = 0;
+    unsigned int iterations = 3;
+    unsigned int burst = 0;
+    bool cancel = false;
+    std::chrono::seconds timeout{ 30 };
+    for (int i = 1; i < argc; i++)
+    {
+        const bool hasValue = i + 1 < argc;
+        if (!strcmp(argv[i], "--folders") && hasValue)
+            options.folders = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--items") && hasValue)
+            options.itemsPerFolder = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--rich"))
+            options.richMetadata = true;
+        else if (!strcmp(argv[i], "--latency") && hasValue)
+            options.latency = std::chrono::milliseconds(atoi(argv[++i]));
+        else if (!strcmp(argv[i], "--pagesize") && hasValue)
+            pageSize = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--iterations") && hasValue)
+            iterations = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--timeout") && hasValue)
+            timeout = std::chrono::seconds(atoi(argv[++i]));
+        else if (!strcmp(argv[i], "--burst") && hasValue)
+            burst = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--cancel"))
+            cancel = true;
+        else if (!strcmp(argv[i], "--captions"))
+            options.captionInfo = captions = true;
+        else if (!strcmp(argv[i], "--fields") && hasValue)
+        {
+            for (std::string_view list = argv[++i]; !list.empty();)
+            {
+                const size_t comma = std::min(list.find(','), list.size());
+                fields.emplace_back(list.substr(0, comma));
+                list.remove_prefix(std::min(comma + 1, list.size()));
+            }
+        }
+        else
+        {
+            fprintf(stderr, "usage: %s [--folders N] [--items N] [--rich] [--latency MS] [--pagesize N] [--iterations N] [--timeout S] [--burst N]"
+                " [--fields KEY,...] [--captions] [--cancel]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    /* Logs and the description cache go to a scratch directory */
+    const std::filesystem::path scratch = std::filesystem::temp_directory_path() / ("dlna_bench_" + std::to_string(Clock::now().time_since_epoch().count()));
+    std::filesystem::create_directories(scratch);
+#if not ENABLE_SLOG
+    SetLogFile((scratch / "bench.log").string().c_str());
+#endif
+
+    SetAddDLNADeviceCallback(OnAddDevice);
+    SetRemoveDLNADeviceCallback(OnRemoveDevice);
+    SKYBOXStartupDLNA();
+
+    int result = 0;
+    MediaServerStub server(options);
+    serverUDN = server.UDN();
+    const Clock::time_point advertised = Clock::now();
+    if (server.Start() != UPNP_E_SUCCESS)
+    {
+        fprintf(stderr, "No usable network interface, set DLNA_IFNAME\n");
+        result = 77;
+    }
+
+    while (!result && !serverFound && Clock::now() - advertised < timeout)
+    {
+        SKYBOXDLNAUpdate();
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    if (!result && !serverFound)
+    {
+        fprintf(stderr, "Server was not discovered within %llds\n", static_cast<long long>(timeout.count()));
+        result = 1;
+    }
+
+    if (!result)
+    {
+        printf("discovery to callback: %.1f ms\n", Milliseconds(Clock::now() - advertised));
+        printf("folders=%u items/folder=%u rich=%d latency=%lldms pagesize=%u\n", options.folders, options.itemsPerFolder, options.richMetadata,
+            static_cast<long long>(options.latency.count()), pageSize);
+
+        /* Without the cache every iteration after the first would only time cache hits */
+        SetDLNABrowseCacheBudget(0);
+        for (unsigned int iteration = 0; iteration < iterations && !result; iteration++)
+        {
+            const std::string label = "uncached iteration " + std::to_string(iteration);
+            if (!BrowseAll(server, options, pageSize, timeout, label.c_str()))
+                result = 1;
+        }
+        if (iterations && !result)
+        {
+            SetDLNABrowseCacheBudget(BrowseCacheBudget);
+            if (!BrowseAll(server, options, pageSize, timeout, "filling the cache"))
+                result = 1;
+        }
+        for (unsigned int iteration = 0; iteration < iterations && !result; iteration++)
+        {
+            const std::string label = "cached iteration " + std::to_string(iteration);
+            if (!BrowseAll(server, options, pageSize, timeout, label.c_str()))
+                result = 1;
+        }
+        SetDLNABrowseCacheBudget(0);
+        for (unsigned int folder = 0; folder < options.folders && burst > 1 && !result; folder++)
+        {
+            /* One request's worth of actions for the whole burst */
+            const unsigned long requestsBefore = server.BrowseRequests();
+            long objects = BrowseBurst("f" + std::to_string(folder), pageSize, burst, timeout);
+            const unsigned long requests = server.BrowseRequests() - requestsBefore;
+            const unsigned long pages = pageSize ? (options.itemsPerFolder + pageSize - 1) / pageSize : 1;
+            if (objects != static_cast<long>(options.itemsPerFolder) * burst || requests > pages)
+            {
+                fprintf(stderr, "Burst of %u on f%u: %ld objects, expected %lu, %lu requests for %lu pages\n", burst, folder, objects,
+                    static_cast<unsigned long>(options.itemsPerFolder) * burst, requests, pages);
+                result = 1;
+            }
+            else if (folder == 0)
+                printf("burst of %u: %lu requests for %ld objects\n", burst, requests, objects);
+        }
+        if (cancel && !result && !BrowseCancelled("f0", pageSize, timeout))
+        {
+            fprintf(stderr, "Cancelled browse of f0 went on\n");
+            result = 1;
+        }
+        printf("peak resident: %ld KiB\n", PeakResidentKiB());
+    }
+
+    server.Stop();
+    SKYBOXShutdownDLNA();
+    std::error_code error;
+    std::filesystem::remove_all(scratch, error);
+    return result;
+}
@@ -0,0 +1,83 @@
+#include <chrono>
+#include <cstdio>
+#include <string>
+
+#include "URLHandler.h"
+
+/* ConvertHTMLtoXML as it was before the single pass decoder, kept as the reference */
+static std::string ConvertHTMLtoXMLReplaceAll(const char* src)
+{
+    const char* replacements[][2] = {
+        { "\xc3\x97", "x" },
+        { "&amp;", "&" },
+        { "&quot;", "\"" },
+        { "&gt;", ">" },
+        { "&lt;", "<" },
+        { "&apos;", "'" },
+        { "<unknown>", "unknown" },
+    };
+
+    std::string srcstr(src);
+    for (const auto& [oldValue, newValue] : replacements)
+    {
+        size_t lengthBefore = 0;
+        do
+        {
+            lengthBefore = srcstr.length();
+            srcstr = ReplaceAll(srcstr.data(), srcstr.length(), oldValue, newValue);
+        } while (lengthBefore != srcstr.length());
+    }
+    return srcstr;
+}
+
+/* Looks like what ixmlDocumenttoString gives for a v1.0 browse response */
+static std::string MakeBrowseResponse(int items)
+{
+    std::string response = "<?xml version=\"1.0\"?>\r\n<u:BrowseResponse xmlns:u=\"urn:schemas-upnp-org:service:ContentDirectory:1\"><Result>"
+        "&lt;DIDL-Lite xmlns=&quot;urn:schemas-upnp-org:metadata-1-0/DIDL-Lite/&quot; xmlns:dc=&quot;http://purl.org/dc/elements/1.1/&quot;&gt;";
+    for (int i = 0; i < items; i++)
+    {
+        std::string id = std::to_string(i);
+        response += "&lt;item id=&quot;64$" + id + "&quot; parentID=&quot;64&quot; restricted=&quot;1&quot;&gt;"
+            "&lt;dc:title&gt;Tom &amp;amp; Jerry 1920\xc3\x97" "1080 part " + id + "&lt;/dc:title&gt;"
+            "&lt;upnp:artist&gt;&lt;unknown&gt;&lt;/upnp:artist&gt;"
+            "&lt;upnp:class&gt;object.item.videoItem&lt;/upnp:class&gt;"
+            "&lt;res protocolInfo=&quot;http-get:*:video/mp4:DLNA.ORG_OP=01;DLNA.ORG_CI=0&quot; size=&quot;1234567&quot; duration=&quot;0:42:00.000&quot;&gt;"
+            "http://192.168.1.2:8200/MediaItems/" + id + ".mp4?a=1&amp;amp;b=2&lt;/res&gt;&lt;/item&gt;";
+    }
+    response += "&lt;/DIDL-Lite&gt;</Result><NumberReturned>" + std::to_string(items) + "</NumberReturned></u:BrowseResponse>";
+    return response;
+}
+
+template <typename Function>
+static double Measure(Function&& function, int rounds)
+{
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < rounds; i++)
+        function();
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / rounds;
+}
+
+int main()
+{
+    int failures = 0;
+    for (int items : { 100, 1000, 10000 })
+    {
+        const std::string response = MakeBrowseResponse(items);
+        const std::string expected = ConvertHTMLtoXMLReplaceAll(response.c_str());
+        const std::string actual = ConvertHTMLtoXML(response.c_str());
+        if (expected != actual)
+        {
+            printf("%d items: output differs from the ReplaceAll implementation\n", items);
+            failures++;
+            continue;
+        }
+
+        const int rounds = items >= 10000 ? 3 : 20;
+        double before = Measure([&] { ConvertHTMLtoXMLReplaceAll(response.c_str()); }, rounds);
+        double after = Measure([&] { ConvertHTMLtoXML(response.c_str()); }, rounds);
+        printf("%6d items, %8zu bytes: ReplaceAll %9.3f ms, single pass %8.3f ms (%.1fx, %.0f MB/s)\n",
+            items, response.size(), before, after, before / after, response.size() / after / 1000.0);
+    }
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,129 @@
+/*
+ * ParseUrl and malloc + UpnpResolveURL against ParseUrlView and ResolveUrl, on the URLs a
+ * discovery pass handles. Returns 1 when the two disagree.
+ *
+ * bench_url [iterations]
+ */
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include "upnptools.h"
+#include "URLHandler.h"
+
+namespace
+{
+    using Clock = std::chrono::steady_clock;
+
+    const char* locations[] = {
+        "http://192.168.1.10:8200/rootDesc.xml",
+        "http://192.168.1.23:49152/description.xml",
+        "http://user@nas.local:5000/dev/0011-2233/desc.xml",
+        "http://[fe80::1]:1400/xml/device_description.xml",
+        "http://192.168.1.40:9000/plugins/UPnP/MediaServer.xml",
+    };
+
+    const char* references[] = {
+        "/ctl/ContentDir",
+        "upnp/control/content_directory",
+        "../icons/sm.png",
+        "http://192.168.1.41:8080/cds/control",
+    };
+
+    double Nanoseconds(Clock::duration duration, unsigned long operations)
+    {
+        return std::chrono::duration<double, std::nano>(duration).count() / operations;
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    const unsigned long iterations = argc > 1 ? strtoul(argv[1], nullptr, 10) : 200000;
+    const size_t locationCount = sizeof(locations) / sizeof(locations[0]);
+    const size_t referenceCount = sizeof(references) / sizeof(references[0]);
+    int result = 0;
+
+    /* Both parsers must agree before timing them */
+    for (const char* location : locations)
+    {
+        URLInfo info;
+        URLView view;
+        char scratch[256];
+        const bool legacy = ParseUrl(&info, location) == 0 && info.host;
+        const bool parsed = ParseUrlView(location, view, scratch);
+        if (legacy != parsed || (parsed && (view.host != info.host || view.port != info.port)))
+        {
+            fprintf(stderr, "ParseUrl and ParseUrlView disagree on %s\n", location);
+            result = 1;
+        }
+        free(info.host);
+        free(info.buffer);
+
+        for (const char* reference : references)
+        {
+            char* legacyUrl = (char*)malloc(strlen(location) + strlen(reference) + 1);
+            std::string resolved;
+            if (UpnpResolveURL(location, reference, legacyUrl) != UPNP_E_SUCCESS || !ResolveUrl(location, reference, resolved) || resolved != legacyUrl)
+            {
+                fprintf(stderr, "UpnpResolveURL and ResolveUrl disagree on %s + %s: %s, %s\n", location, reference, legacyUrl, resolved.c_str());
+                result = 1;
+            }
+            free(legacyUrl);
+        }
+    }
+
+    size_t checksum = 0;
+    Clock::time_point start = Clock::now();
+    for (unsigned long i = 0; i < iterations; i++)
+    {
+        URLInfo info;
+        if (ParseUrl(&info, locations[i % locationCount]) == 0 && info.host)
+            checksum += strlen(info.host);
+        free(info.host);
+        free(info.buffer);
+    }
+    const double legacyParse = Nanoseconds(Clock::now() - start, iterations);
+
+    start = Clock::now();
+    for (unsigned long i = 0; i < iterations; i++)
+    {
+        URLView view;
+        char scratch[256];
+        if (ParseUrlView(locations[i % locationCount], view, scratch))
+            checksum -= view.host.size();
+    }
+    const double viewParse = Nanoseconds(Clock::now() - start, iterations);
+
+    start = Clock::now();
+    for (unsigned long i = 0; i < iterations; i++)
+    {
+        const char* location = locations[i % locationCount];
+        const char* reference = references[i % referenceCount];
+        char* url = (char*)malloc(strlen(location) + strlen(reference) + 1);
+        if (UpnpResolveURL(location, reference, url) == UPNP_E_SUCCESS)
+        {
+            std::string stored = url; /* ParseNewServer keeps a copy */
+            checksum += stored.size();
+        }
+        free(url);
+    }
+    const double legacyResolve = Nanoseconds(Clock::now() - start, iterations);
+
+    start = Clock::now();
+    for (unsigned long i = 0; i < iterations; i++)
+    {
+        std::string stored;
+        if (ResolveUrl(locations[i % locationCount], references[i % referenceCount], stored))
+            checksum -= stored.size();
+    }
+    const double viewResolve = Nanoseconds(Clock::now() - start, iterations);
+
+    printf("ParseUrl            %8.1f ns\n", legacyParse);
+    printf("ParseUrlView        %8.1f ns\n", viewParse);
+    printf("UpnpResolveURL      %8.1f ns\n", legacyResolve);
+    printf("ResolveUrl          %8.1f ns\n", viewResolve);
+    printf("checksum %zu\n", checksum);
+    return result;
+}
@@ -0,0 +1,131 @@
+/*
+ * Golden browse responses through NormalizeResponse and through the ixml round trip it
+ * replaces (ResolveByReparsing): whenever the single pass accepts a response, both must give
+ * the same bytes. Files named *.fallback.xml hold what the single pass must leave to ixml,
+ * every other one has to go through it.
+ *
+ * Each response also goes through Resolve2, whose DIDL-Lite reader must find the objects
+ * TryParseItem finds in the DOM of the Result, with the same fields.
+ *
+ * golden_resolve <directory>
+ */
+#include <algorithm>
+#include <cstdio>
+#include <filesystem>
+#include <string>
+#include <variant>
+#include <vector>
+
+#include "ixml.h"
+
+#include "ResponseNormalizer.h"
+#include "UpnpCommand.h"
+
+namespace
+{
+    /* Empty when Resolve2 and the DOM walk agree */
+    std::string CompareWithDom(IXML_Document* response)
+    {
+        std::variant<BrowseResult, int> resolved = Resolve2(response);
+        if (!std::holds_alternative<BrowseResult>(resolved))
+            return "Resolve2 fails with " + std::to_string(std::get<int>(resolved));
+        const BrowseResult& result = std::get<BrowseResult>(resolved);
+
+        IXML_Document* didl = parseBrowseResult(response);
+        if (!didl)
+            return "Result not parsed by ixml";
+        std::vector<ItemView> expected;
+        for (const char* tag : { "container", "item" })
+        {
+            IXML_NodeList* nodes = ixmlDocument_getElementsByTagName(didl, tag);
+            for (unsigned int i = 0; nodes && i < ixmlNodeList_length(nodes); i++)
+            {
+                if (auto item = TryParseItem((IXML_Element*)ixmlNodeList_item(nodes, i), tag[0] == 'c'))
+                    expected.push_back(*item);
+            }
+            ixmlNodeList_free(nodes);
+        }
+
+        std::string difference;
+        if (result.size() != expected.size())
+            difference = std::to_string(result.size()) + " objects, the DOM has " + std::to_string(expected.size());
+        for (size_t object = 0; object < result.size() && difference.empty(); object++)
+        {
+            if (result.Type(object) != expected[object].media_type)
+                difference = "object " + std::to_string(object) + " has another type";
+            for (size_t field = 0; field < ItemFieldCount && difference.empty(); field++)
+            {
+                if (result.Field(object, field) != expected[object].*ItemFields[field])
+                    difference = "object " + std::to_string(object) + " field " + std::to_string(field) + ": " + std::string(result.Field(object, field))
+                        + " instead of " + std::string(expected[object].*ItemFields[field]);
+            }
+        }
+        ixmlDocument_free(didl);
+        return difference;
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc < 2)
+    {
+        fprintf(stderr, "usage: golden_resolve <directory>\n");
+        return 2;
+    }
+
+    std::vector<std::filesystem::path> files;
+    for (const auto& entry : std::filesystem::directory_iterator(argv[1]))
+    {
+        if (entry.path().extension() == ".xml")
+            files.push_back(entry.path());
+    }
+    std::sort(files.begin(), files.end());
+
+    int result = files.empty() ? 1 : 0;
+    for (const std::filesystem::path& file : files)
+    {
+        const std::string name = file.filename().string();
+        const bool fallback = name.ends_with(".fallback.xml");
+        IXML_Document* response = ixmlLoadDocument(file.string().c_str());
+        if (!response)
+        {
+            fprintf(stderr, "%s: not a valid response\n", name.c_str());
+            result = 1;
+            continue;
+        }
+
+        std::string normalized;
+        const bool single = NormalizeResponse(response, normalized);
+        const std::variant<std::string, int> reparsed = ResolveByReparsing(response);
+        const std::string objects = CompareWithDom(response);
+        ixmlDocument_free(response);
+
+        if (!objects.empty())
+        {
+            fprintf(stderr, "%s: Resolve2 and the DOM differ, %s\n", name.c_str(), objects.c_str());
+            result = 1;
+        }
+        else if (single == fallback)
+        {
+            fprintf(stderr, "%s: %s\n", name.c_str(), single ? "expected to be left to ixml" : "expected to take the single pass");
+            result = 1;
+        }
+        else if (single && !std::holds_alternative<std::string>(reparsed))
+        {
+            fprintf(stderr, "%s: accepted, ixml fails with %d\n", name.c_str(), std::get<int>(reparsed));
+            result = 1;
+        }
+        else if (single && normalized != std::get<std::string>(reparsed))
+        {
+            const std::string& expected = std::get<std::string>(reparsed);
+            auto [at, unused] = std::mismatch(normalized.begin(), normalized.end(), expected.begin(), expected.end());
+            const size_t offset = at - normalized.begin();
+            fprintf(stderr, "%s: differs at byte %zu\nsingle pass: %.80s\nixml:        %.80s\n", name.c_str(), offset,
+                normalized.c_str() + offset, expected.c_str() + std::min(offset, expected.size()));
+            result = 1;
+        }
+        else
+            printf("%s: %s\n", name.c_str(), single ? "same bytes" : "left to ixml");
+    }
+    return result;
+}
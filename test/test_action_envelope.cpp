@@ -0,0 +1,38 @@
+/*
+ * ActionEnvelope: the request text matches what pupnp sends for the same action, values
+ * are escaped, and a buffer written twice holds only the second request.
+ */
+#include <string>
+#include <string_view>
+
+#include "ActionEnvelope.h"
+#include "Check.h"
+
+int main()
+{
+    const ActionEnvelope browse("urn:schemas-upnp-org:service:ContentDirectory:1", "Browse",
+        { "ObjectID", "BrowseFlag", "Filter", "StartingIndex", "RequestedCount", "SortCriteria" });
+
+    std::string request;
+    browse.Write(request, { "64$1", "BrowseDirectChildren", "*", "0", "200", "" });
+    Check(request == "<?xml version=\"1.0\"?>\r\n"
+        "<s:Envelope xmlns:s=\"http://schemas.xmlsoap.org/soap/envelope/\" s:encodingStyle=\"http://schemas.xmlsoap.org/soap/encoding/\"><s:Body>"
+        "<u:Browse xmlns:u=\"urn:schemas-upnp-org:service:ContentDirectory:1\"><ObjectID>64$1</ObjectID><BrowseFlag>BrowseDirectChildren</BrowseFlag>"
+        "<Filter>*</Filter><StartingIndex>0</StartingIndex><RequestedCount>200</RequestedCount><SortCriteria></SortCriteria></u:Browse>"
+        "</s:Body></s:Envelope>\r\n", "browse envelope");
+    Check(browse.Headers() == "CONTENT-TYPE: text/xml; charset=\"utf-8\"\r\nSOAPACTION: \"urn:schemas-upnp-org:service:ContentDirectory:1#Browse\"\r\n", "action headers");
+
+    browse.Write(request, { "a&b<c>", "BrowseMetadata", "dc:title,res@size", "10", "5", "+dc:title" });
+    Check(request.find("<ObjectID>a&amp;b&lt;c&gt;</ObjectID><BrowseFlag>BrowseMetadata</BrowseFlag>") != std::string::npos, "values escaped");
+    Check(request.find("64$1") == std::string::npos && request.find("<SortCriteria>+dc:title</SortCriteria></u:Browse>") != std::string::npos, "buffer replaced");
+
+    const ActionEnvelope capabilities("urn:schemas-upnp-org:service:ContentDirectory:1", "GetSearchCapabilities", {});
+    capabilities.Write(request, {});
+    Check(request.find("<s:Body><u:GetSearchCapabilities xmlns:u=\"urn:schemas-upnp-org:service:ContentDirectory:1\"></u:GetSearchCapabilities></s:Body>") != std::string::npos,
+        "action without arguments");
+
+    std::string escaped;
+    AppendXmlEscaped(escaped, "dc:title contains \"Tom's\"");
+    Check(escaped == "dc:title contains &quot;Tom&apos;s&quot;", "quotes escaped");
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,83 @@
+/*
+ * BrowseResult columns: objects read back as appended, fields already in the text are
+ * referenced rather than copied, containers move first in order and moving the result
+ * keeps the views into it valid.
+ */
+#include <cstring>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "Check.h"
+#include "UpnpCommand.h"
+
+namespace
+{
+    bool Same(const ItemView& a, const ItemView& b)
+    {
+        if (a.media_type != b.media_type)
+            return false;
+        for (auto field : ItemFields)
+        {
+            if (a.*field != b.*field)
+                return false;
+        }
+        return true;
+    }
+}
+
+int main()
+{
+    /* Fields pointing into the adopted text stay there, the others are copied after it */
+    const char didl[] = "c1 Folder i1 Song Genre";
+    BrowseResult result;
+    const char* text = result.Adopt(didl);
+    Check(strcmp(text, didl) == 0, "text adopted");
+
+    ItemView folder;
+    folder.media_type = MediaType::CONTAINER;
+    folder.objectID = std::string_view(text, 2);
+    folder.filename = std::string_view(text + 3, 6);
+    result.Append(folder);
+    Check(result[0].objectID.data() == text && result[0].filename.data() == text + 3, "fields in the text not copied");
+
+    ItemView song;
+    song.media_type = MediaType::AUDIO;
+    song.objectID = std::string_view(text + 10, 2);
+    song.filename = std::string_view(text + 13, 4);
+    song.genre = std::string_view(text + 18, 5);
+    const std::string url = "http://192.168.1.2:8200/MediaItems/1.mp3";
+    song.url = url;
+    result.Append(song);
+    Check(result.size() == 2, "every object appended");
+    Check(result[1].objectID == "i1" && result[1].filename == "Song" && result[1].genre == "Genre", "fields located before the text grew");
+    Check(result[1].url == url && result[1].url.data() != url.data(), "fields outside the text copied");
+    Check(result.Field(0, TitleField) == "Folder" && result.Field(1, ObjectIDField) == "i1", "fields read by column");
+
+    /* Views taken before a move still read the same strings */
+    const ItemView before = result[1];
+    BrowseResult moved = std::move(result);
+    Check(Same(before, moved[1]) && before.url.data() == moved[1].url.data(), "views survive a move");
+
+    /* Stored references are offsets, they stay valid while the text grows */
+    BrowseResult stored;
+    BrowseResult::StringRef fields[ItemFieldCount] = {};
+    fields[ObjectIDField] = stored.Store("64$1");
+    fields[TitleField] = stored.Store("Shared");
+    for (int i = 0; i < 1000; i++)
+        stored.Store("padding that makes the text reallocate");
+    stored.Append(MediaType::VIDEO, fields);
+    stored.Append(MediaType::IMAGE, fields);
+    fields[ObjectIDField] = stored.Store("64");
+    stored.Append(MediaType::CONTAINER, fields);
+    Check(stored.size() == 3 && stored[1].objectID == "64$1" && stored[0].filename == "Shared" && stored[1].url.empty(), "stored strings read back");
+    Check(stored[0].filename.data() == stored[1].filename.data(), "shared references stored once");
+
+    stored.ContainersFirst();
+    Check(stored.Type(0) == MediaType::CONTAINER && stored[0].objectID == "64", "container moved first");
+    Check(stored.Type(1) == MediaType::VIDEO && stored.Type(2) == MediaType::IMAGE && stored[2].objectID == "64$1", "items kept in order");
+
+    stored.Clear();
+    Check(stored.empty(), "cleared");
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,163 @@
+/*
+ * HttpConnectionPool against a loopback server: responses read whole keep their
+ * connection, closing ones don't, a request on a connection the server dropped is sent
+ * again, concurrent requests share no more connections than allowed per host, and idle
+ * connections are closed after the idle timeout with no further request.
+ *
+ * Returns 77 when no loopback socket can be opened.
+ */
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "Check.h"
+#include "HttpConnectionPool.h"
+#include "upnp.h"
+
+namespace
+{
+    std::atomic<int> accepted{ 0 };
+    std::atomic<int> closed{ 0 };
+
+    bool ReadRequest(int client, std::string& request)
+    {
+        request.clear();
+        char chunk[4096];
+        size_t headerEnd;
+        while ((headerEnd = request.find("\r\n\r\n")) == std::string::npos)
+        {
+            ssize_t read = recv(client, chunk, sizeof(chunk), 0);
+            if (read <= 0)
+                return false;
+            request.append(chunk, read);
+        }
+        size_t length = request.find("CONTENT-LENGTH: ");
+        length = length == std::string::npos ? 0 : strtoul(request.c_str() + length + 16, nullptr, 10);
+        while (request.size() < headerEnd + 4 + length)
+        {
+            ssize_t read = recv(client, chunk, sizeof(chunk), 0);
+            if (read <= 0)
+                return false;
+            request.append(chunk, read);
+        }
+        return true;
+    }
+
+    /* The path picks the response */
+    void Serve(int client)
+    {
+        std::string request;
+        while (ReadRequest(client, request))
+        {
+            std::string response;
+            bool last = false;
+            if (request.find(" /chunked ") != std::string::npos)
+                response = "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n5\r\nhello\r\n6;ext=1\r\n world\r\n0\r\nX-Trailer: 1\r\n\r\n";
+            else if (request.find(" /close ") != std::string::npos)
+            {
+                response = "HTTP/1.1 200 OK\r\nConnection: close\r\nContent-Length: 3\r\n\r\nbye";
+                last = true;
+            }
+            else if (request.find(" /eof ") != std::string::npos)
+            {
+                response = "HTTP/1.0 500 Internal Server Error\r\n\r\nuntil closed";
+                last = true;
+            }
+            else if (request.find(" /drop ") != std::string::npos)
+            {
+                /* Answered like a kept connection, then closed anyway */
+                response = "HTTP/1.1 200 OK\r\nContent-Length: 4\r\n\r\ndrop";
+                last = true;
+            }
+            else
+                response = "HTTP/1.1 100 Continue\r\n\r\nHTTP/1.1 200 OK\r\ncontent-length: 2\r\n\r\nok";
+            send(client, response.data(), response.size(), MSG_NOSIGNAL);
+            if (last)
+                break;
+        }
+        close(client);
+        closed++;
+    }
+}
+
+int main()
+{
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t length = sizeof(address);
+    if (listener < 0 || bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) || listen(listener, 16)
+        || getsockname(listener, reinterpret_cast<sockaddr*>(&address), &length))
+        return 77;
+    std::thread([listener]
+        {
+            for (int client; (client = accept(listener, nullptr, nullptr)) >= 0;)
+            {
+                accepted++;
+                std::thread(Serve, client).detach();
+            }
+        }).detach();
+
+    const std::string base = "http://127.0.0.1:" + std::to_string(ntohs(address.sin_port));
+    const auto timeout = std::chrono::milliseconds(3000);
+    HttpConnectionPool pool(2, std::chrono::seconds(15));
+    HttpConnectionPool::Response response;
+
+    bool same = true;
+    for (int i = 0; i < 5; i++)
+        same &= pool.Request("POST", base + "/", "SOAPACTION: \"x\"\r\n", "<body/>", timeout, 1024, response) == UPNP_E_SUCCESS && response.body == "ok";
+    Check(same && accepted == 1, "sequential requests share a connection, interim responses skipped");
+
+    Check(pool.Request("GET", base + "/chunked", "", "", timeout, 1024, response) == UPNP_E_SUCCESS && response.body == "hello world", "chunked body read");
+    Check(pool.Request("GET", base + "/close", "", "", timeout, 1024, response) == UPNP_E_SUCCESS && response.body == "bye", "closing response read");
+    Check(accepted == 1, "connection kept after a chunked body");
+    Check(pool.Request("GET", base + "/", "", "", timeout, 1024, response) == UPNP_E_SUCCESS && accepted == 2, "closed connection not reused");
+    Check(pool.Request("GET", base + "/eof", "", "", timeout, 1024, response) == UPNP_E_SUCCESS && response.status == 500 && response.body == "until closed", "body read to the end of the connection");
+
+    Check(pool.Request("GET", base + "/drop", "", "", timeout, 1024, response) == UPNP_E_SUCCESS, "response before the server dropped the connection");
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    const int before = accepted;
+    Check(pool.Request("GET", base + "/", "", "", timeout, 1024, response) == UPNP_E_SUCCESS && response.body == "ok" && accepted == before + 1, "dropped connection replaced");
+    Check(pool.Request("GET", base + "/chunked", "", "", timeout, 5, response) == UPNP_E_BAD_RESPONSE, "body over the limit refused");
+
+    const int beforeConcurrent = accepted;
+    std::atomic<int> answered{ 0 };
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 8; t++)
+        threads.emplace_back([&]
+            {
+                HttpConnectionPool::Response reply;
+                for (int i = 0; i < 50; i++)
+                {
+                    if (pool.Request("GET", base + "/", "", "", timeout, 1024, reply) == UPNP_E_SUCCESS && reply.body == "ok")
+                        answered++;
+                }
+            });
+    for (std::thread& thread : threads)
+        thread.join();
+    Check(answered == 400, "concurrent requests answered");
+    Check(accepted - beforeConcurrent <= 2, "no more connections than allowed per host");
+
+    pool.Clear();
+    Check(pool.Request("GET", "https://127.0.0.1/", "", "", timeout, 1024, response) == UPNP_E_INVALID_URL, "only http handled");
+    Check(pool.Request("GET", "http://127.0.0.1:1/", "", "", timeout, 1024, response) == UPNP_E_SOCKET_CONNECT, "refused connection reported");
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    const int beforeIdle = closed;
+    HttpConnectionPool reaped(2, std::chrono::seconds(1));
+    Check(reaped.Request("GET", base + "/", "", "", timeout, 1024, response) == UPNP_E_SUCCESS, "request on a short lived pool");
+    std::this_thread::sleep_for(std::chrono::milliseconds(2000));
+    Check(closed == beforeIdle + 1, "idle connection closed without another request");
+
+    fflush(stderr);
+    _exit(failures ? 1 : 0); // The server threads are still blocked in recv
+}
@@ -0,0 +1,138 @@
+/*
+ * LibraryIndex files: what LibraryIndexWriter writes reads back the same once mapped,
+ * shared strings are stored once, and damaged files are refused.
+ *
+ * test_library_index [items per container]
+ */
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "Check.h"
+#include "LibraryIndex.h"
+
+namespace
+{
+    std::vector<Item> MakeItems(unsigned int container, unsigned int count)
+    {
+        std::vector<Item> items;
+        for (unsigned int i = 0; i < count; i++)
+        {
+            Item item;
+            item.media_type = static_cast<MediaType::MEDIA_TYPE>(i % 3);
+            item.objectID = "c" + std::to_string(container) + "/" + std::to_string(i);
+            item.filename = "Title " + std::to_string(i);
+            item.url = "http://192.168.1.2:8200/MediaItems/" + std::to_string(container * count + i) + ".mkv";
+            item.album = "Album " + std::to_string(i % 7);
+            item.genre = "Genre";
+            items.push_back(std::move(item));
+        }
+        return items;
+    }
+
+    std::vector<ItemView> Views(const std::vector<Item>& items)
+    {
+        std::vector<ItemView> views;
+        for (const Item& item : items)
+            views.emplace_back(item);
+        return views;
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    const unsigned int count = argc > 1 ? atoi(argv[1]) : 2000;
+    const std::filesystem::path directory = std::filesystem::temp_directory_path()
+        / ("dlna_index_" + std::to_string(std::chrono::steady_clock::now().time_since_epoch().count()));
+    std::filesystem::create_directories(directory);
+    const std::filesystem::path path = directory / "server.1.idx";
+
+    /* Root lists two containers, each of them count items */
+    Item folder;
+    folder.media_type = MediaType::CONTAINER;
+    std::vector<Item> root;
+    for (const char* id : { "c1", "c0" })
+    {
+        folder.objectID = id;
+        folder.filename = std::string("Folder ") + id;
+        root.push_back(folder);
+    }
+    const std::vector<Item> first = MakeItems(0, count);
+    const std::vector<Item> second = MakeItems(1, count);
+
+    LibraryIndexWriter writer;
+    Check(writer.AddContainer("0", 7, Views(root)), "root added");
+    Check(writer.AddContainer("c1", 0, Views(second)), "c1 added");
+    Check(writer.AddContainer("c0", 3, Views(first)), "c0 added");
+    Check(writer.Write(path, 42), "index written");
+    Check(!std::filesystem::exists(path.string() + ".tmp"), "temporary file renamed");
+
+    {
+        std::shared_ptr<const LibraryIndex> index = LibraryIndex::Open(path);
+        Check(index != nullptr, "index opened");
+        if (index)
+        {
+            Check(index->SystemUpdateID() == 42, "SystemUpdateID kept");
+            Check(index->ItemCount() == root.size() + 2 * count, "every item stored");
+            Check(index->ContainerCount() == 3, "every container stored");
+            Check(!index->FindContainer("c2") && !index->FindContainer(""), "unknown containers not found");
+
+            const LibraryIndex::Container* container = index->FindContainer("c0");
+            Check(container && container->updateID == 3 && container->itemCount == count, "container c0 found");
+            for (unsigned int i = 0; container && i < count; i++)
+            {
+                const ItemView item = index->ItemAt(container->firstItem + i);
+                const Item& expected = first[i];
+                if (item.objectID != expected.objectID || item.filename != expected.filename || item.url != expected.url
+                    || item.album != expected.album || item.genre != expected.genre || !item.artist.empty()
+                    || item.media_type != expected.media_type || index->TitleAt(container->firstItem + i) != expected.filename)
+                {
+                    Check(false, "items read back as written");
+                    break;
+                }
+            }
+
+            const LibraryIndex::Container* top = index->FindContainer("0");
+            Check(top && top->itemCount == 2 && index->TypeAt(top->firstItem) == MediaType::CONTAINER
+                && index->ItemAt(top->firstItem).objectID == "c1", "root lists its containers in order");
+        }
+    }
+
+    /* Albums and genres are shared, the file must be smaller than every string written out */
+    size_t strings = 0;
+    for (const std::vector<Item>* items : { &first, &second })
+        for (const Item& item : *items)
+            strings += item.objectID.size() + item.filename.size() + item.url.size() + item.album.size() + item.genre.size();
+    const size_t fileSize = std::filesystem::file_size(path);
+    Check(fileSize < strings + (root.size() + 2 * count) * (15 * 8 + 1) + 1024, "strings interned");
+    printf("%u items: %zu bytes on disk, %zu bytes of strings\n", 2 * count, fileSize, strings);
+
+    /* A file cut short, or with a reference past the pool, is refused */
+    const std::filesystem::path damaged = directory / "damaged.idx";
+    std::filesystem::copy_file(path, damaged);
+    std::filesystem::resize_file(damaged, fileSize - 1);
+    Check(!LibraryIndex::Open(damaged), "truncated file refused");
+    {
+        std::fstream file(damaged, std::ios::in | std::ios::out | std::ios::binary);
+        std::filesystem::resize_file(damaged, fileSize);
+        file.seekp(40 + 3 * sizeof(LibraryIndex::Container));
+        const LibraryIndex::StringRef outside{ UINT32_MAX - 4, 8 };
+        file.write(reinterpret_cast<const char*>(&outside), sizeof(outside));
+    }
+    Check(!LibraryIndex::Open(damaged), "reference past the pool refused");
+    Check(!LibraryIndex::Open(directory / "missing.idx"), "missing file refused");
+
+    /* Containers must be unique */
+    LibraryIndexWriter duplicates;
+    duplicates.AddContainer("0", 0, {});
+    duplicates.AddContainer("0", 0, {});
+    Check(!duplicates.Write(directory / "duplicates.idx", 0), "duplicate containers refused");
+
+    std::error_code error;
+    std::filesystem::remove_all(directory, error);
+    return failures ? 1 : 0;
+}
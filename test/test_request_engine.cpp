@@ -0,0 +1,52 @@
+/*
+ * RequestEngine: IDs are unique and nonzero, the table refuses requests past its bound,
+ * cancelling reaches the handle, requests finish when the last handle goes, and the
+ * stats count them by outcome.
+ */
+#include <chrono>
+#include <thread>
+
+#include "Check.h"
+#include "RequestEngine.h"
+
+int main()
+{
+    using namespace std::chrono_literals;
+    RequestEngine engine(3);
+
+    RequestEngine::Handle first = engine.Begin(10s);
+    RequestEngine::Handle second = engine.Begin(10s);
+    RequestEngine::Handle third = engine.Begin(10s);
+    Check(first && second && third, "requests begun");
+    Check(first->Id() && first->Id() != second->Id() && second->Id() != third->Id(), "IDs unique and nonzero");
+    Check(!engine.Begin(10s), "request past the bound refused");
+    Check(engine.Stats().inFlight == 3 && engine.Stats().refused == 1, "in flight and refused counted");
+
+    /* The request lives as long as any of its handles */
+    const uint32_t firstId = first->Id();
+    RequestEngine::Handle shared = first;
+    first.reset();
+    Check(engine.Cancel(firstId) && shared->Cancelled() && shared->Abandoned(), "cancel reaches the handle");
+    shared.reset();
+    Check(!engine.Cancel(firstId), "finished request can't be cancelled");
+    Check(engine.Stats().cancelled == 1 && engine.Stats().inFlight == 2, "cancelled request finished");
+
+    RequestEngine::Handle late = engine.Begin(1ms);
+    std::this_thread::sleep_for(5ms);
+    Check(late && late->Expired() && !late->Cancelled() && late->Remaining(30s) == 0ms, "deadline passed");
+    late.reset();
+    second.reset();
+    Check(third->Remaining(1s) <= 1s && third->Remaining(1s) > 0ms, "remaining time bounded");
+    third.reset();
+
+    const DLNARequestStats stats = engine.Stats();
+    Check(stats.inFlight == 0 && stats.completed == 2 && stats.expired == 1 && stats.cancelled == 1, "outcomes counted");
+    Check(stats.latencyP50Ms <= stats.latencyP95Ms && stats.latencyP95Ms <= stats.latencyMaxMs && stats.latencyMaxMs >= 5, "latency percentiles");
+
+    bool begun = true;
+    for (int i = 0; i < 1000; i++)
+        begun &= engine.Begin(1s) != nullptr;
+    Check(begun, "slots released");
+    Check(engine.Stats().completed == 1002, "every finished request counted");
+    return failures ? 1 : 0;
+}
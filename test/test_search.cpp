@@ -0,0 +1,251 @@
+/*
+ * SearchDLNAServers against MediaServerStub, through the exported DLNAModule API. The stub
+ * answers ContentDirectory Search by default; with --browse it reports no SearchCapabilities
+ * and the search has to walk its folders instead. With --loops every folder also lists the
+ * root, the walk must still browse each container once and finish.
+ *
+ * test_search [--browse] [--loops] [--folders N] [--items N] [--pagesize N] [--timeout S]
+ *
+ * Returns 1 when the matches differ from what the stub holds, 77 when no usable network
+ * interface was found (DLNA_IFNAME selects one).
+ */
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+
+#include "rapidjson/document.h"
+#include "rapidjson/stringbuffer.h"
+#include "rapidjson/writer.h"
+
+#include "MediaServerStub.h"
+
+extern "C"
+{
+#if not ENABLE_SLOG
+    bool SetLogFile(const char* path);
+#endif
+    void SKYBOXStartupDLNA();
+    void SKYBOXShutdownDLNA();
+    void SKYBOXDLNAUpdate();
+    bool SearchDLNAServers(const char* json, void (*OnSearchResultCallback)(const char*));
+    void SetAddDLNADeviceCallback(void (*OnAddDLNADevice)(const char* uuid, int uuidLength, const char* title, int titleLength, const char* iconurl, int iconLength, const char* manufacturer, int manufacturerLength));
+    void SetRemoveDLNADeviceCallback(void (*OnRemoveDLNADevice)(const char* uuid, int uuidLength));
+}
+
+namespace
+{
+    using Clock = std::chrono::steady_clock;
+
+    const char* const query = "Item 4";
+
+    std::string serverUDN;
+    std::atomic<bool> serverFound{ false };
+
+    std::mutex searchMutex;
+    std::condition_variable searchDone;
+    struct
+    {
+        std::set<std::string> urls; // Matches from the stub, other servers on the network are ignored
+        unsigned long duplicates = 0;
+        int status = 0;
+        bool serverComplete = false;
+        bool timedOut = false;
+        bool complete = false;
+    } search;
+
+    void OnAddDevice(const char* uuid, int uuidLength, const char*, int, const char*, int, const char*, int)
+    {
+        if (std::string(uuid, uuidLength) == serverUDN)
+            serverFound = true;
+    }
+
+    void OnRemoveDevice(const char*, int)
+    {
+    }
+
+    void OnSearchResult(const char* json)
+    {
+        rapidjson::Document response;
+        response.Parse(json);
+
+        std::lock_guard<std::mutex> lock(searchMutex);
+        if (response.HasParseError() || !response.IsObject() || !response.HasMember("server") || !response.HasMember("complete"))
+        {
+            search.status = -1;
+            search.complete = true;
+        }
+        else
+        {
+            search.complete = response["complete"].GetBool();
+            if (serverUDN == response["server"].GetString())
+            {
+                for (const auto& item : response["results"].GetArray())
+                {
+                    if (!search.urls.insert(item["url"].GetString()).second)
+                        search.duplicates++;
+                }
+                if (response["status"].GetInt())
+                    search.status = response["status"].GetInt();
+                if (response["serverComplete"].GetBool())
+                {
+                    search.serverComplete = true;
+                    search.timedOut = response["timedOut"].GetBool();
+                }
+            }
+        }
+        searchDone.notify_all();
+    }
+
+    std::string SearchRequest(unsigned int pageSize, std::chrono::seconds timeout)
+    {
+        rapidjson::StringBuffer arguments;
+        {
+            rapidjson::Writer<rapidjson::StringBuffer> writer(arguments);
+            writer.StartObject();
+            writer.Key("query");
+            writer.String(query);
+            writer.Key("timeout");
+            writer.Uint(static_cast<unsigned int>(std::chrono::milliseconds(timeout).count()));
+            if (pageSize)
+            {
+                writer.Key("pagesize");
+                writer.Uint(pageSize);
+            }
+            writer.EndObject();
+        }
+
+        rapidjson::StringBuffer request;
+        rapidjson::Writer<rapidjson::StringBuffer> writer(request);
+        writer.StartObject();
+        writer.Key("version");
+        writer.String("2.0");
+        writer.Key("method");
+        writer.String("DLNASearchRequest");
+        writer.Key("arguments");
+        writer.String(arguments.GetString());
+        writer.EndObject();
+        return request.GetString();
+    }
+
+    /* Items are titled "Item <index>" in every folder */
+    unsigned long ExpectedMatches(const MediaServerOptions& options)
+    {
+        unsigned long matches = 0;
+        for (unsigned int index = 0; index < options.itemsPerFolder; index++)
+        {
+            if (("Item " + std::to_string(index)).find(query) != std::string::npos)
+                matches++;
+        }
+        return matches * options.folders;
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    MediaServerOptions options;
+    options.folders = 3;
+    options.itemsPerFolder = 120;
+    options.searchable = true;
+    unsigned int pageSize = 7;
+    std::chrono::seconds timeout{ 30 };
+    for (int i = 1; i < argc; i++)
+    {
+        const bool hasValue = i + 1 < argc;
+        if (!strcmp(argv[i], "--browse"))
+            options.searchable = false;
+        else if (!strcmp(argv[i], "--loops"))
+            options.rootAlias = true;
+        else if (!strcmp(argv[i], "--folders") && hasValue)
+            options.folders = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--items") && hasValue)
+            options.itemsPerFolder = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--pagesize") && hasValue)
+            pageSize = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--timeout") && hasValue)
+            timeout = std::chrono::seconds(atoi(argv[++i]));
+        else
+        {
+            fprintf(stderr, "usage: %s [--browse] [--loops] [--folders N] [--items N] [--pagesize N] [--timeout S]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    const std::filesystem::path scratch = std::filesystem::temp_directory_path() / ("dlna_search_" + std::to_string(Clock::now().time_since_epoch().count()));
+    std::filesystem::create_directories(scratch);
+#if not ENABLE_SLOG
+    SetLogFile((scratch / "search.log").string().c_str());
+#endif
+
+    SetAddDLNADeviceCallback(OnAddDevice);
+    SetRemoveDLNADeviceCallback(OnRemoveDevice);
+    SKYBOXStartupDLNA();
+
+    int result = 0;
+    MediaServerStub server(options);
+    serverUDN = server.UDN();
+    const Clock::time_point advertised = Clock::now();
+    if (server.Start() != UPNP_E_SUCCESS)
+    {
+        fprintf(stderr, "No usable network interface, set DLNA_IFNAME\n");
+        result = 77;
+    }
+
+    while (!result && !serverFound && Clock::now() - advertised < timeout)
+    {
+        SKYBOXDLNAUpdate();
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    if (!result && !serverFound)
+    {
+        fprintf(stderr, "Server was not discovered within %llds\n", static_cast<long long>(timeout.count()));
+        result = 1;
+    }
+
+    if (!result && !SearchDLNAServers(SearchRequest(pageSize, timeout).c_str(), OnSearchResult))
+    {
+        fprintf(stderr, "Search was refused\n");
+        result = 1;
+    }
+
+    if (!result)
+    {
+        std::unique_lock<std::mutex> lock(searchMutex);
+        const unsigned long expected = ExpectedMatches(options);
+        if (!searchDone.wait_for(lock, timeout + std::chrono::seconds(5), [] { return search.complete; }))
+        {
+            fprintf(stderr, "Search did not complete\n");
+            result = 1;
+        }
+        else if (search.status || !search.serverComplete || search.timedOut)
+        {
+            fprintf(stderr, "Search on the stub ended with status %d, serverComplete %d, timedOut %d\n", search.status, search.serverComplete, search.timedOut);
+            result = 1;
+        }
+        else if (search.urls.size() != expected || search.duplicates)
+        {
+            fprintf(stderr, "Found %lu matches and %lu duplicates, expected %lu matches\n", static_cast<unsigned long>(search.urls.size()), search.duplicates, expected);
+            result = 1;
+        }
+        else if (options.searchable ? !server.SearchRequests() || server.BrowseRequests() : server.SearchRequests() || !server.BrowseRequests())
+        {
+            fprintf(stderr, "Stub saw %lu Search and %lu Browse requests\n", server.SearchRequests(), server.BrowseRequests());
+            result = 1;
+        }
+        else
+            printf("%lu matches through %lu Search and %lu Browse requests\n", expected, server.SearchRequests(), server.BrowseRequests());
+    }
+
+    server.Stop();
+    SKYBOXShutdownDLNA();
+    std::error_code error;
+    std::filesystem::remove_all(scratch, error);
+    return result;
+}
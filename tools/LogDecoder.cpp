@@ -0,0 +1,178 @@
+/*
+ * Turns a binary log (ENABLE_BINARY_LOG) back into the lines the text logger writes.
+ *
+ * LogDecoder <log file>...
+ */
+#include <cstdio>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "LogRecord.h"
+
+using namespace logger::binary;
+
+namespace
+{
+    struct CallSite
+    {
+        std::string file;
+        std::string function;
+        uint32_t line = 0;
+        uint32_t column = 0;
+        std::vector<std::string> literals; // One more than placeholders
+        std::vector<std::string> placeholders;
+    };
+
+    void SplitFormat(std::string_view format, CallSite& site)
+    {
+        size_t literal = 0;
+        for (size_t i = 0; i < format.size(); i++)
+        {
+            if (format[i] != '%')
+                continue;
+            site.literals.emplace_back(format.substr(literal, i - literal));
+            site.placeholders.emplace_back(format.substr(i, 2));
+            literal = std::min(i + 2, format.size());
+            i = literal - 1;
+        }
+        site.literals.emplace_back(format.substr(literal));
+    }
+
+    // Writes the next argument as the text logger would have streamed it.
+    bool WriteArgument(Reader& reader, std::ostream& os)
+    {
+        switch (reader.Get<ArgumentTag>())
+        {
+        case ArgumentTag::Null: os << "(compile-time nullptr)"; break;
+        case ArgumentTag::NullString: os << "(runtime nullptr)"; break;
+        case ArgumentTag::Bool: os << static_cast<bool>(reader.Get<uint8_t>()); break;
+        case ArgumentTag::Char: os << reader.Get<char>(); break;
+        case ArgumentTag::Signed: os << reader.Get<int64_t>(); break;
+        case ArgumentTag::Unsigned: os << reader.Get<uint64_t>(); break;
+        case ArgumentTag::Double: os << reader.Get<double>(); break;
+        case ArgumentTag::Pointer: os << reinterpret_cast<const void*>(static_cast<uintptr_t>(reader.Get<uint64_t>())); break;
+        case ArgumentTag::String: os << reader.GetString(); break;
+        default: return false;
+        }
+        return reader.Valid();
+    }
+
+    void WriteEntry(Reader& reader, const std::map<uint32_t, CallSite>& callSites, std::ostream& os)
+    {
+        const uint32_t id = reader.Get<uint32_t>();
+        const char level = reader.Get<char>();
+        const int64_t nanoseconds = reader.Get<int64_t>();
+        const uint64_t thread = reader.Get<uint64_t>();
+
+        const time_t seconds = static_cast<time_t>(nanoseconds / 1000000000);
+        std::tm local{};
+#if _WIN64
+        localtime_s(&local, &seconds);
+#else
+        localtime_r(&seconds, &local);
+#endif
+        os << std::put_time(&local, "%F %T ") << "[" << level << "]" << "[thread " << thread << "] ";
+
+        auto site = callSites.find(id);
+        if (site == callSites.end())
+        {
+            os << "(unknown call site " << id << ")\n";
+            return;
+        }
+        if (!site->second.file.empty())
+            os << site->second.file << "(" << site->second.line << "," << site->second.column << ","
+                << std::quoted(site->second.function) << "): ";
+
+        size_t index = 0;
+        for (; index < site->second.placeholders.size() && !reader.Empty(); index++)
+        {
+            os << site->second.literals[index];
+            if (!WriteArgument(reader, os))
+            {
+                os << "(corrupt argument)\n";
+                return;
+            }
+        }
+        for (; index < site->second.placeholders.size(); index++)
+            os << site->second.literals[index] << site->second.placeholders[index];
+        os << site->second.literals.back() << "\n";
+    }
+
+    bool Decode(const char* path, std::ostream& os)
+    {
+        std::ifstream file{ path, std::ios::in | std::ios::binary };
+        if (!file.is_open())
+        {
+            fprintf(stderr, "%s: cannot open\n", path);
+            return false;
+        }
+        std::stringstream content;
+        content << file.rdbuf();
+        const std::string data = content.str();
+        if (data.size() < sizeof(Magic) || data.compare(0, sizeof(Magic), Magic, sizeof(Magic)))
+        {
+            fprintf(stderr, "%s: not a binary DLNAModule log\n", path);
+            return false;
+        }
+
+        std::map<uint32_t, CallSite> callSites;
+        for (size_t offset = sizeof(Magic); offset < data.size();)
+        {
+            Reader header{ std::string_view(data).substr(offset) };
+            const uint32_t size = header.Get<uint32_t>();
+            if (!header.Valid() || size < sizeof(uint32_t) + sizeof(RecordType) || size > data.size() - offset)
+            {
+                fprintf(stderr, "%s: truncated or corrupt record at offset %zu\n", path, offset);
+                return false;
+            }
+
+            Reader reader{ std::string_view(data).substr(offset + sizeof(uint32_t), size - sizeof(uint32_t)) };
+            switch (reader.Get<RecordType>())
+            {
+            case RecordType::CallSite:
+            {
+                const uint32_t id = reader.Get<uint32_t>();
+                CallSite site;
+                site.line = reader.Get<uint32_t>();
+                site.column = reader.Get<uint32_t>();
+                SplitFormat(reader.GetString(), site);
+                site.file = reader.GetString();
+                site.function = reader.GetString();
+                callSites.insert_or_assign(id, std::move(site));
+                break;
+            }
+            case RecordType::Entry:
+                WriteEntry(reader, callSites, os);
+                break;
+            case RecordType::Dropped:
+                os << "[W] " << reader.Get<uint64_t>() << " log messages dropped, logging threads outran the writer\n";
+                break;
+            default:
+                break;
+            }
+            offset += size;
+        }
+        return true;
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc < 2)
+    {
+        fprintf(stderr, "usage: %s <log file>...\n", argv[0]);
+        return 2;
+    }
+
+    int result = 0;
+    for (int i = 1; i < argc; i++)
+        if (!Decode(argv[i], std::cout))
+            result = 1;
+    return result;
+}